@@ -0,0 +1,132 @@
+#include "blob_store.h"
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+using std::array;
+using std::atomic;
+using std::hash;
+using std::lock_guard;
+using std::make_shared;
+using std::memory_order_relaxed;
+using std::move;
+using std::next;
+using std::shared_ptr;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::unordered_multimap;
+using std::vector;
+using std::weak_ptr;
+
+namespace
+{
+    constexpr size_t shard_count = 64;
+}  // namespace
+
+// Removes its entry from the store once the last holder is gone
+struct server::BlobStore::Blob
+{
+    Blob(shared_ptr<const string>&& content, size_t hash) noexcept;
+    Blob(const Blob&) = delete;
+    ~Blob();
+
+    Blob& operator=(const Blob&) = delete;
+
+    shared_ptr<const string> content;
+    size_t hash;
+};
+
+// The store only refers to the blobs, shards keep threads interning different contents from
+// contending
+struct server::BlobStore::Table
+{
+    struct Shard
+    {
+        std::mutex mutex;
+        unordered_multimap<size_t, weak_ptr<const Blob>> blobs;
+    };
+
+    // Never destroyed, contents in static objects may outlive every other static
+    static Table& instance()
+    {
+        static Table* table = new Table;
+        return *table;
+    }
+
+    Shard& shard_of(size_t hash) noexcept
+    {
+        return shards[hash % shard_count];
+    }
+
+    array<Shard, shard_count> shards;
+    atomic<size_t> blob_count = 0;
+    atomic<size_t> blob_size = 0;
+};
+
+server::BlobStore::Blob::Blob(shared_ptr<const string>&& content, size_t hash) noexcept
+    : content(move(content))
+    , hash(hash)
+{
+    Table& table = Table::instance();
+    table.blob_count.fetch_add(1, memory_order_relaxed);
+    table.blob_size.fetch_add(this->content->size(), memory_order_relaxed);
+}
+
+server::BlobStore::Blob::~Blob()
+{
+    Table& table = Table::instance();
+    table.blob_count.fetch_sub(1, memory_order_relaxed);
+    table.blob_size.fetch_sub(content->size(), memory_order_relaxed);
+
+    // The store may already hold a newer blob with the same content, only expired ones go
+    auto& shard = table.shard_of(hash);
+    lock_guard lock(shard.mutex);
+    auto [iter, last] = shard.blobs.equal_range(hash);
+    while (iter != last) {
+        iter = iter->second.expired() ? shard.blobs.erase(iter) : next(iter);
+    }
+}
+
+shared_ptr<const string> server::BlobStore::intern(shared_ptr<const string> content)
+{
+    const size_t content_hash = hash<string_view>{}(*content);
+    auto& shard = Table::instance().shard_of(content_hash);
+    // Other blobs with the same hash, released only after the lock since the last reference
+    // destroys the blob, which takes the lock again
+    vector<shared_ptr<const Blob>> other_blobs;
+    lock_guard lock(shard.mutex);
+    const auto [first, last] = shard.blobs.equal_range(content_hash);
+    for (auto iter = first; iter != last; ++iter) {
+        auto blob = iter->second.lock();
+        if (blob == nullptr) {
+            continue;
+        }
+        if (*blob->content == *content) {
+            const string* blob_content = blob->content.get();
+            return { move(blob), blob_content };
+        }
+        other_blobs.push_back(move(blob));
+    }
+
+    auto blob = make_shared<const Blob>(move(content), content_hash);
+    shard.blobs.emplace(content_hash, blob);
+    const string* blob_content = blob->content.get();
+    return { move(blob), blob_content };
+}
+
+size_t server::BlobStore::blob_count() noexcept
+{
+    return Table::instance().blob_count.load(memory_order_relaxed);
+}
+
+size_t server::BlobStore::blob_size() noexcept
+{
+    return Table::instance().blob_size.load(memory_order_relaxed);
+}
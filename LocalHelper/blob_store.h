@@ -0,0 +1,27 @@
+#pragma once
+#ifndef BLOB_STORE_H_
+#  define BLOB_STORE_H_
+#  include <cstddef>
+
+#  include <memory>
+#  include <string>
+
+namespace server
+{
+    // Contents stored once however many files hold them, shared by all threads. A blob leaves
+    // the store when its last holder lets go of it.
+    class BlobStore
+    {
+    public:
+        // The blob equal to content, content itself becomes the blob if there is none yet
+        static std::shared_ptr<const std::string>
+        intern(std::shared_ptr<const std::string> content);
+        // Of the blobs currently alive
+        static std::size_t blob_count() noexcept;
+        static std::size_t blob_size() noexcept;
+    private:
+        struct Blob;
+        struct Table;
+    };
+}  // namespace server
+#endif  // !BLOB_STORE_H_
@@ -0,0 +1,172 @@
+#include "chunked_content.h"
+
+#include <algorithm>
+using std::make_shared;
+using std::memory_order_acquire;
+using std::min;
+using std::move;
+using std::size_t;
+using std::span;
+using std::string;
+using std::string_view;
+
+server::ChunkedContent::ChunkedContent(string_view content)
+{
+    append(content);
+}
+
+server::ChunkedContent::ChunkedContent(const ChunkedContent& right)
+    : m_chunks(right.m_chunks)
+    , m_size(right.m_size)
+    , m_view(right.m_view.load())
+{}
+
+server::ChunkedContent::ChunkedContent(ChunkedContent&& right) noexcept
+    : m_chunks(move(right.m_chunks))
+    , m_size(right.m_size)
+    , m_view(right.m_view.exchange(nullptr))
+{
+    right.m_chunks.clear();
+    right.m_size = 0;
+}
+
+server::ChunkedContent& server::ChunkedContent::operator=(const ChunkedContent& right)
+{
+    m_chunks = right.m_chunks;
+    m_size = right.m_size;
+    m_view = right.m_view.load();
+    return *this;
+}
+
+server::ChunkedContent& server::ChunkedContent::operator=(ChunkedContent&& right) noexcept
+{
+    m_chunks = move(right.m_chunks);
+    m_size = right.m_size;
+    m_view = right.m_view.exchange(nullptr);
+    right.m_chunks.clear();
+    right.m_size = 0;
+    return *this;
+}
+
+string& server::ChunkedContent::writable_chunk(size_t index)
+{
+    auto& chunk = m_chunks[index];
+    if (chunk.use_count() != 1) {
+        chunk = make_shared<string>(*chunk);
+    }
+
+    return *chunk;
+}
+
+template <typename Extend>
+void server::ChunkedContent::extend(size_t count, Extend&& extend)
+{
+    for (size_t extended = 0; extended < count;) {
+        if (m_chunks.empty() || m_chunks.back()->size() == chunk_size) {
+            m_chunks.push_back(make_shared<string>());
+        }
+
+        string& chunk = writable_chunk(m_chunks.size() - 1);
+        const size_t extended_now = min(chunk_size - chunk.size(), count - extended);
+        extend(chunk, extended, extended_now);
+        extended += extended_now;
+        m_size += extended_now;
+    }
+
+    m_view.store(nullptr);
+}
+
+size_t server::ChunkedContent::read(span<char> buffer, size_t offset) const noexcept
+{
+    size_t copied = 0;
+    while (copied < buffer.size() && offset < m_size) {
+        const string& chunk = *m_chunks[offset / chunk_size];
+        const size_t chunk_offset = offset % chunk_size;
+        const size_t count = min(buffer.size() - copied, chunk.size() - chunk_offset);
+        chunk.copy(buffer.data() + copied, count, chunk_offset);
+        copied += count;
+        offset += count;
+    }
+
+    return copied;
+}
+
+void server::ChunkedContent::write(size_t offset, string_view data)
+{
+    if (data.empty()) {
+        return;
+    }
+    if (offset > m_size) {
+        truncate(offset);
+    }
+
+    // Overwrites up to the end in every chunk it touches, the rest is appended
+    const size_t overwritten = min(data.size(), m_size - offset);
+    for (size_t written = 0; written < overwritten;) {
+        const size_t position = offset + written;
+        const size_t chunk_offset = position % chunk_size;
+        const size_t count = min(chunk_size - chunk_offset, overwritten - written);
+        writable_chunk(position / chunk_size).replace(
+            chunk_offset,
+            count,
+            data.substr(written, count)
+        );
+        written += count;
+    }
+
+    m_view.store(nullptr);
+    append(data.substr(overwritten));
+}
+
+void server::ChunkedContent::append(string_view data)
+{
+    extend(data.size(), [data](string& chunk, size_t offset, size_t count) {
+        chunk.append(data.substr(offset, count));
+    });
+}
+
+void server::ChunkedContent::truncate(size_t size)
+{
+    if (size > m_size) {
+        extend(size - m_size, [](string& chunk, size_t, size_t count) {
+            chunk.append(count, '\0');
+        });
+        return;
+    }
+    if (size == m_size) {
+        return;
+    }
+
+    const size_t chunk_count = (size + chunk_size - 1) / chunk_size;
+    m_chunks.resize(chunk_count);
+    if (size % chunk_size != 0) {
+        writable_chunk(chunk_count - 1).resize(size % chunk_size);
+    }
+    m_size = size;
+    m_view.store(nullptr);
+}
+
+string server::ChunkedContent::flatten() const
+{
+    string content;
+    content.reserve(m_size);
+    for (const auto& chunk : m_chunks) {
+        content += *chunk;
+    }
+
+    return content;
+}
+
+string_view server::ChunkedContent::view() const
+{
+    auto content = m_view.load(memory_order_acquire);
+    if (content == nullptr) {
+        // Concurrent readers may both flatten, the loser takes the copy of the winner
+        auto flattened_content = make_shared<const string>(flatten());
+        if (m_view.compare_exchange_strong(content, flattened_content)) {
+            content = move(flattened_content);
+        }
+    }
+
+    return *content;
+}
@@ -0,0 +1,96 @@
+#pragma once
+#ifndef CHUNKED_CONTENT_H_
+#  define CHUNKED_CONTENT_H_
+#  include <cstddef>
+
+#  include <algorithm>
+#  include <atomic>
+#  include <memory>
+#  include <span>
+#  include <string>
+#  include <string_view>
+#  include <vector>
+
+namespace server
+{
+    // Content split into chunks of chunk_size chars, only the last one may be shorter. Copies
+    // share their chunks until one of them changes, so an edit costs O(chunk) at any size.
+    class ChunkedContent
+    {
+    public:
+        static constexpr std::size_t chunk_size = std::size_t{ 64 } << 10;
+
+        ChunkedContent() = default;
+        explicit ChunkedContent(std::string_view content);
+        ChunkedContent(const ChunkedContent& right);
+        ChunkedContent(ChunkedContent&& right) noexcept;
+
+        ChunkedContent& operator=(const ChunkedContent& right);
+        ChunkedContent& operator=(ChunkedContent&& right) noexcept;
+
+        inline std::size_t size() const noexcept;
+        // Copies content from offset into buffer, returns the number of chars copied
+        std::size_t read(std::span<char> buffer, std::size_t offset = 0) const noexcept;
+        // Writing beyond the end fills the gap with '\0'
+        void write(std::size_t offset, std::string_view data);
+        void append(std::string_view data);
+        // Shrinks to size or extends with '\0'
+        void truncate(std::size_t size);
+        template <typename Function>
+        void for_each_chunk(Function&& function) const;
+        // Calls function(chunk, piece) for the pieces of [offset, offset + size) in order. A kept
+        // chunk is never changed in place, so piece lives and stays the same as long as it.
+        template <typename Function>
+        void for_each_shared_chunk(std::size_t offset, std::size_t size, Function&& function) const;
+        std::string flatten() const;
+        // Contiguous copy made on first use and kept until the next change
+        std::string_view view() const;
+    private:
+        using chunk_pointer = std::shared_ptr<std::string>;
+
+        // Copies the chunk first if another content shares it
+        std::string& writable_chunk(std::size_t index);
+        // Grows by count chars, extend(chunk, offset, n) adds the n chars starting at offset
+        template <typename Extend>
+        void extend(std::size_t count, Extend&& extend);
+
+        std::vector<chunk_pointer> m_chunks;
+        std::size_t m_size = 0;
+        mutable std::atomic<std::shared_ptr<const std::string>> m_view;
+    };
+
+    inline std::size_t ChunkedContent::size() const noexcept
+    {
+        return m_size;
+    }
+
+    template <typename Function>
+    void ChunkedContent::for_each_chunk(Function&& function) const
+    {
+        for (const auto& chunk : m_chunks) {
+            function(std::string_view{ *chunk });
+        }
+    }
+
+    template <typename Function>
+    void ChunkedContent::for_each_shared_chunk(
+        std::size_t offset,
+        std::size_t size,
+        Function&& function
+    ) const
+    {
+        if (offset >= m_size) {
+            return;
+        }
+
+        size = std::min(size, m_size - offset);
+        for (auto index = offset / chunk_size; size != 0; ++index) {
+            const std::string_view chunk{ *m_chunks[index] };
+            const auto piece = chunk.substr(offset - index * chunk_size, size);
+            function(std::shared_ptr<const void>{ m_chunks[index] }, piece);
+            offset += piece.size();
+            size -= piece.size();
+        }
+    }
+}  // namespace server
+#endif  // !CHUNKED_CONTENT_H_
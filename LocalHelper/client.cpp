@@ -0,0 +1,207 @@
+#include "client.h"
+
+#include <cstddef>
+#include <iterator>
+#include <span>
+#include <stdexcept>
+#include <utility>
+
+using std::invalid_argument;
+using std::make_move_iterator;
+using std::runtime_error;
+using std::size_t;
+using std::span;
+using std::string;
+using std::string_view;
+using std::uint16_t;
+using std::uint32_t;
+using std::uint64_t;
+using std::uint8_t;
+using std::vector;
+
+server::Client::Client(string_view host, uint16_t port) : m_socket(Socket::connect(host, port))
+{}
+
+template <typename Function>
+string_view server::Client::call(Protocol::Opcode opcode, Function&& add)
+{
+    send(opcode, add);
+    return receive();
+}
+
+template <typename Function>
+void server::Client::send(Protocol::Opcode opcode, Function&& add)
+{
+    if (!is_connected()) {
+        throw runtime_error{ "The connection is closed." };
+    }
+
+    m_request.clear();
+    Protocol::Writer request{ m_request };
+    const auto mark = request.begin_frame(++m_id);
+    request.add_byte(static_cast<uint8_t>(opcode));
+    add(request);
+    request.end_frame(mark);
+    try {
+        m_request.for_each_buffer([this](string_view data) { m_socket.send_all(data); });
+    } catch (...) {
+        m_socket.close();
+        throw;
+    }
+}
+
+string_view server::Client::receive()
+{
+    try {
+        // Responses are not limited to Protocol::max_frame_size
+        receive_exactly(Protocol::header_size);
+        Protocol::Reader header{ m_response };
+        const auto size = header.read_integer();
+        const auto id = header.read_integer();
+        if (size <= sizeof(id) || id != m_id) {
+            throw ProtocolError{ "The response does not match the request." };
+        }
+        receive_exactly(size - sizeof(id));
+    } catch (...) {
+        m_socket.close();
+        throw;
+    }
+
+    Protocol::Reader response{ m_response };
+    const auto status = static_cast<Protocol::Status>(response.read_byte());
+    const string_view results{ string_view{ m_response }.substr(1) };
+    if (status == Protocol::Status::ok) {
+        return results;
+    }
+
+    const string message{ Protocol::Reader{ results }.read_string() };
+    if (status == Protocol::Status::not_found) {
+        throw invalid_argument{ message };
+    }
+    throw runtime_error{ message };
+}
+
+string server::Client::get(string_view path)
+{
+    Protocol::Reader results{ call(Protocol::Opcode::get, [&](Protocol::Writer& request) {
+        request.add_string(path);
+    }) };
+    return string{ results.read_string() };
+}
+
+string server::Client::read(string_view path, uint64_t offset, uint32_t size)
+{
+    Protocol::Reader results{ call(Protocol::Opcode::read, [&](Protocol::Writer& request) {
+        request.add_string(path).add_long(offset).add_integer(size);
+    }) };
+    return string{ results.read_string() };
+}
+
+server::Protocol::Stat server::Client::stat(string_view path)
+{
+    Protocol::Reader results{ call(Protocol::Opcode::stat, [&](Protocol::Writer& request) {
+        request.add_string(path);
+    }) };
+    const auto kind = static_cast<Protocol::Kind>(results.read_byte());
+    return { kind, results.read_long() };
+}
+
+void server::Client::create(
+    string_view folder,
+    Protocol::Kind kind,
+    string_view name,
+    string_view content,
+    bool overwrite
+)
+{
+    call(Protocol::Opcode::create, [&](Protocol::Writer& request) {
+        request.add_string(folder).add_byte(static_cast<uint8_t>(kind)).add_string(name);
+        request.add_byte(overwrite);
+        if (kind == Protocol::Kind::file) {
+            request.add_string(content);
+        }
+    });
+}
+
+bool server::Client::remove(string_view path)
+{
+    Protocol::Reader results{ call(Protocol::Opcode::remove, [&](Protocol::Writer& request) {
+        request.add_string(path);
+    }) };
+    return results.read_byte() != 0;
+}
+
+vector<string> server::Client::search(string_view name)
+{
+    begin_search(name);
+    return end_search();
+}
+
+void server::Client::begin_search(string_view name)
+{
+    send(Protocol::Opcode::search, [&](Protocol::Writer& request) { request.add_string(name); });
+}
+
+vector<string> server::Client::end_search()
+{
+    Protocol::Reader results{ receive() };
+    vector<string> paths(results.read_integer());
+    for (auto& path : paths) {
+        path = results.read_string();
+    }
+    return paths;
+}
+
+server::Protocol::Page server::Client::list(string_view path, string_view cursor, uint32_t limit)
+{
+    Protocol::Reader results{ call(Protocol::Opcode::list, [&](Protocol::Writer& request) {
+        request.add_string(path).add_string(cursor).add_integer(limit);
+    }) };
+    Protocol::Page page;
+    page.entries.resize(results.read_integer());
+    for (auto& entry : page.entries) {
+        entry.kind = static_cast<Protocol::Kind>(results.read_byte());
+        entry.name = results.read_string();
+    }
+    page.cursor = results.read_string();
+    return page;
+}
+
+vector<server::Protocol::Entry> server::Client::list(string_view path)
+{
+    auto page = list(path, {}, Protocol::max_list_size);
+    auto entries = std::move(page.entries);
+    while (!page.cursor.empty()) {
+        page = list(path, page.cursor, Protocol::max_list_size);
+        entries.insert(
+            entries.end(),
+            make_move_iterator(page.entries.begin()),
+            make_move_iterator(page.entries.end())
+        );
+    }
+    return entries;
+}
+
+string server::Client::metrics()
+{
+    Protocol::Reader results{ call(Protocol::Opcode::metrics, [](Protocol::Writer&) {}) };
+    return string{ results.read_string() };
+}
+
+string server::Client::trace()
+{
+    Protocol::Reader results{ call(Protocol::Opcode::trace, [](Protocol::Writer&) {}) };
+    return string{ results.read_string() };
+}
+
+void server::Client::receive_exactly(size_t size)
+{
+    m_response.resize(size);
+    for (size_t received = 0; received < size;) {
+        const auto count = m_socket.receive_some(span{ m_response }.subspan(received));
+        if (count == 0) {
+            throw runtime_error{ "The connection was closed." };
+        }
+        received += count;
+    }
+}
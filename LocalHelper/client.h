@@ -0,0 +1,70 @@
+#pragma once
+#ifndef CLIENT_H_
+#  define CLIENT_H_
+#  include <cstdint>
+
+#  include <string>
+#  include <string_view>
+#  include <vector>
+
+#  include "event_loop.h"
+#  include "protocol.h"
+
+namespace server
+{
+    // Blocking connection to a Server which sends one request at a time, not thread-safe. A
+    // failure status is thrown as FileSystem does: std::invalid_argument for an unknown name,
+    // std::runtime_error otherwise.
+    class Client
+    {
+    public:
+        Client(std::string_view host, std::uint16_t port);
+
+        std::string get(std::string_view path);
+        std::string read(std::string_view path, std::uint64_t offset, std::uint32_t size);
+        Protocol::Stat stat(std::string_view path);
+        // content is ignored for a folder
+        void create(
+            std::string_view folder,
+            Protocol::Kind kind,
+            std::string_view name,
+            std::string_view content,
+            bool overwrite
+        );
+        bool remove(std::string_view path);
+        std::vector<std::string> search(std::string_view name);
+        // search in two halves, so that searches on several connections wait at the same time.
+        // Nothing else may be called in between.
+        void begin_search(std::string_view name);
+        std::vector<std::string> end_search();
+        // At most limit children after cursor in name order, see Folder::list
+        Protocol::Page list(std::string_view path, std::string_view cursor, std::uint32_t limit);
+        // Every child, page by page, so a child added or removed meanwhile may be missing
+        std::vector<Protocol::Entry> list(std::string_view path);
+        std::string metrics();
+        std::string trace();
+        // False once the connection broke, the server closes it after a malformed request
+        inline bool is_connected() const noexcept;
+    private:
+        // Sends the request whose arguments add writes, returns the results of an ok response.
+        // They stay valid until the next call.
+        template <typename Function>
+        std::string_view call(Protocol::Opcode opcode, Function&& add);
+        template <typename Function>
+        void send(Protocol::Opcode opcode, Function&& add);
+        // The results of the response to the last request sent
+        std::string_view receive();
+        void receive_exactly(std::size_t size);
+
+        Socket m_socket;
+        std::uint32_t m_id = 0;
+        Protocol::Output m_request;
+        std::string m_response;
+    };
+
+    inline bool Client::is_connected() const noexcept
+    {
+        return m_socket.is_open();
+    }
+}  // namespace server
+#endif  // !CLIENT_H_
@@ -0,0 +1,153 @@
+#include "epoch.h"
+using std::function;
+using std::lock_guard;
+using std::make_shared;
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::memory_order_release;
+using std::memory_order_seq_cst;
+using std::move;
+using std::size_t;
+using std::uint64_t;
+using std::vector;
+using std::weak_ptr;
+
+namespace
+{
+    std::atomic<uint64_t> s_next_domain_id = 0;
+
+    // Participants of the calling thread, given back to their domains when it exits
+    template <typename Registry, typename Participant>
+    struct ThreadParticipants
+    {
+        struct Entry
+        {
+            uint64_t domain_id;
+            weak_ptr<Registry> registry;
+            Participant* participant;
+        };
+
+        ~ThreadParticipants()
+        {
+            for (auto& entry : entries) {
+                if (const auto registry = entry.registry.lock()) {
+                    entry.participant->in_use.store(false, memory_order_release);
+                }
+            }
+        }
+
+        vector<Entry> entries;
+    };
+}  // namespace
+
+server::EpochDomain::Guard::Guard(const EpochDomain& domain) : m_participant(domain.participant())
+{
+    // The exchange keeps the loads of the critical section from moving before the pin
+    if (m_participant.nesting++ == 0) {
+        const uint64_t epoch = domain.m_epoch.load(memory_order_seq_cst);
+        m_participant.epoch.exchange(epoch, memory_order_seq_cst);
+    }
+}
+
+server::EpochDomain::Guard::~Guard()
+{
+    if (--m_participant.nesting == 0) {
+        m_participant.epoch.store(0, memory_order_release);
+    }
+}
+
+server::EpochDomain::EpochDomain()
+    : m_id(s_next_domain_id.fetch_add(1, memory_order_relaxed))
+    , m_registry(make_shared<Registry>())
+{}
+
+server::EpochDomain::~EpochDomain()
+{
+    for (auto& [epoch, destroy] : m_retired) {
+        destroy();
+    }
+}
+
+void server::EpochDomain::retire(function<void()> destroy)
+{
+    bool should_collect = false;
+    {
+        lock_guard lock(m_retired_mutex);
+        m_retired.emplace_back(m_epoch.load(memory_order_seq_cst), move(destroy));
+        should_collect = ++m_retired_since_collect >= collect_interval;
+    }
+
+    if (should_collect) {
+        collect();
+    }
+}
+
+void server::EpochDomain::collect()
+{
+    vector<function<void()>> reclaimable;
+    {
+        lock_guard lock(m_retired_mutex);
+        m_retired_since_collect = 0;
+        try_advance();
+        // A reader pinned in epoch e keeps the epoch below e + 2
+        const uint64_t epoch = m_epoch.load(memory_order_relaxed);
+        auto iter = m_retired.begin();
+        for (; iter != m_retired.end() && iter->first + 2 <= epoch; ++iter) {
+            reclaimable.push_back(move(iter->second));
+        }
+        m_retired.erase(m_retired.begin(), iter);
+    }
+
+    for (auto& destroy : reclaimable) {
+        destroy();
+    }
+}
+
+server::EpochDomain::Participant& server::EpochDomain::participant() const
+{
+    thread_local ThreadParticipants<Registry, Participant> thread_participants;
+    auto& entries = thread_participants.entries;
+    for (const auto& entry : entries) {
+        if (entry.domain_id == m_id) {
+            return *entry.participant;
+        }
+    }
+
+    std::erase_if(entries, [](const auto& entry) { return entry.registry.expired(); });
+
+    Participant* found_participant = nullptr;
+    {
+        lock_guard lock(m_registry->mutex);
+        for (auto& participant : m_registry->participants) {
+            bool in_use = false;
+            if (participant.in_use.compare_exchange_strong(in_use, true, memory_order_acquire)) {
+                found_participant = &participant;
+                break;
+            }
+        }
+        if (found_participant == nullptr) {
+            found_participant = &m_registry->participants.emplace_back();
+            found_participant->in_use.store(true, memory_order_relaxed);
+        }
+    }
+
+    entries.push_back({ m_id, m_registry, found_participant });
+    return *found_participant;
+}
+
+bool server::EpochDomain::try_advance() noexcept
+{
+    const uint64_t epoch = m_epoch.load(memory_order_seq_cst);
+    {
+        lock_guard lock(m_registry->mutex);
+        for (const auto& participant : m_registry->participants) {
+            const uint64_t participant_epoch = participant.epoch.load(memory_order_seq_cst);
+            if (participant_epoch != 0 && participant_epoch != epoch) {
+                return false;
+            }
+        }
+    }
+
+    m_epoch.store(epoch + 1, memory_order_seq_cst);
+    return true;
+}
@@ -0,0 +1,75 @@
+#pragma once
+#ifndef EPOCH_H_
+#  define EPOCH_H_
+#  include <cstddef>
+#  include <cstdint>
+
+#  include <atomic>
+#  include <deque>
+#  include <functional>
+#  include <memory>
+#  include <mutex>
+#  include <utility>
+#  include <vector>
+
+namespace server
+{
+    // Epoch-based reclamation. Readers pin the domain while they follow pointers without locks,
+    // writers retire what they unlinked and it is destroyed once no reader pinned before can
+    // still hold it.
+    class EpochDomain
+    {
+    private:
+        struct alignas(64) Participant
+        {
+            // 0 while the owning thread is not pinned
+            std::atomic<std::uint64_t> epoch = 0;
+            std::atomic<bool> in_use = false;
+            // Only touched by the owning thread
+            std::size_t nesting = 0;
+        };
+
+        struct Registry
+        {
+            std::mutex mutex;
+            std::deque<Participant> participants;
+        };
+    public:
+        // Keeps the calling thread pinned, guards may nest
+        class Guard
+        {
+        public:
+            explicit Guard(const EpochDomain& domain);
+            Guard(const Guard&) = delete;
+            ~Guard();
+
+            Guard& operator=(const Guard&) = delete;
+        private:
+            Participant& m_participant;
+        };
+
+        EpochDomain();
+        EpochDomain(const EpochDomain&) = delete;
+        // Destroys everything still retired, no guard may be alive
+        ~EpochDomain();
+
+        EpochDomain& operator=(const EpochDomain&) = delete;
+
+        void retire(std::function<void()> destroy);
+        // Destroys what no reader can reach anymore, retire calls this every few objects
+        void collect();
+    private:
+        static constexpr std::size_t collect_interval = 64;
+
+        Participant& participant() const;
+        bool try_advance() noexcept;
+
+        std::uint64_t m_id;
+        std::shared_ptr<Registry> m_registry;
+        std::atomic<std::uint64_t> m_epoch = 1;
+        std::mutex m_retired_mutex;
+        std::vector<std::pair<std::uint64_t, std::function<void()>>> m_retired;
+        std::size_t m_retired_since_collect = 0;
+    };
+}  // namespace server
+#endif  // !EPOCH_H_
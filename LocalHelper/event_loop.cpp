@@ -0,0 +1,660 @@
+#include "event_loop.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef _WIN32
+#  ifndef NOMINMAX
+#    define NOMINMAX
+#  endif
+#  include <winsock2.h>
+#  include <mswsock.h>
+#  include <ws2tcpip.h>
+#  include <windows.h>
+#else
+#  include <netdb.h>
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#  include <sys/epoll.h>
+#  include <sys/eventfd.h>
+#  include <sys/socket.h>
+#  include <sys/uio.h>
+#  include <unistd.h>
+#endif
+
+using std::coroutine_handle;
+using std::exchange;
+using std::lock_guard;
+using std::mutex;
+using std::ptrdiff_t;
+using std::runtime_error;
+using std::size_t;
+using std::span;
+using std::string;
+using std::string_view;
+using std::uint16_t;
+using std::vector;
+
+namespace
+{
+#ifdef _WIN32
+    using native_socket = SOCKET;
+
+    // Completion keys of the packets posted by the loop itself
+    constexpr ULONG_PTR stop_key = 1;
+    constexpr ULONG_PTR quit_key = 2;
+    constexpr DWORD address_size = sizeof(sockaddr_in) + 16;
+
+    void initialize_sockets()
+    {
+        static const int error = [] {
+            WSADATA data;
+            return WSAStartup(MAKEWORD(2, 2), &data);
+        }();
+        if (error != 0) {
+            throw runtime_error{ "Cannot initialize Windows Sockets." };
+        }
+    }
+
+    void close_socket(native_socket socket) noexcept
+    {
+        closesocket(socket);
+    }
+#else
+    using native_socket = int;
+
+    void initialize_sockets() noexcept
+    {}
+
+    void close_socket(native_socket socket) noexcept
+    {
+        ::close(socket);
+    }
+
+    bool would_block() noexcept
+    {
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+#endif
+
+    native_socket to_native(server::Socket::native_handle_type handle) noexcept
+    {
+        return static_cast<native_socket>(handle);
+    }
+
+    // Replies go out as soon as they are written, the handlers batch them already
+    void disable_delay(native_socket socket) noexcept
+    {
+        const int enabled = 1;
+        setsockopt(
+            socket,
+            IPPROTO_TCP,
+            TCP_NODELAY,
+            reinterpret_cast<const char*>(&enabled),
+            sizeof(enabled)
+        );
+    }
+}  // namespace
+
+server::Socket::Socket(native_handle_type handle) noexcept : m_handle(handle)
+{}
+
+server::Socket::Socket(Socket&& right) noexcept
+    : m_handle(exchange(right.m_handle, invalid_handle))
+{}
+
+server::Socket::~Socket()
+{
+    close();
+}
+
+server::Socket& server::Socket::operator=(Socket&& right) noexcept
+{
+    if (this != &right) {
+        close();
+        m_handle = exchange(right.m_handle, invalid_handle);
+    }
+
+    return *this;
+}
+
+server::Socket server::Socket::listen(uint16_t port)
+{
+    initialize_sockets();
+#ifdef _WIN32
+    Socket listener{ static_cast<native_handle_type>(
+        WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, WSA_FLAG_OVERLAPPED)
+    ) };
+#else
+    Socket listener{ static_cast<native_handle_type>(
+        ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)
+    ) };
+#endif
+    if (!listener.is_open()) {
+        throw runtime_error{ "Cannot create a socket." };
+    }
+
+    const native_socket socket = to_native(listener.m_handle);
+#ifndef _WIN32
+    // SO_REUSEADDR would let other processes take the port on Windows
+    const int enabled = 1;
+    setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, &enabled, sizeof(enabled));
+    setsockopt(socket, SOL_SOCKET, SO_REUSEPORT, &enabled, sizeof(enabled));
+#endif
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+        || ::listen(socket, SOMAXCONN) != 0) {
+        throw runtime_error{ "Cannot listen on the port." };
+    }
+
+    return listener;
+}
+
+server::Socket server::Socket::connect(string_view host, uint16_t port)
+{
+    initialize_sockets();
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    addrinfo* addresses = nullptr;
+    const string name{ host };
+    const auto service = std::to_string(port);
+    if (getaddrinfo(name.c_str(), service.c_str(), &hints, &addresses) != 0) {
+        throw runtime_error{ "Cannot resolve the host." };
+    }
+
+    Socket connected;
+    for (const addrinfo* address = addresses; address != nullptr; address = address->ai_next) {
+        Socket socket{ static_cast<native_handle_type>(
+            ::socket(address->ai_family, address->ai_socktype, address->ai_protocol)
+        ) };
+        if (socket.is_open()
+            && ::connect(
+                to_native(socket.m_handle),
+                address->ai_addr,
+                static_cast<int>(address->ai_addrlen)
+            ) == 0) {
+            connected = std::move(socket);
+            break;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (!connected.is_open()) {
+        throw runtime_error{ "Cannot connect to the host." };
+    }
+
+    disable_delay(to_native(connected.m_handle));
+    return connected;
+}
+
+uint16_t server::Socket::local_port() const
+{
+    sockaddr_in address{};
+#ifdef _WIN32
+    int size = sizeof(address);
+#else
+    socklen_t size = sizeof(address);
+#endif
+    if (getsockname(to_native(m_handle), reinterpret_cast<sockaddr*>(&address), &size) != 0) {
+        throw runtime_error{ "Cannot get the address of the socket." };
+    }
+
+    return ntohs(address.sin_port);
+}
+
+void server::Socket::close() noexcept
+{
+    if (!is_open()) {
+        return;
+    }
+
+    if (m_loop != nullptr) {
+        m_loop->forget(*this);
+        m_loop = nullptr;
+    }
+    close_socket(to_native(exchange(m_handle, invalid_handle)));
+}
+
+void server::Socket::send_all(string_view data)
+{
+    while (!data.empty()) {
+        // The size is an int on Windows
+        const auto size = static_cast<int>(std::min<size_t>(data.size(), INT_MAX));
+#ifdef _WIN32
+        const auto sent = ::send(to_native(m_handle), data.data(), size, 0);
+#else
+        const auto sent = ::send(to_native(m_handle), data.data(), size, MSG_NOSIGNAL);
+#endif
+        if (sent <= 0) {
+            throw runtime_error{ "Cannot send on the connection." };
+        }
+        data.remove_prefix(static_cast<size_t>(sent));
+    }
+}
+
+size_t server::Socket::receive_some(span<char> buffer)
+{
+    const auto size = static_cast<int>(std::min<size_t>(buffer.size(), INT_MAX));
+    const auto received = ::recv(to_native(m_handle), buffer.data(), size, 0);
+    if (received < 0) {
+        throw runtime_error{ "Cannot receive on the connection." };
+    }
+
+    return static_cast<size_t>(received);
+}
+
+server::IoOperation::IoOperation(
+    EventLoop& loop,
+    Socket& socket,
+    Type type,
+    void* data,
+    size_t size
+) noexcept
+    : m_loop(&loop), m_socket(&socket), m_data(data), m_size(size), m_type(type)
+{}
+
+bool server::IoOperation::await_ready() noexcept
+{
+    if (m_loop->is_stopping() || !m_socket->is_open()) {
+        m_result = -1;
+        return true;
+    }
+
+#ifdef _WIN32
+    return false;
+#else
+    return attempt();
+#endif
+}
+
+server::Socket server::AcceptOperation::await_resume() noexcept
+{
+    if (m_result < 0 || m_accepted == Socket::invalid_handle) {
+        return {};
+    }
+
+    disable_delay(to_native(m_accepted));
+    return Socket{ exchange(m_accepted, Socket::invalid_handle) };
+}
+
+server::AcceptOperation server::EventLoop::accept(Socket& listener) noexcept
+{
+    return { *this, listener, IoOperation::Type::accept, nullptr, 0 };
+}
+
+server::TransferOperation server::EventLoop::receive(Socket& socket, span<char> buffer) noexcept
+{
+    return { *this, socket, IoOperation::Type::receive, buffer.data(), buffer.size() };
+}
+
+server::TransferOperation
+server::EventLoop::send(Socket& socket, span<const ConstBuffer> buffers) noexcept
+{
+    // Only read from, the array is not const for the sake of WSASend
+    return {
+        *this,
+        socket,
+        IoOperation::Type::send,
+        const_cast<ConstBuffer*>(buffers.data()),
+        buffers.size()
+    };
+}
+
+#ifdef _WIN32
+static_assert(sizeof(server::ConstBuffer) == sizeof(WSABUF));
+
+bool server::IoOperation::await_suspend(coroutine_handle<> waiter) noexcept
+{
+    static_assert(sizeof(OVERLAPPED) <= sizeof(m_overlapped));
+
+    if (!m_loop->watch(*m_socket)) {
+        m_result = -1;
+        return false;
+    }
+
+    m_waiter = waiter;
+    auto* overlapped = new (m_overlapped) OVERLAPPED{};
+    const native_socket socket = to_native(m_socket->m_handle);
+    EventLoop& loop = *m_loop;
+    // The completion may resume the coroutine on another thread before the call returns
+    ++loop.m_waiting;
+    bool started = false;
+    if (m_type == Type::accept) {
+        m_accepted = static_cast<Socket::native_handle_type>(
+            WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, WSA_FLAG_OVERLAPPED)
+        );
+        started = m_accepted != Socket::invalid_handle && (AcceptEx(
+            socket,
+            to_native(m_accepted),
+            m_addresses,
+            0,
+            address_size,
+            address_size,
+            nullptr,
+            overlapped
+        ) || WSAGetLastError() == ERROR_IO_PENDING);
+    } else if (m_type == Type::receive) {
+        WSABUF buffer{ static_cast<ULONG>(m_size), static_cast<char*>(m_data) };
+        DWORD flags = 0;
+        started = WSARecv(socket, &buffer, 1, nullptr, &flags, overlapped, nullptr) == 0
+            || WSAGetLastError() == WSA_IO_PENDING;
+    } else {
+        auto* buffers = static_cast<WSABUF*>(m_data);
+        const auto count = static_cast<DWORD>(m_size);
+        started = WSASend(socket, buffers, count, nullptr, 0, overlapped, nullptr) == 0
+            || WSAGetLastError() == WSA_IO_PENDING;
+    }
+
+    if (!started) {
+        --loop.m_waiting;
+        if (m_accepted != Socket::invalid_handle) {
+            close_socket(to_native(exchange(m_accepted, Socket::invalid_handle)));
+        }
+        m_result = -1;
+        return false;
+    }
+
+    // Canceling the sockets of a stopping loop may have missed this operation
+    if (loop.is_stopping()) {
+        CancelIoEx(reinterpret_cast<HANDLE>(socket), overlapped);
+    }
+    return true;
+}
+
+void server::IoOperation::complete(bool succeeded, size_t transferred) noexcept
+{
+    if (m_type == Type::accept) {
+        const native_socket listener = to_native(m_socket->m_handle);
+        succeeded = succeeded && setsockopt(
+            to_native(m_accepted),
+            SOL_SOCKET,
+            SO_UPDATE_ACCEPT_CONTEXT,
+            reinterpret_cast<const char*>(&listener),
+            sizeof(listener)
+        ) == 0;
+        if (!succeeded && m_accepted != Socket::invalid_handle) {
+            close_socket(to_native(exchange(m_accepted, Socket::invalid_handle)));
+        }
+    }
+
+    m_result = succeeded ? static_cast<ptrdiff_t>(transferred) : -1;
+}
+
+server::EventLoop::EventLoop()
+{
+    initialize_sockets();
+    m_port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 0);
+    if (m_port == nullptr) {
+        throw runtime_error{ "Cannot create an I/O completion port." };
+    }
+}
+
+server::EventLoop::~EventLoop()
+{
+    CloseHandle(m_port);
+}
+
+void server::EventLoop::run()
+{
+    for (;;) {
+        DWORD transferred = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED* overlapped = nullptr;
+        const bool succeeded =
+            GetQueuedCompletionStatus(m_port, &transferred, &key, &overlapped, INFINITE);
+        if (overlapped != nullptr) {
+            auto& operation = *reinterpret_cast<IoOperation*>(overlapped);
+            operation.complete(succeeded, transferred);
+            const auto waiter = operation.m_waiter;
+            --m_waiting;
+            waiter.resume();
+        } else if (!succeeded) {
+            throw runtime_error{ "Cannot wait for completions." };
+        } else if (key == stop_key) {
+            cancel_all();
+        } else if (key == quit_key) {
+            // Passed on to the next thread running the loop
+            PostQueuedCompletionStatus(m_port, 0, quit_key, nullptr);
+            return;
+        }
+
+        if (is_stopping() && m_waiting == 0) {
+            PostQueuedCompletionStatus(m_port, 0, quit_key, nullptr);
+            return;
+        }
+    }
+}
+
+void server::EventLoop::stop() noexcept
+{
+    m_stopping = true;
+    PostQueuedCompletionStatus(m_port, 0, stop_key, nullptr);
+}
+
+bool server::EventLoop::watch(Socket& socket) noexcept
+{
+    lock_guard<mutex> lock{ m_mutex };
+    if (socket.m_loop == this) {
+        return true;
+    }
+
+    const auto handle = reinterpret_cast<HANDLE>(socket.m_handle);
+    if (socket.m_loop != nullptr || CreateIoCompletionPort(handle, m_port, 0, 0) == nullptr) {
+        return false;
+    }
+
+    m_sockets.insert(&socket);
+    socket.m_loop = this;
+    return true;
+}
+
+void server::EventLoop::forget(Socket& socket) noexcept
+{
+    lock_guard<mutex> lock{ m_mutex };
+    m_sockets.erase(&socket);
+}
+
+void server::EventLoop::cancel_all() noexcept
+{
+    lock_guard<mutex> lock{ m_mutex };
+    for (Socket* socket : m_sockets) {
+        CancelIoEx(reinterpret_cast<HANDLE>(socket->m_handle), nullptr);
+    }
+}
+#else
+static_assert(sizeof(server::ConstBuffer) == sizeof(iovec));
+
+bool server::IoOperation::await_suspend(coroutine_handle<> waiter) noexcept
+{
+    if (!m_loop->watch(*m_socket)) {
+        m_result = -1;
+        return false;
+    }
+
+    m_waiter = waiter;
+    (m_type == Type::send ? m_socket->m_writing : m_socket->m_reading) = this;
+    ++m_loop->m_waiting;
+    return true;
+}
+
+bool server::IoOperation::attempt() noexcept
+{
+    const native_socket socket = to_native(m_socket->m_handle);
+    for (;;) {
+        ptrdiff_t result = 0;
+        switch (m_type) {
+        case Type::accept:
+            result = ::accept4(socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (result >= 0) {
+                m_accepted = static_cast<Socket::native_handle_type>(result);
+            }
+            break;
+        case Type::receive:
+            result = ::recv(socket, static_cast<char*>(m_data), m_size, 0);
+            break;
+        case Type::send: {
+            msghdr message{};
+            message.msg_iov = static_cast<iovec*>(m_data);
+            message.msg_iovlen = std::min<size_t>(m_size, IOV_MAX);
+            result = ::sendmsg(socket, &message, MSG_NOSIGNAL);
+            break;
+        }
+        }
+
+        if (result >= 0) {
+            m_result = result;
+            return true;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        // Out of descriptors, the connection stays queued until the next one arrives
+        if (would_block() || (m_type == Type::accept && (errno == EMFILE || errno == ENFILE))) {
+            return false;
+        }
+
+        m_result = -1;
+        return true;
+    }
+}
+
+server::EventLoop::EventLoop()
+    : m_epoll(epoll_create1(EPOLL_CLOEXEC)), m_wake(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+{
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    if (m_epoll < 0 || m_wake < 0 || epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wake, &event) != 0) {
+        if (m_wake >= 0) {
+            ::close(m_wake);
+        }
+        if (m_epoll >= 0) {
+            ::close(m_epoll);
+        }
+        throw runtime_error{ "Cannot create an event loop." };
+    }
+}
+
+server::EventLoop::~EventLoop()
+{
+    ::close(m_wake);
+    ::close(m_epoll);
+}
+
+void server::EventLoop::run()
+{
+    bool stopped = false;
+    epoll_event events[256];
+    while (!stopped || m_waiting != 0) {
+        const int count = epoll_wait(m_epoll, events, static_cast<int>(std::size(events)), -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw runtime_error{ "Cannot wait for events." };
+        }
+
+        for (int index = 0; index < count; ++index) {
+            const auto flags = events[index].events;
+            if (events[index].data.ptr == nullptr) {
+                std::uint64_t value;
+                [[maybe_unused]] const auto size = ::read(m_wake, &value, sizeof(value));
+                stopped = true;
+                cancel_all();
+                continue;
+            }
+            // A coroutine only closes its own sockets, so the others of this batch stay valid
+            resume(
+                *static_cast<Socket*>(events[index].data.ptr),
+                (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0,
+                (flags & (EPOLLOUT | EPOLLHUP | EPOLLERR)) != 0
+            );
+        }
+    }
+}
+
+void server::EventLoop::stop() noexcept
+{
+    m_stopping = true;
+    const std::uint64_t value = 1;
+    [[maybe_unused]] const auto size = ::write(m_wake, &value, sizeof(value));
+}
+
+bool server::EventLoop::watch(Socket& socket) noexcept
+{
+    if (socket.m_loop == this) {
+        return true;
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = &socket;
+    if (socket.m_loop != nullptr
+        || epoll_ctl(m_epoll, EPOLL_CTL_ADD, to_native(socket.m_handle), &event) != 0) {
+        return false;
+    }
+
+    m_sockets.insert(&socket);
+    socket.m_loop = this;
+    return true;
+}
+
+void server::EventLoop::forget(Socket& socket) noexcept
+{
+    // Closing the descriptor removes it from the epoll set
+    m_sockets.erase(&socket);
+}
+
+void server::EventLoop::cancel_all()
+{
+    const vector<Socket*> sockets{ m_sockets.begin(), m_sockets.end() };
+    for (Socket* socket : sockets) {
+        ::shutdown(to_native(socket->m_handle), SHUT_RDWR);
+    }
+    for (Socket* socket : sockets) {
+        // Closed by a coroutine resumed before
+        if (!m_sockets.contains(socket)) {
+            continue;
+        }
+        for (IoOperation* operation : { socket->m_reading, socket->m_writing }) {
+            if (operation != nullptr) {
+                operation->m_result = -1;
+            }
+        }
+        resume(*socket, true, true);
+    }
+}
+
+void server::EventLoop::resume(Socket& socket, bool readable, bool writable)
+{
+    // A failed operation is over without another attempt
+    const auto take_if_over = [](IoOperation*& operation, bool ready) -> coroutine_handle<> {
+        if (operation == nullptr
+            || (operation->m_result >= 0 && !(ready && operation->attempt()))) {
+            return nullptr;
+        }
+
+        --operation->m_loop->m_waiting;
+        return exchange(operation, nullptr)->m_waiter;
+    };
+    const auto reader = take_if_over(socket.m_reading, readable);
+    const auto writer = take_if_over(socket.m_writing, writable);
+    // Socket may be gone once one of them ran
+    if (reader) {
+        reader.resume();
+    }
+    if (writer) {
+        writer.resume();
+    }
+}
+#endif
@@ -0,0 +1,279 @@
+#pragma once
+#ifndef EVENT_LOOP_H_
+#  define EVENT_LOOP_H_
+#  include <cstddef>
+#  include <cstdint>
+
+#  include <atomic>
+#  include <coroutine>
+#  include <exception>
+#  include <mutex>
+#  include <span>
+#  include <string_view>
+#  include <unordered_set>
+
+namespace server
+{
+    class EventLoop;
+    class IoOperation;
+
+    // One of the buffers of a gathering send, laid out as an iovec or a WSABUF
+    class ConstBuffer
+    {
+    public:
+        inline ConstBuffer(const char* data, std::size_t size) noexcept;
+
+        inline const char* data() const noexcept;
+        inline std::size_t size() const noexcept;
+        inline void remove_prefix(std::size_t size) noexcept;
+    private:
+#  ifdef _WIN32
+        unsigned long m_size;
+        char* m_data;
+#  else
+        void* m_data;
+        std::size_t m_size;
+#  endif
+    };
+
+    // Coroutine which starts at once and is destroyed when it returns, nobody waits for it
+    class Task
+    {
+    public:
+        struct promise_type
+        {
+            inline Task get_return_object() const noexcept;
+            inline std::suspend_never initial_suspend() const noexcept;
+            inline std::suspend_never final_suspend() const noexcept;
+            inline void return_void() const noexcept;
+            // Handlers catch what they can recover from, anything else is a bug
+            [[noreturn]] inline void unhandled_exception() const noexcept;
+        };
+    };
+
+    // Non-blocking TCP socket, at most one accept or receive and one send may wait on it. Only
+    // those from connect block, they are used without a loop.
+    class Socket
+    {
+        friend class EventLoop;
+        friend class IoOperation;
+    public:
+        // A file descriptor or a SOCKET
+        using native_handle_type = std::uintptr_t;
+
+        static constexpr native_handle_type invalid_handle = ~native_handle_type{ 0 };
+
+        Socket() = default;
+        explicit Socket(native_handle_type handle) noexcept;
+        Socket(Socket&& right) noexcept;
+        ~Socket();
+
+        Socket& operator=(Socket&& right) noexcept;
+
+        // Listens on every IPv4 address. On Linux several listeners may share port, the kernel
+        // spreads the connections among them.
+        static Socket listen(std::uint16_t port);
+        // Connects to the first address of host which accepts
+        static Socket connect(std::string_view host, std::uint16_t port);
+
+        inline bool is_open() const noexcept;
+        inline native_handle_type native_handle() const noexcept;
+        std::uint16_t local_port() const;
+        void close() noexcept;
+        // Blocking transfers of a socket from connect, throw std::runtime_error if it broke
+        void send_all(std::string_view data);
+        // 0 once the peer closed the connection
+        std::size_t receive_some(std::span<char> buffer);
+    private:
+        native_handle_type m_handle = invalid_handle;
+        // Set by the first operation which had to wait, a registered socket is never moved
+        EventLoop* m_loop = nullptr;
+#  ifndef _WIN32
+        IoOperation* m_reading = nullptr;
+        IoOperation* m_writing = nullptr;
+#  endif
+    };
+
+    // One accept, receive or send, awaited in place so it lives in the frame of its coroutine
+    class IoOperation
+    {
+        friend class EventLoop;
+    public:
+        IoOperation(const IoOperation&) = delete;
+
+        IoOperation& operator=(const IoOperation&) = delete;
+
+        bool await_ready() noexcept;
+        // Does not suspend if the operation failed to start
+        bool await_suspend(std::coroutine_handle<> waiter) noexcept;
+    protected:
+        enum class Type : std::uint8_t
+        {
+            accept,
+            receive,
+            send
+        };
+
+        IoOperation(EventLoop& loop, Socket& socket, Type type, void* data, std::size_t size)
+            noexcept;
+
+#  ifdef _WIN32
+        // Fills in the result from a completion
+        void complete(bool succeeded, std::size_t transferred) noexcept;
+
+        // An OVERLAPPED, first so that the completions lead back to the operation
+        alignas(void*) unsigned char m_overlapped[32];
+        // Room for the two addresses written by AcceptEx
+        char m_addresses[64];
+#  else
+        // Tries the system call once, whether the operation is over
+        bool attempt() noexcept;
+#  endif
+
+        EventLoop* m_loop;
+        Socket* m_socket;
+        // The chars to receive into or the ConstBuffer array to send
+        void* m_data;
+        std::size_t m_size;
+        Socket::native_handle_type m_accepted = Socket::invalid_handle;
+        // The number of chars transferred or -1 once the operation failed
+        std::ptrdiff_t m_result = 0;
+        std::coroutine_handle<> m_waiter;
+        Type m_type;
+    };
+
+    class AcceptOperation : public IoOperation
+    {
+        friend class EventLoop;
+    public:
+        // Closed if accepting failed
+        Socket await_resume() noexcept;
+    private:
+        using IoOperation::IoOperation;
+    };
+
+    class TransferOperation : public IoOperation
+    {
+        friend class EventLoop;
+    public:
+        // 0 once the connection is closed or broken
+        inline std::size_t await_resume() const noexcept;
+    private:
+        using IoOperation::IoOperation;
+    };
+
+    // Resumes the coroutines waiting on its sockets: epoll with one loop per thread on Linux,
+    // an I/O completion port which any number of threads may run together on Windows
+    class EventLoop
+    {
+        friend class IoOperation;
+        friend class Socket;
+    public:
+        EventLoop();
+        EventLoop(const EventLoop&) = delete;
+        ~EventLoop();
+
+        EventLoop& operator=(const EventLoop&) = delete;
+
+        AcceptOperation accept(Socket& listener) noexcept;
+        TransferOperation receive(Socket& socket, std::span<char> buffer) noexcept;
+        // Sends the buffers in order, possibly not all of them
+        TransferOperation send(Socket& socket, std::span<const ConstBuffer> buffers) noexcept;
+        // Returns once stop was called and no coroutine waits on the loop any more
+        void run();
+        // Thread-safe. Fails the waiting and all later operations, so their coroutines return.
+        void stop() noexcept;
+        inline bool is_stopping() const noexcept;
+    private:
+        // Registers socket with the loop unless it is already, false if that failed
+        bool watch(Socket& socket) noexcept;
+        void forget(Socket& socket) noexcept;
+#  ifdef _WIN32
+        void cancel_all() noexcept;
+
+        void* m_port = nullptr;
+        // Guards m_sockets, the threads running the loop share it
+        std::mutex m_mutex;
+        std::atomic<std::size_t> m_waiting = 0;
+#  else
+        void cancel_all();
+        // Resumes the operations of socket which are over
+        static void resume(Socket& socket, bool readable, bool writable);
+
+        int m_epoll = -1;
+        // An eventfd which wakes the loop up for stop
+        int m_wake = -1;
+        std::size_t m_waiting = 0;
+#  endif
+        std::atomic<bool> m_stopping = false;
+        std::unordered_set<Socket*> m_sockets;
+    };
+
+    inline Task Task::promise_type::get_return_object() const noexcept
+    {
+        return {};
+    }
+
+    inline std::suspend_never Task::promise_type::initial_suspend() const noexcept
+    {
+        return {};
+    }
+
+    inline std::suspend_never Task::promise_type::final_suspend() const noexcept
+    {
+        return {};
+    }
+
+    inline void Task::promise_type::return_void() const noexcept
+    {}
+
+    inline void Task::promise_type::unhandled_exception() const noexcept
+    {
+        std::terminate();
+    }
+
+    inline ConstBuffer::ConstBuffer(const char* data, std::size_t size) noexcept
+#  ifdef _WIN32
+        : m_size(static_cast<unsigned long>(size)), m_data(const_cast<char*>(data))
+#  else
+        : m_data(const_cast<char*>(data)), m_size(size)
+#  endif
+    {}
+
+    inline const char* ConstBuffer::data() const noexcept
+    {
+        return static_cast<const char*>(m_data);
+    }
+
+    inline std::size_t ConstBuffer::size() const noexcept
+    {
+        return m_size;
+    }
+
+    inline void ConstBuffer::remove_prefix(std::size_t size) noexcept
+    {
+        m_data = const_cast<char*>(data() + size);
+        m_size -= static_cast<decltype(m_size)>(size);
+    }
+
+    inline bool Socket::is_open() const noexcept
+    {
+        return m_handle != invalid_handle;
+    }
+
+    inline Socket::native_handle_type Socket::native_handle() const noexcept
+    {
+        return m_handle;
+    }
+
+    inline std::size_t TransferOperation::await_resume() const noexcept
+    {
+        return m_result > 0 ? static_cast<std::size_t>(m_result) : 0;
+    }
+
+    inline bool EventLoop::is_stopping() const noexcept
+    {
+        return m_stopping.load();
+    }
+}  // namespace server
+#endif  // !EVENT_LOOP_H_
@@ -0,0 +1,197 @@
+#pragma once
+#ifndef EXPECTED_H_
+#  define EXPECTED_H_
+#  if __has_include(<version>)
+#    include <version>
+#  endif
+
+#  ifdef __cpp_lib_expected
+#    include <expected>
+
+namespace server
+{
+    using std::bad_expected_access;
+    using std::expected;
+    using std::unexpected;
+}  // namespace server
+#  else
+#    include <exception>
+#    include <type_traits>
+#    include <utility>
+#    include <variant>
+
+namespace server
+{
+    // The part of std::expected used here, until the build moves to C++23
+    template <typename E>
+    class unexpected
+    {
+    public:
+        constexpr explicit unexpected(E error);
+
+        constexpr const E& error() const noexcept;
+    private:
+        E m_error;
+    };
+
+    template <typename E>
+    unexpected(E) -> unexpected<E>;
+
+    template <typename E>
+    class bad_expected_access : public std::exception
+    {
+    public:
+        explicit bad_expected_access(E error);
+
+        const char* what() const noexcept override;
+        const E& error() const noexcept;
+    private:
+        E m_error;
+    };
+
+    template <typename T, typename E>
+    class expected
+    {
+    public:
+        using value_type = T;
+        using error_type = E;
+
+        template <typename U = T>
+        constexpr expected(U&& value)
+        requires(
+            std::is_constructible_v<T, U&&> &&
+            !std::is_same_v<std::remove_cvref_t<U>, expected> &&
+            !std::is_same_v<std::remove_cvref_t<U>, unexpected<E>>
+        );
+        template <typename G>
+        constexpr expected(const unexpected<G>& error);
+
+        constexpr bool has_value() const noexcept;
+        constexpr explicit operator bool() const noexcept;
+        constexpr const T& value() const;
+        constexpr T& value();
+        constexpr const T& operator*() const noexcept;
+        constexpr T& operator*() noexcept;
+        constexpr const T* operator->() const noexcept;
+        constexpr T* operator->() noexcept;
+        constexpr const E& error() const noexcept;
+        template <typename U>
+        constexpr T value_or(U&& default_value) const;
+    private:
+        std::variant<T, E> m_value;
+    };
+
+    template <typename E>
+    constexpr unexpected<E>::unexpected(E error) : m_error(std::move(error))
+    {}
+
+    template <typename E>
+    constexpr const E& unexpected<E>::error() const noexcept
+    {
+        return m_error;
+    }
+
+    template <typename E>
+    bad_expected_access<E>::bad_expected_access(E error) : m_error(std::move(error))
+    {}
+
+    template <typename E>
+    const char* bad_expected_access<E>::what() const noexcept
+    {
+        return "Bad expected access.";
+    }
+
+    template <typename E>
+    const E& bad_expected_access<E>::error() const noexcept
+    {
+        return m_error;
+    }
+
+    template <typename T, typename E>
+    template <typename U>
+    constexpr expected<T, E>::expected(U&& value)
+    requires(
+        std::is_constructible_v<T, U&&> &&
+        !std::is_same_v<std::remove_cvref_t<U>, expected> &&
+        !std::is_same_v<std::remove_cvref_t<U>, unexpected<E>>
+    )
+        : m_value(std::in_place_index<0>, std::forward<U>(value))
+    {}
+
+    template <typename T, typename E>
+    template <typename G>
+    constexpr expected<T, E>::expected(const unexpected<G>& error)
+        : m_value(std::in_place_index<1>, error.error())
+    {}
+
+    template <typename T, typename E>
+    constexpr bool expected<T, E>::has_value() const noexcept
+    {
+        return m_value.index() == 0;
+    }
+
+    template <typename T, typename E>
+    constexpr expected<T, E>::operator bool() const noexcept
+    {
+        return has_value();
+    }
+
+    template <typename T, typename E>
+    constexpr const T& expected<T, E>::value() const
+    {
+        if (!has_value()) {
+            throw bad_expected_access<E>{ error() };
+        }
+
+        return **this;
+    }
+
+    template <typename T, typename E>
+    constexpr T& expected<T, E>::value()
+    {
+        if (!has_value()) {
+            throw bad_expected_access<E>{ error() };
+        }
+
+        return **this;
+    }
+
+    template <typename T, typename E>
+    constexpr const T& expected<T, E>::operator*() const noexcept
+    {
+        return *std::get_if<0>(&m_value);
+    }
+
+    template <typename T, typename E>
+    constexpr T& expected<T, E>::operator*() noexcept
+    {
+        return *std::get_if<0>(&m_value);
+    }
+
+    template <typename T, typename E>
+    constexpr const T* expected<T, E>::operator->() const noexcept
+    {
+        return std::get_if<0>(&m_value);
+    }
+
+    template <typename T, typename E>
+    constexpr T* expected<T, E>::operator->() noexcept
+    {
+        return std::get_if<0>(&m_value);
+    }
+
+    template <typename T, typename E>
+    constexpr const E& expected<T, E>::error() const noexcept
+    {
+        return *std::get_if<1>(&m_value);
+    }
+
+    template <typename T, typename E>
+    template <typename U>
+    constexpr T expected<T, E>::value_or(U&& default_value) const
+    {
+        return has_value() ? **this : static_cast<T>(std::forward<U>(default_value));
+    }
+}  // namespace server
+#  endif
+#endif  // !EXPECTED_H_
@@ -1,239 +1,1914 @@
 #include "filesystem.h"
 
-#include <queue>
-using std::bad_cast;
+#include "blob_store.h"
+#include "snapshot.h"
+#include "traversal.h"
+using std::exception;
+using std::function;
+using std::get;
+using std::get_if;
+using std::holds_alternative;
 using std::invalid_argument;
+using std::logic_error;
+using std::make_shared;
 using std::make_unique;
+using std::memory_order_acq_rel;
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::min;
 using std::move;
 using std::next;
+using std::pair;
 using std::prev;
-using std::queue;
 using std::reference_wrapper;
 using std::runtime_error;
+using std::shared_ptr;
+using std::shared_lock;
+using std::shared_mutex;
+using std::size_t;
 using std::string;
+using std::string_view;
+using std::to_string;
+using std::uint64_t;
+using std::unique_lock;
 using std::unique_ptr;
-using std::unordered_set;
+using std::unordered_map;
 using std::vector;
+using std::visit;
+using std::pmr::memory_resource;
+using std::pmr::polymorphic_allocator;
+using std::pmr::synchronized_pool_resource;
+using std::pmr::unsynchronized_pool_resource;
 namespace filesystem = std::filesystem;
 namespace ranges = std::ranges;
 
-void server::Folder::copy_files_from_folder(const container_of_file& files)
+// Besides its own node and its node in the set of the parent, a file whose name and content
+// are stored inline allocates nothing
+static_assert(sizeof(server::File) <= 80);
+static_assert(sizeof(server::file_pointer) == sizeof(void*));
+
+namespace
 {
-    for (const auto& e : files) {
-        const auto& type = typeid(*e);
-        assert(type == typeid(File) || type == typeid(Folder));
-        if (type == typeid(File)) {
-            m_files.insert(make_unique<File>(static_cast<const File&>(*e)));
-        } else {
-            m_files.insert(make_unique<Folder>(static_cast<const Folder&>(*e)));
+    // Calls add for at most limit of the children from first in name order, returns the cursor
+    // of the next page
+    template <typename Iter, typename Add>
+    string list_children(Iter first, Iter last, string_view cursor, size_t limit, Add&& add)
+    {
+        for (; first != last && limit != 0; ++first, --limit) {
+            cursor = add(*first);
+        }
+
+        return first == last ? string{} : string{ cursor };
+    }
+
+    // Whether a .. of path leads back out of a component of path itself. A lexical key would
+    // skip checking that the component is a folder, so such paths bypass the cache.
+    bool steps_back_over_itself(const filesystem::path& path)
+    {
+        size_t depth = 0;
+        for (const auto& subdir : path) {
+            if (subdir == "..") {
+                if (depth != 0) {
+                    return true;
+                }
+            } else if (subdir == "/") {
+                depth = 0;
+            } else if (subdir != "." && !subdir.empty()) {
+                ++depth;
+            }
+        }
+
+        return false;
+    }
+
+    // The exceptions the throwing lookups report FileSystemError with
+    [[noreturn]] void throw_error(server::FileSystemError error)
+    {
+        switch (error) {
+        case server::FileSystemError::not_found:
+            throw invalid_argument{ "Unknown filename." };
+        case server::FileSystemError::not_a_file:
+            throw runtime_error{ "The name does not refer to a file." };
+        default:
+            throw runtime_error{ "The name does not refer to a folder." };
         }
     }
+}  // namespace
+
+void server::FileDeleter::operator()(FileBase* file) const noexcept
+{
+    polymorphic_allocator<> allocator = file->get_allocator();
+    file->visit([&allocator](auto& actual_file) { allocator.delete_object(&actual_file); });
 }
 
-server::Folder::Folder(const Folder& right) : FileBase(right.name())
+server::FileBase::FileBase(const FileBase& right) : m_name(right.m_name), m_kind(right.m_kind) {}
+
+server::FileBase::FileBase(const FileBase& right, const allocator_type& allocator)
+    : m_name(right.m_name)
+    , m_allocator(allocator)
+    , m_kind(right.m_kind)
+{}
+
+server::FileBase::FileBase(FileBase&& right, const allocator_type& allocator)
+    : m_name(move(right.m_name))
+    , m_allocator(allocator)
+    , m_kind(right.m_kind)
+{}
+
+server::FileBase::FileBase(Kind kind, string_view name, const allocator_type& allocator)
+    : m_name(name)
+    , m_allocator(allocator)
+    , m_kind(kind)
+{}
+
+server::FileBase& server::FileBase::operator=(const FileBase& right)
 {
-    copy_files_from_folder(right.m_files);
+    m_name = right.m_name;
+    return *this;
 }
 
-server::Folder::Folder(const string& name) : FileBase(name) {}
+void server::FileBase::rename(string_view new_name)
+{
+    if (m_parent == nullptr) {
+        set_name(new_name);
+        return;
+    }
+    if (name() == new_name) {
+        return;
+    }
+
+    auto& files = m_parent->m_files;
+    if (files.contains(new_name)) {
+        throw runtime_error{ "A file with the same name exists" };
+    }
+
+    // The set is ordered by name, so the file is taken out while its name changes
+    const string old_name{ name() };
+    auto node = files.extract(files.find(old_name));
+    set_name(new_name);
+    files.insert(move(node));
+    m_parent->publish_children();
 
-server::Folder::Folder(string&& name) : FileBase(move(name)) {}
+    if (Folder::Tree* tree = Folder::logged_tree(*m_parent)) {
+        WriteAheadLog::Record record{ WriteAheadLog::RecordType::rename };
+        record.add(m_parent->absolute_path()).add(old_name).add(new_name);
+        tree->commit(record);
+    }
+}
 
-const server::FileBase& server::Folder::search_file(const string& name) const
+void server::FileBase::set_name(string_view new_name)
 {
-    for (const auto& file : m_files) {
-        if (file->name() == name) {
-            return *file;
+    if (m_kind == Kind::folder) {
+        to_actually_type<Folder>().bump_structure_generation();
+        m_name = InternedName{ new_name };
+    } else if (m_parent != nullptr && m_parent->m_tree != nullptr) {
+        NameIndex& index = m_parent->m_tree->name_index;
+        index.erase(to_actually_type<File>());
+        m_name = InternedName{ new_name };
+        index.insert(to_actually_type<File>());
+    } else {
+        m_name = InternedName{ new_name };
+    }
+}
+
+string server::FileBase::absolute_path() const
+{
+    vector<string_view> names;
+    for (const FileBase* node = this; node->has_parent(); node = &node->get_parent()) {
+        names.push_back(node->name());
+    }
+    if (names.empty()) {
+        return "/";
+    }
+
+    string path;
+    for (auto iter = names.rbegin(); iter != names.rend(); ++iter) {
+        path += '/';
+        path += *iter;
+    }
+    return path;
+}
+
+server::File::File(const File& right, const allocator_type& allocator)
+    : FileBase(right, allocator)
+    , m_content(right.m_content)
+{}
+
+server::File::File(File&& right, const allocator_type& allocator)
+    : FileBase(move(right), allocator)
+    , m_content(move(right.m_content))
+{}
+
+server::File::File(string_view name, const string& content, const allocator_type& allocator)
+    : FileBase(Kind::file, name, allocator)
+    , m_content(make_content(string{ content }))
+{}
+
+server::File::File(string_view name, string&& content, const allocator_type& allocator)
+    : FileBase(Kind::file, name, allocator)
+    , m_content(make_content(move(content)))
+{}
+
+server::File::File(
+    string_view name,
+    shared_ptr<const void> owner,
+    string_view content,
+    const allocator_type& allocator
+)
+    : FileBase(Kind::file, name, allocator)
+    , m_content(ExternalContent{ move(owner), content })
+{}
+
+server::File& server::File::operator=(const File& right)
+{
+    assign(right);
+    if (Folder::logged_tree(*this) != nullptr) {
+        log_content();
+    }
+    return *this;
+}
+
+server::File& server::File::operator=(File&& right)
+{
+    assign(move(right));
+    if (Folder::logged_tree(*this) != nullptr) {
+        log_content();
+    }
+    return *this;
+}
+
+void server::File::assign(const File& right)
+{
+    const auto old_size = size();
+    m_content = right.m_content;
+    resize_in_totals(old_size);
+}
+
+void server::File::assign(File&& right)
+{
+    const auto old_size = size();
+    m_content = move(right.m_content);
+    resize_in_totals(old_size);
+}
+
+template <typename Edit>
+void server::File::edit_content(Edit&& edit)
+{
+    auto* chunked_content = get_if<shared_ptr<ChunkedContent>>(&m_content);
+    if (chunked_content == nullptr) {
+        auto split_content = make_shared<ChunkedContent>(content());
+        chunked_content = &m_content.emplace<shared_ptr<ChunkedContent>>(move(split_content));
+    } else if (chunked_content->use_count() != 1) {
+        *chunked_content = make_shared<ChunkedContent>(**chunked_content);
+    }
+
+    ChunkedContent& edited_content = **chunked_content;
+    const auto old_size = edited_content.size();
+    edit(edited_content);
+    // Contents up to a chunk are cheap to copy and stay in one piece for content()
+    if (edited_content.size() <= ChunkedContent::chunk_size) {
+        m_content = make_content(edited_content.flatten());
+    }
+    resize_in_totals(old_size);
+}
+
+void server::File::intern_content()
+{
+    if (auto* shared_content = get_if<shared_ptr<const string>>(&m_content)) {
+        *shared_content = BlobStore::intern(move(*shared_content));
+    }
+}
+
+void server::File::resize_in_totals(size_t old_size) noexcept
+{
+    const auto new_size = size();
+    if (!has_parent() || new_size == old_size) {
+        return;
+    }
+
+    Folder& parent = get_parent();
+    if (new_size > old_size) {
+        parent.add_to_totals({ .size = new_size - old_size });
+    } else {
+        parent.subtract_from_totals({ .size = old_size - new_size });
+    }
+}
+
+void server::File::log_content() const
+{
+    WriteAheadLog::Record record{ WriteAheadLog::RecordType::change_content };
+    record.add(get_parent().absolute_path()).add(name()).add_content(*this);
+    Folder::logged_tree(*this)->commit(record);
+}
+
+void server::File::write(size_t offset, string_view data)
+{
+    edit_content([offset, data](ChunkedContent& content) { content.write(offset, data); });
+    if (Folder::Tree* tree = Folder::logged_tree(*this)) {
+        WriteAheadLog::Record record{ WriteAheadLog::RecordType::write };
+        record.add(get_parent().absolute_path()).add(name()).add(uint64_t{ offset }).add(data);
+        tree->commit(record);
+    }
+}
+
+void server::File::append(string_view data)
+{
+    const auto offset = size();
+    edit_content([data](ChunkedContent& content) { content.append(data); });
+    if (Folder::Tree* tree = Folder::logged_tree(*this)) {
+        WriteAheadLog::Record record{ WriteAheadLog::RecordType::write };
+        record.add(get_parent().absolute_path()).add(name()).add(uint64_t{ offset }).add(data);
+        tree->commit(record);
+    }
+}
+
+void server::File::truncate(size_t size)
+{
+    edit_content([size](ChunkedContent& content) { content.truncate(size); });
+    if (Folder::Tree* tree = Folder::logged_tree(*this)) {
+        WriteAheadLog::Record record{ WriteAheadLog::RecordType::truncate };
+        record.add(get_parent().absolute_path()).add(name()).add(uint64_t{ size });
+        tree->commit(record);
+    }
+}
+
+void server::Folder::copy_descendants(const Folder& right)
+{
+    // Folders of right and their copies whose children are still to be copied
+    vector<pair<const Folder*, Folder*>> unvisited_folders{ { &right, this } };
+    while (!unvisited_folders.empty()) {
+        const auto [from, to] = unvisited_folders.back();
+        unvisited_folders.pop_back();
+        for (const auto& file : from->m_files) {
+            file_pointer copy;
+            if (file->kind() == Kind::file) {
+                copy = to->allocate_file<File>(file->to_actually_type<File>());
+            } else {
+                // An empty folder with the name of the original, its children come later
+                copy = to->allocate_file<Folder>("");
+                copy->FileBase::operator=(*file);
+                auto& folder = copy->to_actually_type<Folder>();
+                const auto totals = file->to_actually_type<Folder>().totals();
+                folder.m_total_size.store(totals.size, memory_order_relaxed);
+                folder.m_file_count.store(totals.file_count, memory_order_relaxed);
+                folder.m_folder_count.store(totals.folder_count, memory_order_relaxed);
+                unvisited_folders.push_back({ &file->to_actually_type<Folder>(), &folder });
+            }
+            copy->set_parent(*to);
+            // The children come in order, so every one goes at the end in O(1)
+            to->m_files.emplace_hint(to->m_files.end(), move(copy));
         }
     }
 
-    throw invalid_argument{ "Unknown filename." };
+    add_to_totals(right.totals());
 }
 
-server::FileBase& server::Folder::search_file(const string& name)
+void server::Folder::clear_files()
 {
     for (const auto& file : m_files) {
-        if (file->name() == name) {
-            return *file;
-        }
+        detach(*file);
+    }
+    if (epoch_domain() == nullptr) {
+        m_files.clear();
+        return;
     }
 
-    throw invalid_argument{ "Unknown filename." };
+    while (!m_files.empty()) {
+        retire(move(m_files.extract(m_files.begin()).value()));
+    }
 }
 
-server::Folder& server::Folder::operator=(const Folder& right)
+server::Folder::Totals server::Folder::totals_of(const FileBase& file) noexcept
 {
-    copy_files_from_folder(right.m_files);
-    return *this;
+    if (file.kind() == Kind::file) {
+        return { .size = file.to_actually_type<File>().size(), .file_count = 1 };
+    }
+
+    auto totals = file.to_actually_type<Folder>().totals();
+    ++totals.folder_count;
+    return totals;
 }
 
-bool server::Folder::has_file(const string& name) const noexcept
+void server::Folder::add_to_totals(const Totals& totals) noexcept
 {
-    for (const auto& file : m_files) {
-        if (file->name() == name) {
-            return true;
+    // Relaxed adds commute, so writers in different subtrees never wait for each other here
+    for (Folder* folder = this;; folder = &folder->get_parent()) {
+        folder->m_total_size.fetch_add(totals.size, memory_order_relaxed);
+        folder->m_file_count.fetch_add(totals.file_count, memory_order_relaxed);
+        folder->m_folder_count.fetch_add(totals.folder_count, memory_order_relaxed);
+        if (!folder->has_parent()) {
+            break;
         }
     }
+}
 
-    return false;
+void server::Folder::subtract_from_totals(const Totals& totals) noexcept
+{
+    for (Folder* folder = this;; folder = &folder->get_parent()) {
+        folder->m_total_size.fetch_sub(totals.size, memory_order_relaxed);
+        folder->m_file_count.fetch_sub(totals.file_count, memory_order_relaxed);
+        folder->m_folder_count.fetch_sub(totals.folder_count, memory_order_relaxed);
+        if (!folder->has_parent()) {
+            break;
+        }
+    }
 }
 
-const server::File& server::Folder::get_file(const string& name) const
+void server::Folder::attach(FileBase& file)
 {
-    try {
-        return dynamic_cast<const File&>(search_file(name));
-    } catch (bad_cast) {
-        throw runtime_error{ "The name does not refer to a file." };
+    file.set_parent(*this);
+    add_to_totals(totals_of(file));
+    if (m_tree == nullptr) {
+        return;
+    }
+
+    if (file.kind() == Kind::file) {
+        m_tree->name_index.insert(file.to_actually_type<File>());
+    } else {
+        file.to_actually_type<Folder>().join(*m_tree);
     }
 }
 
-server::File& server::Folder::get_file(const string& name)
+void server::Folder::detach(FileBase& file) noexcept
 {
-    try {
-        return dynamic_cast<File&>(search_file(name));
-    } catch (bad_cast) {
-        throw runtime_error{ "The name does not refer to a file." };
+    subtract_from_totals(totals_of(file));
+    if (m_tree == nullptr) {
+        return;
+    }
+
+    if (file.kind() == Kind::file) {
+        m_tree->name_index.erase(file.to_actually_type<File>());
+    } else {
+        file.to_actually_type<Folder>().unindex_files();
+        file.to_actually_type<Folder>().m_tree = nullptr;
     }
 }
 
-const server::Folder& server::Folder::get_folder(const string& name) const
+void server::Folder::join(Tree& tree)
 {
-    try {
-        return dynamic_cast<const Folder&>(search_file(name));
-    } catch (bad_cast) {
-        throw runtime_error{ "The name does not refer to a folder." };
+    const auto join_folder = [&tree](Folder& folder) {
+        folder.m_tree = &tree;
+        if (tree.synchronized && folder.m_lock_state == nullptr) {
+            polymorphic_allocator<> allocator = folder.get_allocator();
+            folder.m_lock_state = allocator.new_object<LockState>();
+        }
+        folder.publish_children();
+    };
+
+    join_folder(*this);
+    for_each_descendant([&tree, &join_folder](FileBase& file) {
+        if (file.kind() == Kind::file) {
+            tree.name_index.insert(file.to_actually_type<File>());
+        } else {
+            join_folder(file.to_actually_type<Folder>());
+        }
+    });
+}
+
+void server::Folder::Tree::commit(const WriteAheadLog::Record& record)
+{
+    log->commit(record);
+    if (log->should_checkpoint()) {
+        FileSystem::checkpoint(*log);
     }
 }
 
-server::Folder& server::Folder::get_folder(const string& name)
+void server::Folder::unindex_files() noexcept
 {
-    try {
-        return dynamic_cast<Folder&>(search_file(name));
-    } catch (bad_cast) {
-        throw runtime_error{ "The name does not refer to a folder." };
+    if (m_tree == nullptr) {
+        return;
+    }
+
+    NameIndex& index = m_tree->name_index;
+    for_each_descendant([&index](FileBase& file) {
+        if (file.kind() == Kind::file) {
+            index.erase(file.to_actually_type<File>());
+        } else {
+            file.to_actually_type<Folder>().m_tree = nullptr;
+        }
+    });
+}
+
+void server::Folder::publish_children()
+{
+    EpochDomain* domain = epoch_domain();
+    if (domain == nullptr) {
+        return;
     }
+
+    polymorphic_allocator<> allocator = get_allocator();
+    std::pmr::vector<ChildTable::Child> children(allocator);
+    children.reserve(m_files.size());
+    for (const auto& file : m_files) {
+        children.push_back({ file->name(), file.get() });
+    }
+
+    const ChildTable* table = allocator.new_object<ChildTable>(move(children));
+    const ChildTable* old_table = m_lock_state->child_table.exchange(table, memory_order_acq_rel);
+    if (old_table != nullptr) {
+        domain->retire([allocator, old_table]() mutable {
+            allocator.delete_object(const_cast<ChildTable*>(old_table));
+        });
+    }
+}
+
+server::FileBase& server::Folder::replace(container_of_file::iterator iter, file_pointer file)
+{
+    if ((*iter)->kind() == Kind::folder) {
+        bump_structure_generation();
+    }
+
+    detach(**iter);
+    const auto hint = next(iter);
+    auto replaced_file = m_files.extract(iter);
+    FileBase& added_file = **m_files.emplace_hint(hint, move(file));
+    attach(added_file);
+    publish_children();
+    retire(move(replaced_file.value()));
+    return added_file;
+}
+
+void server::Folder::retire(file_pointer file)
+{
+    const FileDeleter deleter = file.get_deleter();
+    epoch_domain()->retire([deleter, released_file = file.release()] { deleter(released_file); });
+}
+
+const server::FileBase* server::Folder::find_published(string_view name) const noexcept
+{
+    const ChildTable* table = published_children();
+    if (table == nullptr) {
+        return nullptr;
+    }
+
+    const auto iter = ranges::lower_bound(table->children, name, {}, &ChildTable::Child::name);
+    if (iter == table->children.end() || iter->name != name) {
+        return nullptr;
+    }
+
+    return iter->file;
+}
+
+server::Folder::ChildTable::ChildTable(std::pmr::vector<Child>&& children) noexcept
+    : children(move(children))
+{}
+
+server::Folder::Folder(const Folder& right) : FileBase(right)
+{
+    Measurement measurement{ Operation::copy };
+    copy_descendants(right);
 }
 
-bool server::Folder::remove(const string& name) noexcept
+server::Folder::Folder(const Folder& right, const allocator_type& allocator)
+    : FileBase(right, allocator)
+    , m_files(allocator)
 {
-    auto iter = m_files.begin();
-    auto end = m_files.end();
-    for (; iter != end; ++iter) {
-        if ((*iter)->name() == name) {
-            m_files.erase(iter);
-            return true;
+    Measurement measurement{ Operation::copy };
+    copy_descendants(right);
+}
+
+server::Folder::Folder(Folder&& right, const allocator_type& allocator)
+    : FileBase(move(right), allocator)
+    , m_files(allocator)
+{
+    // The children leave right, so paths through it may no longer lead where they did
+    right.bump_structure_generation();
+    right.unindex_files();
+    const auto moved_totals = right.totals();
+    if (right.get_allocator() == allocator) {
+        m_files.swap(right.m_files);
+        for (auto& file : m_files) {
+            file->set_parent(*this);
         }
+        add_to_totals(moved_totals);
+    } else {
+        // The files have to move to another resource anyway and copies share the contents
+        copy_descendants(right);
+        right.m_files.clear();
     }
 
-    return false;
+    right.subtract_from_totals(moved_totals);
+    right.publish_children();
+    if (logged_tree(right) != nullptr) {
+        right.log_assign();
+    }
 }
 
-const server::Folder&
-server::FileSystem::entry_path(const Folder& folder, const filesystem::path& path) const
+server::Folder::Folder(string_view name, const allocator_type& allocator)
+    : FileBase(Kind::folder, name, allocator)
+    , m_files(allocator)
+{}
+
+server::Folder::~Folder()
 {
-    const Folder* now = &folder;
-    for (const auto& subdir : path) {
-        if (subdir == ".") {
+    // Destroys the subtree from the bottom along the parent links, destroying the children
+    // directly would recurse as deep as the tree
+    for (Folder* folder = this; !m_files.empty();) {
+        if (folder->m_files.empty()) {
+            folder = &folder->get_parent();
+            folder->m_files.erase(folder->m_files.begin());
             continue;
-        } else if (subdir == "..") {
-            now = &(now->get_parent());
-        } else [[unlikely]] if (subdir == "/") {
-            now = &m_root;
-        } else [[likely]] if (!subdir.empty()) {
-            now = &(now->get_folder(subdir.generic_string()));
+        }
+
+        FileBase& first = **folder->m_files.begin();
+        if (first.kind() == Kind::folder && !first.to_actually_type<Folder>().m_files.empty()) {
+            folder = &first.to_actually_type<Folder>();
+        } else {
+            folder->m_files.erase(folder->m_files.begin());
         }
     }
 
-    return *now;
+    if (m_lock_state != nullptr) {
+        polymorphic_allocator<> allocator = get_allocator();
+        if (const ChildTable* table = m_lock_state->child_table.load(memory_order_relaxed)) {
+            allocator.delete_object(const_cast<ChildTable*>(table));
+        }
+        allocator.delete_object(m_lock_state);
+    }
 }
 
-server::Folder& server::FileSystem::entry_path(Folder& folder, const filesystem::path& path)
+server::Folder& server::Folder::operator=(const Folder& right)
 {
-    Folder* now = &folder;
-    for (const auto& subdir : path) {
-        if (subdir == ".") {
-            continue;
-        } else if (subdir == "..") {
-            now = &(now->get_parent());
-        } else [[unlikely]] if (subdir == "/") {
-            now = &m_root;
-        } else [[likely]] if (!subdir.empty()) {
-            now = &(now->get_folder(subdir.generic_string()));
+    if (this == &right) {
+        return *this;
+    }
+
+    assign(right);
+    if (logged_tree(*this) != nullptr) {
+        log_assign();
+    }
+    return *this;
+}
+
+server::Folder& server::Folder::operator=(Folder&& right)
+{
+    if (this == &right) {
+        return *this;
+    }
+
+    // A descendant of this folder is destroyed with the old children, otherwise right stays
+    // behind empty
+    bool right_is_descendant = false;
+    for (const FileBase* folder = &right; folder->has_parent();) {
+        folder = &folder->get_parent();
+        if (folder == this) {
+            right_is_descendant = true;
+            break;
         }
     }
+    assign(move(right));
+    if (!right_is_descendant && logged_tree(right) != nullptr) {
+        right.log_assign();
+    }
+    if (logged_tree(*this) != nullptr) {
+        log_assign();
+    }
+    return *this;
+}
 
-    return *now;
+void server::Folder::assign(const Folder& right)
+{
+    Measurement measurement{ Operation::copy };
+    bump_structure_generation();
+    // right may be below this folder, so it is copied before the children are replaced
+    Folder copy{ right, get_allocator() };
+    clear_files();
+    m_files.swap(copy.m_files);
+    for (auto& file : m_files) {
+        file->set_parent(*this);
+    }
+    add_to_totals(copy.totals());
+
+    if (m_tree != nullptr) {
+        join(*m_tree);
+    }
 }
 
-server::FileSystem::FileSystem() : m_root("/"), m_active_folder(&m_root) {}
+void server::Folder::assign(Folder&& right)
+{
+    bump_structure_generation();
+    right.unindex_files();
+    const auto moved_totals = right.totals();
+    right.subtract_from_totals(moved_totals);
+    // right may be below this folder, so its children are taken before they are replaced
+    container_of_file files{ move(right.m_files) };
+    right.m_files.clear();
+    right.publish_children();
+    clear_files();
+    m_files = move(files);
+    for (auto& file : m_files) {
+        file->set_parent(*this);
+    }
+    add_to_totals(moved_totals);
 
-const server::File& server::FileSystem::get_file(const filesystem::path& path) const
+    if (m_tree != nullptr) {
+        join(*m_tree);
+    }
+    right.publish_children();
+}
+
+void server::Folder::log_assign() const
 {
-    const Folder& folder = get_folder(path.parent_path());
-    return folder.get_file(path.filename().generic_string());
+    WriteAheadLog::Record record{ WriteAheadLog::RecordType::assign };
+    record.add(absolute_path()).add(*this);
+    m_tree->commit(record);
 }
 
-server::File& server::FileSystem::get_file(const filesystem::path& path)
+void server::Folder::log_add(const FileBase& file, HowToHandleFilesWithTheSameName how) const
 {
-    Folder& folder = get_folder(path.parent_path());
-    return folder.get_file(path.filename().generic_string());
+    WriteAheadLog::Record record{ WriteAheadLog::RecordType::create };
+    record.add(absolute_path()).add(static_cast<uint64_t>(how)).add(file);
+    m_tree->commit(record);
 }
 
-const server::Folder& server::FileSystem::get_folder(const filesystem::path& path) const
+server::Folder::Totals server::Folder::totals() const noexcept
 {
-    return entry_path(*m_active_folder, path);
+    return {
+        .size = m_total_size.load(memory_order_relaxed),
+        .file_count = m_file_count.load(memory_order_relaxed),
+        .folder_count = m_folder_count.load(memory_order_relaxed)
+    };
 }
 
-server::Folder& server::FileSystem::get_folder(const filesystem::path& path)
+bool server::Folder::has_file(string_view name) const noexcept
 {
-    return entry_path(*m_active_folder, path);
+    Measurement measurement{ Operation::child_lookup };
+    return m_files.contains(name);
 }
 
-bool server::FileSystem::remove(const filesystem::path& path)
+const server::File& server::Folder::get_file(string_view name) const
 {
-    Folder& folder = get_folder(path.parent_path());
-    return folder.remove(path.filename().generic_string());
+    const auto file = try_get_file(name);
+    if (!file) {
+        throw_error(file.error());
+    }
+
+    return *file;
 }
 
-vector<reference_wrapper<const server::File>> server::FileSystem::search_file(const string& name
-) const
+server::File& server::Folder::get_file(string_view name)
 {
-    vector<reference_wrapper<const File>> found_files;
-    queue<reference_wrapper<const Folder>> unvisited_folders;
-    unvisited_folders.emplace(m_root);
+    const auto file = try_get_file(name);
+    if (!file) {
+        throw_error(file.error());
+    }
 
-    while (!unvisited_folders.empty()) {
-        for (const auto& file : unvisited_folders.front().get()) {
-            if (typeid(file) == typeid(Folder)) {
-                unvisited_folders.push(file.to_actually_type<Folder>());
-            } else if (file.name() == name) {
-                found_files.emplace_back(file.to_actually_type<File>());
-            }
-        }
+    return *file;
+}
+
+const server::Folder& server::Folder::get_folder(string_view name) const
+{
+    const auto folder = try_get_folder(name);
+    if (!folder) {
+        throw_error(folder.error());
+    }
+
+    return *folder;
+}
 
-        unvisited_folders.pop();
+server::Folder& server::Folder::get_folder(string_view name)
+{
+    const auto folder = try_get_folder(name);
+    if (!folder) {
+        throw_error(folder.error());
     }
 
-    return found_files;
+    return *folder;
 }
 
-vector<reference_wrapper<server::File>> server::FileSystem::search_file(const string& name)
+server::expected<reference_wrapper<const server::File>, server::FileSystemError>
+server::Folder::try_get_file(string_view name) const noexcept
 {
-    vector<reference_wrapper<File>> found_files;
-    queue<reference_wrapper<Folder>> unvisited_folders;
-    unvisited_folders.emplace(m_root);
+    Measurement measurement{ Operation::child_lookup };
+    auto iter = m_files.find(name);
+    if (iter == m_files.end()) {
+        return unexpected{ FileSystemError::not_found };
+    }
+    if ((*iter)->kind() != Kind::file) {
+        return unexpected{ FileSystemError::not_a_file };
+    }
 
-    while (!unvisited_folders.empty()) {
-        for (auto& file : unvisited_folders.front().get()) {
-            if (typeid(file) == typeid(Folder)) {
-                unvisited_folders.emplace(file.to_actually_type<Folder>());
-            } else if (file.name() == name) {
-                found_files.emplace_back(file.to_actually_type<File>());
-            }
-        }
+    return (*iter)->to_actually_type<File>();
+}
 
-        unvisited_folders.pop();
+server::expected<reference_wrapper<server::File>, server::FileSystemError>
+server::Folder::try_get_file(string_view name) noexcept
+{
+    Measurement measurement{ Operation::child_lookup };
+    auto iter = m_files.find(name);
+    if (iter == m_files.end()) {
+        return unexpected{ FileSystemError::not_found };
+    }
+    if ((*iter)->kind() != Kind::file) {
+        return unexpected{ FileSystemError::not_a_file };
     }
 
-    return found_files;
+    return (*iter)->to_actually_type<File>();
+}
+
+server::expected<reference_wrapper<const server::Folder>, server::FileSystemError>
+server::Folder::try_get_folder(string_view name) const noexcept
+{
+    Measurement measurement{ Operation::child_lookup };
+    auto iter = m_files.find(name);
+    if (iter == m_files.end()) {
+        return unexpected{ FileSystemError::not_found };
+    }
+    if ((*iter)->kind() != Kind::folder) {
+        return unexpected{ FileSystemError::not_a_folder };
+    }
+
+    return (*iter)->to_actually_type<Folder>();
+}
+
+server::expected<reference_wrapper<server::Folder>, server::FileSystemError>
+server::Folder::try_get_folder(string_view name) noexcept
+{
+    Measurement measurement{ Operation::child_lookup };
+    auto iter = m_files.find(name);
+    if (iter == m_files.end()) {
+        return unexpected{ FileSystemError::not_found };
+    }
+    if ((*iter)->kind() != Kind::folder) {
+        return unexpected{ FileSystemError::not_a_folder };
+    }
+
+    return (*iter)->to_actually_type<Folder>();
+}
+
+bool server::Folder::remove(string_view name)
+{
+    Measurement measurement{ Operation::remove };
+    auto iter = m_files.find(name);
+    if (iter == m_files.end()) {
+        return false;
+    }
+
+    // Written first, name may point into the removed file
+    WriteAheadLog::Record record{ WriteAheadLog::RecordType::remove };
+    Tree* const tree = logged_tree(*this);
+    if (tree != nullptr) {
+        record.add(absolute_path()).add(name);
+    }
+
+    if ((*iter)->kind() == Kind::folder) {
+        bump_structure_generation();
+    }
+
+    detach(**iter);
+    if (epoch_domain() == nullptr) {
+        m_files.erase(iter);
+    } else {
+        auto removed_file = m_files.extract(iter);
+        publish_children();
+        retire(move(removed_file.value()));
+    }
+
+    if (tree != nullptr) {
+        tree->commit(record);
+    }
+    return true;
+}
+
+server::Folder::Page server::Folder::list(string_view cursor, size_t limit) const
+{
+    Page page;
+    page.files.reserve(min(limit, m_files.size()));
+    page.cursor = list_children(
+        m_files.upper_bound(cursor), m_files.end(), cursor, limit, [&](const file_pointer& file) {
+            page.files.push_back(*file);
+            return file->name();
+        }
+    );
+    return page;
+}
+
+const server::Folder&
+server::FileSystem::entry_path(const Folder& folder, const filesystem::path& path) const
+{
+    const auto found_folder = try_entry_path(folder, path);
+    if (!found_folder) {
+        throw_error(found_folder.error());
+    }
+
+    return *found_folder;
+}
+
+server::Folder& server::FileSystem::entry_path(Folder& folder, const filesystem::path& path)
+{
+    const auto found_folder = try_entry_path(folder, path);
+    if (!found_folder) {
+        throw_error(found_folder.error());
+    }
+
+    return *found_folder;
+}
+
+server::expected<reference_wrapper<const server::Folder>, server::FileSystemError>
+server::FileSystem::try_entry_path(const Folder& folder, const filesystem::path& path) const
+{
+    Measurement measurement{ Operation::path_walk };
+    LOCAL_HELPER_TRACE("FileSystem::entry_path");
+    size_t depth = 0;
+    const Folder* now = &folder;
+    for (const auto& subdir : path) {
+        if (subdir == ".") {
+            continue;
+        } else if (subdir == "..") {
+            if (now->has_parent()) {
+                now = &(now->get_parent());
+            }
+        } else [[unlikely]] if (subdir == "/") {
+            now = &m_root;
+        } else [[likely]] if (!subdir.empty()) {
+            const auto child = now->try_get_folder(subdir.generic_string());
+            if (!child) {
+                return child;
+            }
+            now = &(child->get());
+            ++depth;
+        }
+    }
+
+    if constexpr (metrics_enabled) {
+        Metrics::record_path_depth(depth);
+    }
+    return *now;
+}
+
+server::expected<reference_wrapper<server::Folder>, server::FileSystemError>
+server::FileSystem::try_entry_path(Folder& folder, const filesystem::path& path)
+{
+    Measurement measurement{ Operation::path_walk };
+    LOCAL_HELPER_TRACE("FileSystem::entry_path");
+    size_t depth = 0;
+    Folder* now = &folder;
+    for (const auto& subdir : path) {
+        if (subdir == ".") {
+            continue;
+        } else if (subdir == "..") {
+            if (now->has_parent()) {
+                now = &(now->get_parent());
+            }
+        } else [[unlikely]] if (subdir == "/") {
+            now = &m_root;
+        } else [[likely]] if (!subdir.empty()) {
+            const auto child = now->try_get_folder(subdir.generic_string());
+            if (!child) {
+                return child;
+            }
+            now = &(child->get());
+            ++depth;
+        }
+    }
+
+    if constexpr (metrics_enabled) {
+        Metrics::record_path_depth(depth);
+    }
+    return *now;
+}
+
+void server::FileSystem::throw_error(FileSystemError error)
+{
+    ::throw_error(error);
+}
+
+string_view server::FileSystem::absolute_path(const filesystem::path& path)
+{
+    refresh_working_directory();
+    m_path_buffer = m_active_key;
+    for (const auto& subdir : path) {
+        if (subdir == "." || subdir.empty()) {
+            continue;
+        } else if (subdir == "..") {
+            m_path_buffer.erase(min(m_path_buffer.rfind('/'), m_path_buffer.size()));
+        } else if (subdir == "/") {
+            m_path_buffer.clear();
+        } else {
+            m_path_buffer += '/';
+            m_path_buffer += subdir.generic_string();
+        }
+    }
+
+    if (m_path_buffer.empty()) {
+        return "/";
+    }
+
+    return m_path_buffer;
+}
+
+server::expected<reference_wrapper<server::Folder>, server::FileSystemError>
+server::FileSystem::try_entry_absolute_path(string_view path)
+{
+    Measurement measurement{ Operation::path_walk };
+    LOCAL_HELPER_TRACE("FileSystem::entry_path");
+    size_t depth = 0;
+    Folder* now = &m_root;
+    while (!path.empty()) {
+        const auto separator = min(path.find('/'), path.size());
+        if (separator != 0) {
+            const auto child = now->try_get_folder(path.substr(0, separator));
+            if (!child) {
+                return child;
+            }
+            now = &(child->get());
+            ++depth;
+        }
+
+        path.remove_prefix(min(separator + 1, path.size()));
+    }
+
+    if constexpr (metrics_enabled) {
+        Metrics::record_path_depth(depth);
+    }
+    return *now;
+}
+
+void server::FileSystem::replay(WriteAheadLog::RecordReader& record)
+{
+    using HowToHandle = Folder::HowToHandleFilesWithTheSameName;
+    using RecordType = WriteAheadLog::RecordType;
+
+    // Only changes which succeeded are logged, so they succeed again on the same tree
+    const auto read_path = [&record] { return filesystem::path{ record.read_string() }; };
+    switch (record.type()) {
+    case RecordType::create: {
+        Folder& folder = get_folder(read_path());
+        const auto how_to_handle = static_cast<HowToHandle>(record.read_integer());
+        visit(
+            [&](auto&& file) {
+                auto& added_file = folder.add(move(file), how_to_handle);
+                if (m_deduplication) {
+                    intern_contents(added_file);
+                }
+            },
+            record.read_file()
+        );
+        break;
+    }
+    case RecordType::remove: {
+        const auto folder = read_path();
+        remove(folder / record.read_string());
+        break;
+    }
+    case RecordType::rename: {
+        const auto folder = read_path();
+        const auto name = record.read_string();
+        rename(folder / name, record.read_string());
+        break;
+    }
+    case RecordType::change_content: {
+        const auto folder = read_path();
+        const auto name = record.read_string();
+        change_content(folder / name, string{ record.read_string() });
+        break;
+    }
+    case RecordType::move_file: {
+        const auto folder = read_path();
+        const auto name = record.read_string();
+        const auto new_folder = read_path();
+        move_file(folder / name, new_folder / record.read_string());
+        break;
+    }
+    case RecordType::batch: {
+        Batch batch;
+        for (auto count = record.read_integer(); count != 0; --count) {
+            const auto folder = read_path();
+            if (record.read_integer() == 0) {
+                batch.remove(folder / record.read_string());
+                continue;
+            }
+
+            const auto how_to_handle = static_cast<HowToHandle>(record.read_integer());
+            visit(
+                [&](auto&& file) { batch.create(move(file), folder, how_to_handle); },
+                record.read_file()
+            );
+        }
+        apply(move(batch));
+        break;
+    }
+    case RecordType::assign: {
+        Folder& folder = get_folder(read_path());
+        folder.assign(get<Folder>(record.read_file()));
+        if (m_deduplication) {
+            intern_contents(folder);
+        }
+        break;
+    }
+    case RecordType::write: {
+        const auto folder = read_path();
+        File& file = get_file(folder / record.read_string());
+        const auto offset = record.read_integer();
+        file.write(offset, record.read_string());
+        break;
+    }
+    case RecordType::truncate: {
+        const auto folder = read_path();
+        get_file(folder / record.read_string()).truncate(record.read_integer());
+        break;
+    }
+    default:
+        throw runtime_error{ "The log record is corrupted." };
+    }
+}
+
+filesystem::path server::FileSystem::normal_absolute_path(const filesystem::path& path) const
+{
+    return (m_active_path / path).lexically_normal();
+}
+
+void server::FileSystem::wait_for_readers(const Folder& folder)
+{
+    // Readers only move downwards, so a reader not met here has already left the subtree
+    vector<const Folder*> unvisited_folders{ &folder };
+    while (!unvisited_folders.empty()) {
+        const Folder& now = *unvisited_folders.back();
+        unvisited_folders.pop_back();
+        const auto lock = lock_of<unique_lock<shared_mutex>>(now);
+        for (const auto& file : now) {
+            if (file.kind() == FileBase::Kind::folder) {
+                unvisited_folders.push_back(&file.to_actually_type<Folder>());
+            }
+        }
+    }
+}
+
+void server::FileSystem::intern_contents(FileBase& file)
+{
+    if (file.kind() == FileBase::Kind::file) {
+        file.to_actually_type<File>().intern_content();
+        return;
+    }
+
+    file.to_actually_type<Folder>().for_each_descendant([](FileBase& descendant) {
+        if (descendant.kind() == FileBase::Kind::file) {
+            descendant.to_actually_type<File>().intern_content();
+        }
+    });
+}
+
+const server::Folder& server::FileSystem::lock_free_entry_path(const filesystem::path& path) const
+{
+    const Folder* now = &m_root;
+    for (const auto& subdir : path.relative_path()) {
+        if (subdir.empty()) {
+            continue;
+        }
+
+        const FileBase* file = now->find_published(subdir.generic_string());
+        if (file == nullptr) {
+            throw invalid_argument{ "Unknown filename." };
+        }
+        if (file->kind() != FileBase::Kind::folder) {
+            throw runtime_error{ "The name does not refer to a folder." };
+        }
+        now = &file->to_actually_type<Folder>();
+    }
+
+    return *now;
+}
+
+unique_ptr<memory_resource> server::FileSystem::make_pool(Synchronization synchronization)
+{
+    if (synchronization != Synchronization::none) {
+        return make_unique<synchronized_pool_resource>();
+    }
+
+    return make_unique<unsynchronized_pool_resource>();
+}
+
+unique_ptr<server::EpochDomain>
+server::FileSystem::make_epoch_domain(Synchronization synchronization)
+{
+    if (synchronization == Synchronization::lock_free_reads) {
+        return make_unique<EpochDomain>();
+    }
+
+    return nullptr;
+}
+
+server::FileSystem::FileSystem() : FileSystem(Synchronization::none) {}
+
+server::FileSystem::FileSystem(Synchronization synchronization)
+    : m_synchronization(synchronization)
+    , m_pool(make_pool(synchronization))
+    , m_epoch_domain(make_epoch_domain(synchronization))
+    , m_name_index(synchronization != Synchronization::none)
+    , m_root("/", m_pool.get())
+    , m_active_path("/")
+    , m_active_folder(&m_root)
+{
+    m_root.join(m_tree);
+}
+
+server::FileSystem::FileSystem(memory_resource* resource)
+    : m_root("/", resource)
+    , m_active_path("/")
+    , m_active_folder(&m_root)
+{
+    m_root.join(m_tree);
+}
+
+server::FileSystem::FileSystem(const FileSystem& right)
+    : m_synchronization(right.m_synchronization)
+    , m_pool(make_pool(right.m_synchronization))
+    , m_epoch_domain(make_epoch_domain(right.m_synchronization))
+    , m_name_index(right.m_synchronization != Synchronization::none)
+    , m_root(right.m_root, m_pool.get())
+    , m_active_folder(&m_root)
+    , m_path_cache(right.m_path_cache)
+    , m_deduplication(right.m_deduplication)
+{
+    m_root.join(m_tree);
+    set_working_directory(entry_path(m_root, right.m_active_folder->absolute_path()));
+}
+
+const server::File& server::FileSystem::get_file(const filesystem::path& path) const
+{
+    const auto file = try_get_file(path);
+    if (!file) {
+        throw_error(file.error());
+    }
+
+    return *file;
+}
+
+server::File& server::FileSystem::get_file(const filesystem::path& path)
+{
+    const auto file = try_get_file(path);
+    if (!file) {
+        throw_error(file.error());
+    }
+
+    return *file;
+}
+
+const server::Folder& server::FileSystem::get_folder(const filesystem::path& path) const
+{
+    return entry_path(*m_active_folder, path);
+}
+
+server::Folder& server::FileSystem::get_folder(const filesystem::path& path)
+{
+    const auto folder = try_get_folder(path);
+    if (!folder) {
+        throw_error(folder.error());
+    }
+
+    return *folder;
+}
+
+server::expected<reference_wrapper<const server::File>, server::FileSystemError>
+server::FileSystem::try_get_file(const filesystem::path& path) const
+{
+    const auto folder = try_get_folder(path.parent_path());
+    if (!folder) {
+        return unexpected{ folder.error() };
+    }
+
+    return folder->get().try_get_file(path.filename().generic_string());
+}
+
+server::expected<reference_wrapper<server::File>, server::FileSystemError>
+server::FileSystem::try_get_file(const filesystem::path& path)
+{
+    const auto folder = try_get_folder(path.parent_path());
+    if (!folder) {
+        return unexpected{ folder.error() };
+    }
+
+    return folder->get().try_get_file(path.filename().generic_string());
+}
+
+server::expected<reference_wrapper<const server::Folder>, server::FileSystemError>
+server::FileSystem::try_get_folder(const filesystem::path& path) const
+{
+    return try_entry_path(*m_active_folder, path);
+}
+
+server::expected<reference_wrapper<server::Folder>, server::FileSystemError>
+server::FileSystem::try_get_folder(const filesystem::path& path)
+{
+    if (m_path_cache.capacity() == 0 || steps_back_over_itself(path)) {
+        return try_entry_path(*m_active_folder, path);
+    }
+
+    const auto key = absolute_path(path);
+    if (Folder* cached_folder = m_path_cache.find(key, m_root.structure_generation())) {
+        return *cached_folder;
+    }
+
+    auto folder = try_entry_absolute_path(key);
+    if (folder) {
+        m_path_cache.insert(key, *folder);
+    }
+    return folder;
+}
+
+bool server::FileSystem::remove(const filesystem::path& path)
+{
+    Folder& folder = get_folder(path.parent_path());
+    const string name = path.filename().generic_string();
+    return folder.remove(name);
+}
+
+void server::FileSystem::rename(const filesystem::path& path, string_view new_name)
+{
+    if (!is_valid_name(new_name)) {
+        throw invalid_argument{ "Invalid filename." };
+    }
+
+    Folder& folder = get_folder(path.parent_path());
+    const string name = path.filename().generic_string();
+    auto iter = folder.m_files.find(name);
+    if (iter == folder.m_files.end()) {
+        throw invalid_argument{ "Unknown filename." };
+    }
+    if (name == new_name) {
+        return;
+    }
+
+    (*iter)->rename(new_name);
+}
+
+bool server::FileSystem::is_valid_name(string_view name) noexcept
+{
+    return !name.empty() && name != "." && name != ".." && name.find('/') == string_view::npos;
+}
+
+void server::FileSystem::move_file(const filesystem::path& from, const filesystem::path& to)
+{
+    const string new_name = to.filename().generic_string();
+    if (new_name.empty()) {
+        throw invalid_argument{ "Invalid filename." };
+    }
+
+    Folder& source = get_folder(from.parent_path());
+    const string name = from.filename().generic_string();
+    auto iter = source.m_files.find(name);
+    if (iter == source.m_files.end()) {
+        throw invalid_argument{ "Unknown filename." };
+    }
+    Folder& destination = get_folder(to.parent_path());
+    if (&destination == &source) {
+        rename(from, new_name);
+        return;
+    }
+    if (destination.m_files.contains(new_name)) {
+        throw runtime_error{ "A file with the same name exists" };
+    }
+
+    FileBase& file = **iter;
+    for (const FileBase* folder = &destination;; folder = &folder->get_parent()) {
+        if (folder == &file) {
+            throw runtime_error{ "A folder cannot be moved into itself." };
+        }
+        if (!folder->has_parent()) {
+            break;
+        }
+    }
+
+    // Both folders belong to this file system, so the subtree stays indexed and published and
+    // only the node of the moved file changes hands
+    if (file.kind() == FileBase::Kind::folder) {
+        source.bump_structure_generation();
+    }
+    const auto totals = Folder::totals_of(file);
+    auto node = source.m_files.extract(iter);
+    source.subtract_from_totals(totals);
+    if (name != new_name) {
+        file.set_name(new_name);
+    }
+    file.set_parent(destination);
+    destination.m_files.insert(move(node));
+    destination.add_to_totals(totals);
+    source.publish_children();
+    destination.publish_children();
+    refresh_working_directory();
+
+    if (m_tree.log != nullptr) {
+        // Neither folder is below the moved file, so their paths are the same before the move
+        WriteAheadLog::Record record{ WriteAheadLog::RecordType::move_file };
+        record.add(source.absolute_path()).add(name);
+        record.add(destination.absolute_path()).add(new_name);
+        m_tree.commit(record);
+    }
+}
+
+void server::FileSystem::change_content(const filesystem::path& path, string new_content)
+{
+    Measurement measurement{ Operation::change_content };
+    File& file = get_file(path);
+    file.change_content(move(new_content));
+    if (m_deduplication) {
+        file.intern_content();
+    }
+}
+
+server::FileSystem::Batch& server::FileSystem::Batch::remove(const filesystem::path& path)
+{
+    m_operations.push_back({
+        path.parent_path(),
+        path.filename().generic_string(),
+        Folder::HowToHandleFilesWithTheSameName::throw_exception,
+    });
+    return *this;
+}
+
+void server::FileSystem::apply(Batch batch)
+{
+    using HowToHandle = Folder::HowToHandleFilesWithTheSameName;
+
+    // Each operation is written once its folder is resolved and before its file is moved out of
+    // the batch, the record is committed once the whole batch is applied
+    WriteAheadLog::Record record{ WriteAheadLog::RecordType::batch };
+    if (m_tree.log != nullptr) {
+        record.add(uint64_t{ batch.m_operations.size() });
+    }
+    const auto log_operation = [&](const Folder& folder, const Batch::Operation& operation) {
+        if (m_tree.log == nullptr) {
+            return;
+        }
+
+        record.add(folder.absolute_path());
+        if (const auto* name = get_if<string>(&operation.target)) {
+            record.add(uint64_t{ 0 }).add(*name);
+            return;
+        }
+
+        record.add(uint64_t{ 1 });
+        record.add(static_cast<uint64_t>(operation.how_to_handle_files_with_the_same_name));
+        if (const auto* file = get_if<File>(&operation.target)) {
+            record.add(*file);
+        } else {
+            record.add(get<Folder>(operation.target));
+        }
+    };
+
+    // Operations of the same folder are applied together in the order the folders first appear,
+    // path is the folder of the first one as given and is resolved from the working directory
+    struct Group
+    {
+        filesystem::path path;
+        vector<Batch::Operation*> operations;
+    };
+
+    vector<Group> groups;
+    unordered_map<string, size_t> group_of_path;
+    for (auto& operation : batch.m_operations) {
+        if (m_deduplication) {
+            if (auto* file = get_if<File>(&operation.target)) {
+                intern_contents(*file);
+            } else if (auto* folder = get_if<Folder>(&operation.target)) {
+                intern_contents(*folder);
+            }
+        }
+
+        auto [iter, inserted] =
+            group_of_path.try_emplace(string{ absolute_path(operation.folder) }, groups.size());
+        if (inserted) {
+            groups.push_back({ operation.folder, {} });
+        }
+        groups[iter->second].operations.push_back(&operation);
+    }
+
+    // Either the node taken out of folder or the file added to it, undone in reverse order
+    struct Change
+    {
+        Folder* folder;
+        Folder::container_of_file::node_type removed_file;
+        FileBase* added_file = nullptr;
+    };
+
+    vector<Change> changes;
+    changes.reserve(batch.m_operations.size() * 2);
+    vector<Folder*> changed_folders;
+    changed_folders.reserve(groups.size());
+
+    const auto take_out = [&changes](Folder& folder, Folder::container_of_file::iterator iter) {
+        if ((*iter)->kind() == FileBase::Kind::folder) {
+            folder.bump_structure_generation();
+        }
+
+        folder.detach(**iter);
+        changes.push_back({ &folder, folder.m_files.extract(iter) });
+    };
+
+    const auto apply_operation = [&](Folder& folder, Batch::Operation& operation) {
+        if (const auto* name = get_if<string>(&operation.target)) {
+            auto iter = folder.m_files.find(*name);
+            if (iter != folder.m_files.end()) {
+                take_out(folder, iter);
+            }
+            return;
+        }
+
+        const bool is_file = holds_alternative<File>(operation.target);
+        const string_view name = is_file ? get<File>(operation.target).name()
+                                         : get<Folder>(operation.target).name();
+        auto iter = folder.m_files.lower_bound(name);
+        if (iter != folder.m_files.end() && (*iter)->name() == name) {
+            if (operation.how_to_handle_files_with_the_same_name == HowToHandle::throw_exception) {
+                throw runtime_error{ "A file with the same name exists" };
+            }
+            if (((*iter)->kind() == FileBase::Kind::file) != is_file) {
+                throw runtime_error{ is_file ? "The name does not refer to a file."
+                                             : "The name does not refer to a folder." };
+            }
+
+            const auto hint = next(iter);
+            take_out(folder, iter);
+            iter = hint;
+        }
+
+        file_pointer file = is_file
+                                ? folder.allocate_file<File>(move(get<File>(operation.target)))
+                                : folder.allocate_file<Folder>(move(get<Folder>(operation.target)));
+        FileBase& added_file = **folder.m_files.emplace_hint(iter, move(file));
+        changes.push_back({ &folder, {}, &added_file });
+        folder.attach(added_file);
+    };
+
+    const Batch::Operation* failed_operation = nullptr;
+    try {
+        for (auto& group : groups) {
+            failed_operation = group.operations.front();
+            Folder& folder = entry_path(*m_active_folder, group.path);
+            changed_folders.push_back(&folder);
+            for (Batch::Operation* operation : group.operations) {
+                failed_operation = operation;
+                log_operation(folder, *operation);
+                apply_operation(folder, *operation);
+            }
+        }
+    } catch (const exception& e) {
+        for (auto iter = changes.rbegin(); iter != changes.rend(); ++iter) {
+            Folder& folder = *(iter->folder);
+            if (iter->added_file != nullptr) {
+                auto added_file = folder.m_files.find(iter->added_file->name());
+                folder.detach(**added_file);
+                folder.m_files.erase(added_file);
+            } else {
+                FileBase& removed_file = **folder.m_files.insert(move(iter->removed_file)).position;
+                folder.attach(removed_file);
+            }
+        }
+
+        const auto index = failed_operation - batch.m_operations.data();
+        throw runtime_error{ "Operation " + to_string(index) + " of the batch failed, nothing was "
+                             "applied: " + e.what() };
+    }
+
+    // Readers without locks see the old children of a folder until its table is replaced
+    for (Folder* folder : changed_folders) {
+        folder->publish_children();
+    }
+    for (auto& change : changes) {
+        if (!change.removed_file.empty() && change.folder->epoch_domain() != nullptr) {
+            change.folder->retire(move(change.removed_file.value()));
+        }
+    }
+
+    if (m_tree.log != nullptr) {
+        m_tree.commit(record);
+    }
+}
+
+void server::FileSystem::save_snapshot(const filesystem::path& path) const
+{
+    Snapshot::write(m_root, path);
+}
+
+void server::FileSystem::load_snapshot(const filesystem::path& path)
+{
+    const Snapshot snapshot{ path };
+    Folder root{ m_root.name(), m_root.get_allocator() };
+    snapshot.materialize(root);
+
+    // Not logged, the log restarts from the image below
+    m_root.assign(move(root));
+    set_working_directory(m_root);
+    m_path_cache.clear();
+
+    // The log cannot describe the replacement, so it restarts from a copy of the image
+    if (m_log != nullptr) {
+        m_log->checkpoint([image = filesystem::absolute(path)](const auto& checkpoint) {
+            FileSystem state;
+            state.load_snapshot(image);
+            Snapshot::write(state.m_root, checkpoint.snapshot());
+        });
+    }
+}
+
+void server::FileSystem::open_log(
+    const filesystem::path& directory,
+    const WriteAheadLog::Options& options
+)
+{
+    m_tree.log = nullptr;
+    m_log.reset();
+    auto log = make_unique<WriteAheadLog>(directory, options);
+    if (const auto snapshot = log->latest_snapshot(); !snapshot.empty()) {
+        load_snapshot(snapshot);
+    } else {
+        m_root = Folder{ m_root.name(), m_root.get_allocator() };
+        set_working_directory(m_root);
+        m_path_cache.clear();
+    }
+
+    log->replay([this](WriteAheadLog::RecordReader& record) { replay(record); });
+    m_log = move(log);
+    m_tree.log = m_log.get();
+}
+
+void server::FileSystem::checkpoint()
+{
+    if (m_log == nullptr) {
+        throw logic_error{ "No log is open." };
+    }
+
+    checkpoint(*m_log);
+}
+
+void server::FileSystem::checkpoint(WriteAheadLog& log)
+{
+    // Rebuilt from the previous snapshot and the log off the write path, so no writer waits
+    // for a copy of the tree
+    log.checkpoint([](const WriteAheadLog::Checkpoint& checkpoint) {
+        FileSystem state;
+        if (!checkpoint.base_snapshot().empty()) {
+            state.load_snapshot(checkpoint.base_snapshot());
+        }
+        checkpoint.replay([&state](WriteAheadLog::RecordReader& record) { state.replay(record); });
+        Snapshot::write(state.m_root, checkpoint.snapshot());
+    });
+}
+
+void server::FileSystem::change_directory(const filesystem::path& path)
+{
+    set_working_directory(get_folder(path));
+}
+
+void server::FileSystem::set_working_directory(Folder& folder)
+{
+    m_active_folder = &folder;
+    m_active_key = folder.absolute_path();
+    m_active_path = m_active_key;
+    if (m_active_key == "/") {
+        m_active_key.clear();
+    }
+    m_active_generation = m_root.structure_generation();
+}
+
+void server::FileSystem::refresh_working_directory()
+{
+    // A rename or move of the working directory or of an ancestor leaves the lexical paths
+    // behind, every such change bumps the structure generation
+    if (m_active_generation != m_root.structure_generation()) {
+        set_working_directory(*m_active_folder);
+    }
+}
+
+vector<reference_wrapper<const server::File>> server::FileSystem::search_file(string_view name
+) const
+{
+    Measurement measurement{ Operation::search };
+    LOCAL_HELPER_TRACE("FileSystem::search_file");
+    vector<reference_wrapper<const File>> found_files;
+    m_name_index.for_each(name, [&found_files](const File& file) {
+        found_files.emplace_back(file);
+    });
+    return found_files;
+}
+
+vector<reference_wrapper<server::File>> server::FileSystem::search_file(string_view name)
+{
+    Measurement measurement{ Operation::search };
+    LOCAL_HELPER_TRACE("FileSystem::search_file");
+    vector<reference_wrapper<File>> found_files;
+    m_name_index.for_each(name, [&found_files](File& file) { found_files.emplace_back(file); });
+    return found_files;
+}
+
+vector<reference_wrapper<const server::File>>
+server::FileSystem::search_file_with_prefix(string_view prefix) const
+{
+    Measurement measurement{ Operation::search };
+    LOCAL_HELPER_TRACE("FileSystem::search_file");
+    vector<reference_wrapper<const File>> found_files;
+    m_name_index.for_each_with_prefix(prefix, [&found_files](const File& file) {
+        found_files.emplace_back(file);
+    });
+    return found_files;
+}
+
+vector<reference_wrapper<server::File>>
+server::FileSystem::search_file_with_prefix(string_view prefix)
+{
+    Measurement measurement{ Operation::search };
+    LOCAL_HELPER_TRACE("FileSystem::search_file");
+    vector<reference_wrapper<File>> found_files;
+    m_name_index.for_each_with_prefix(prefix, [&found_files](File& file) {
+        found_files.emplace_back(file);
+    });
+    return found_files;
+}
+
+vector<reference_wrapper<const server::File>>
+server::FileSystem::search_file_matching(string_view pattern) const
+{
+    Measurement measurement{ Operation::search };
+    LOCAL_HELPER_TRACE("FileSystem::search_file");
+    vector<reference_wrapper<const File>> found_files;
+    m_name_index.for_each_matching(Glob{ pattern }, [&found_files](const File& file) {
+        found_files.emplace_back(file);
+    });
+    return found_files;
+}
+
+vector<reference_wrapper<server::File>>
+server::FileSystem::search_file_matching(string_view pattern)
+{
+    Measurement measurement{ Operation::search };
+    LOCAL_HELPER_TRACE("FileSystem::search_file");
+    vector<reference_wrapper<File>> found_files;
+    m_name_index.for_each_matching(Glob{ pattern }, [&found_files](File& file) {
+        found_files.emplace_back(file);
+    });
+    return found_files;
+}
+
+vector<reference_wrapper<const server::File>>
+server::FileSystem::search_file_containing(string_view substring) const
+{
+    Measurement measurement{ Operation::search };
+    LOCAL_HELPER_TRACE("FileSystem::search_file");
+    vector<reference_wrapper<const File>> found_files;
+    m_name_index.for_each_containing(substring, [&found_files](const File& file) {
+        found_files.emplace_back(file);
+    });
+    return found_files;
+}
+
+vector<reference_wrapper<server::File>>
+server::FileSystem::search_file_containing(string_view substring)
+{
+    Measurement measurement{ Operation::search };
+    LOCAL_HELPER_TRACE("FileSystem::search_file");
+    vector<reference_wrapper<File>> found_files;
+    m_name_index.for_each_containing(substring, [&found_files](File& file) {
+        found_files.emplace_back(file);
+    });
+    return found_files;
+}
+
+void server::FileSystem::sample_metrics() const
+{
+    const auto totals = m_root.totals();
+    Metrics::set_tree_size(totals.file_count + totals.folder_count, totals.size);
+}
+
+vector<reference_wrapper<const server::File>>
+server::FileSystem::search_file_if(const function<bool(const File&)>& predicate) const
+{
+    Measurement measurement{ Operation::search };
+    LOCAL_HELPER_TRACE("FileSystem::search_file");
+    return find_files(parallel, m_root, predicate);
+}
+
+vector<reference_wrapper<server::File>>
+server::FileSystem::search_file_if(const function<bool(const File&)>& predicate)
+{
+    Measurement measurement{ Operation::search };
+    LOCAL_HELPER_TRACE("FileSystem::search_file");
+    vector<reference_wrapper<File>> found_files;
+    // The tree is reachable through this non-const FileSystem, so handing out File& is safe
+    for (const File& file : find_files(parallel, m_root, predicate)) {
+        found_files.emplace_back(const_cast<File&>(file));
+    }
+    return found_files;
+}
+
+void server::FileSystem::concurrent_visit_file(
+    const filesystem::path& path,
+    const function<void(const File&)>& visitor
+) const
+{
+    const auto absolute_path = normal_absolute_path(path);
+    shared_lock<shared_mutex> lock;
+    const Folder& folder = lock_folder(m_root, absolute_path.parent_path(), lock);
+    visitor(folder.get_file(absolute_path.filename().generic_string()));
+}
+
+void server::FileSystem::concurrent_visit_folder(
+    const filesystem::path& path,
+    const function<void(const Folder&)>& visitor
+) const
+{
+    shared_lock<shared_mutex> lock;
+    visitor(lock_folder(m_root, normal_absolute_path(path), lock));
+}
+
+void server::FileSystem::concurrent_list_folder(
+    const filesystem::path& path,
+    string_view cursor,
+    size_t limit,
+    const function<void(const Folder::Page&)>& visitor
+) const
+{
+    shared_lock<shared_mutex> lock;
+    visitor(lock_folder(m_root, normal_absolute_path(path), lock).list(cursor, limit));
+}
+
+bool server::FileSystem::concurrent_remove(const filesystem::path& path)
+{
+    const auto absolute_path = normal_absolute_path(path);
+    const auto name = absolute_path.filename().generic_string();
+    unique_lock<shared_mutex> lock;
+    Folder& folder = lock_folder(m_root, absolute_path.parent_path(), lock);
+    auto iter = folder.m_files.find(name);
+    if (iter == folder.m_files.end()) {
+        return false;
+    }
+    if ((*iter)->kind() == FileBase::Kind::folder) {
+        wait_for_readers((*iter)->to_actually_type<Folder>());
+    }
+
+    return folder.remove(name);
+}
+
+vector<string> server::FileSystem::concurrent_search_file(string_view name) const
+{
+    Measurement measurement{ Operation::search };
+    LOCAL_HELPER_TRACE("FileSystem::concurrent_search_file");
+    // Writers take a file out of the index before they destroy it or its folders, so the path
+    // is complete while the index is locked
+    vector<string> paths;
+    m_name_index.for_each(name, [&paths](const File& file) {
+        paths.push_back(file.absolute_path());
+    });
+    return paths;
+}
+
+void server::FileSystem::lock_free_visit_file(
+    const filesystem::path& path,
+    const function<void(const File&)>& visitor
+) const
+{
+    assert(m_epoch_domain != nullptr);
+    const auto absolute_path = normal_absolute_path(path);
+    EpochDomain::Guard guard{ *m_epoch_domain };
+    const Folder& folder = lock_free_entry_path(absolute_path.parent_path());
+    const FileBase* file = folder.find_published(absolute_path.filename().generic_string());
+    if (file == nullptr) {
+        throw invalid_argument{ "Unknown filename." };
+    }
+    if (file->kind() != FileBase::Kind::file) {
+        throw runtime_error{ "The name does not refer to a file." };
+    }
+
+    visitor(file->to_actually_type<File>());
+}
+
+void server::FileSystem::lock_free_visit_folder(
+    const filesystem::path& path,
+    const function<void(const FileBase&)>& visitor
+) const
+{
+    assert(m_epoch_domain != nullptr);
+    const auto absolute_path = normal_absolute_path(path);
+    EpochDomain::Guard guard{ *m_epoch_domain };
+    const Folder::ChildTable* table = lock_free_entry_path(absolute_path).published_children();
+    for (const auto& child : table->children) {
+        visitor(*child.file);
+    }
+}
+
+void server::FileSystem::lock_free_list_folder(
+    const filesystem::path& path,
+    string_view cursor,
+    size_t limit,
+    const function<void(const Folder::Page&)>& visitor
+) const
+{
+    using Child = Folder::ChildTable::Child;
+
+    assert(m_epoch_domain != nullptr);
+    const auto absolute_path = normal_absolute_path(path);
+    EpochDomain::Guard guard{ *m_epoch_domain };
+    const auto& children = lock_free_entry_path(absolute_path).published_children()->children;
+    Folder::Page page;
+    page.files.reserve(min(limit, children.size()));
+    page.cursor = list_children(
+        ranges::upper_bound(children, cursor, {}, &Child::name),
+        children.end(),
+        cursor,
+        limit,
+        [&](const Child& child) {
+            page.files.push_back(*child.file);
+            return child.name;
+        }
+    );
+    visitor(page);
 }
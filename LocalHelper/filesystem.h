@@ -2,20 +2,40 @@
 #ifndef FILE_SYSTEM_H_
 #  define FILE_SYSTEM_H_
 #  include <cassert>
+#  include <cstdint>
 #  include <cstdlib>
 
 #  include <algorithm>
+#  include <array>
+#  include <atomic>
 #  include <filesystem>
+#  include <functional>
 #  include <memory>
+#  include <memory_resource>
+#  include <mutex>
 #  include <ranges>
+#  include <set>
+#  include <shared_mutex>
+#  include <span>
 #  include <stdexcept>
 #  include <string>
+#  include <string_view>
 #  include <type_traits>
-#  include <unordered_set>
 #  include <utility>
 #  include <variant>
 #  include <vector>
 
+#  include "chunked_content.h"
+#  include "epoch.h"
+#  include "expected.h"
+#  include "interned_name.h"
+#  include "metrics.h"
+#  include "name_index.h"
+#  include "path_cache.h"
+#  include "static_path.h"
+#  include "trace.h"
+#  include "wal.h"
+
 namespace server
 {
     template <typename Container>
@@ -25,22 +45,68 @@ namespace server
     };
 
     class FileBase;
+    class File;
+    class Folder;
+
+    // Destroys a file and returns its memory to the resource it was allocated from, which is
+    // the one of its allocator
+    class FileDeleter
+    {
+    public:
+        void operator()(FileBase* file) const noexcept;
+    };
+
+    using file_pointer = std::unique_ptr<FileBase, FileDeleter>;
 
     template <typename Iter>
     concept folder_files_iterator =
         std::forward_iterator<Iter> &&
-        std::same_as<std::decay_t<typename Iter::value_type>, std::unique_ptr<FileBase>>;
+        std::same_as<std::decay_t<typename Iter::value_type>, file_pointer>;
 
+    // Why a lookup failed
+    enum class FileSystemError
+    {
+        not_found,
+        not_a_file,
+        not_a_folder
+    };
+
+    // Files and folders carry their kind instead of a vtable, dispatch switches over it
     class FileBase
     {
+        friend class FileSystem;
     public:
-        constexpr virtual ~FileBase() = default;
-        constexpr FileBase(const std::string& name);
-        constexpr FileBase(std::string&& name) noexcept;
+        using allocator_type = std::pmr::polymorphic_allocator<>;
 
-        constexpr std::string name() const noexcept;
-        constexpr void rename(const std::string& new_name);
-        constexpr void rename(std::string&& new_name) noexcept;
+        enum class Kind : std::uint8_t
+        {
+            file,
+            folder
+        };
+
+        template <typename T>
+        static constexpr Kind kind_of =
+            std::is_same_v<std::remove_cv_t<T>, File> ? Kind::file : Kind::folder;
+
+        FileBase& operator=(const FileBase& right);
+
+        inline Kind kind() const noexcept;
+        // Calls function with the File or the Folder this is
+        template <typename Function>
+        decltype(auto) visit(Function&& function) const;
+        template <typename Function>
+        decltype(auto) visit(Function&& function);
+        inline allocator_type get_allocator() const noexcept;
+        inline std::string_view name() const noexcept;
+        inline std::string copy_name() const;
+        // Keeps the parent ordered by name, throws if it holds new_name already
+        void rename(std::string_view new_name);
+        // Follows the parents, "/" for a folder without one
+        std::string absolute_path() const;
+        inline bool has_parent() const noexcept;
+        inline const Folder& get_parent() const noexcept;
+        inline Folder& get_parent() noexcept;
+        inline void set_parent(Folder& folder) noexcept;
 
         template <typename T>
         constexpr const T& to_actually_type() const noexcept
@@ -49,25 +115,113 @@ namespace server
         template <typename T>
         constexpr T& to_actually_type() noexcept
         requires std::is_base_of_v<FileBase, T>;
+    protected:
+        // Only destroyed as the File or Folder it is, see FileDeleter
+        constexpr ~FileBase() = default;
+        // Copies only the name, a copy is not linked to any parent
+        FileBase(const FileBase& right);
+        FileBase(const FileBase& right, const allocator_type& allocator);
+        FileBase(FileBase&& right, const allocator_type& allocator);
+        FileBase(Kind kind, std::string_view name, const allocator_type& allocator = {});
     private:
-        std::string m_name;
+        // Renames without reordering the parent, the caller takes the file out of it meanwhile
+        void set_name(std::string_view new_name);
+
+        InternedName m_name;
+        allocator_type m_allocator;
+        Folder* m_parent = nullptr;
+        Kind m_kind;
     };
 
     class File : public FileBase
     {
+        friend class Folder;
     public:
         File() = delete;
-        constexpr File(const File&) = default;
-        constexpr File(const std::string& name, const std::string& content);
-        constexpr File(const std::string& name, std::string&& content);
-        constexpr File(std::string&& name, const std::string& content);
-        constexpr File(std::string&& name, std::string&& content) noexcept;
-
-        constexpr std::string content() const noexcept;
-        constexpr void change_content(const std::string& new_content);
-        constexpr void change_content(std::string&& new_content) noexcept;
+        File(const File&) = default;
+        File(const File& right, const allocator_type& allocator);
+        File(File&& right, const allocator_type& allocator);
+        File(
+            std::string_view name,
+            const std::string& content,
+            const allocator_type& allocator = {}
+        );
+        File(std::string_view name, std::string&& content, const allocator_type& allocator = {});
+        // Refers to content kept alive by owner instead of copying it, e.g. inside a mapped file
+        File(
+            std::string_view name,
+            std::shared_ptr<const void> owner,
+            std::string_view content,
+            const allocator_type& allocator = {}
+        );
+
+        // Replace the content and keep the name, so the parent stays ordered and its totals
+        // follow the size
+        File& operator=(const File& right);
+        File& operator=(File&& right);
+
+        // O(size) for a chunked content, i.e. one edited while longer than a chunk: it is copied
+        // into one piece on first use, which is kept until the next change. read and
+        // for_each_shared_chunk avoid that.
+        inline std::string_view content() const;
+        inline std::string copy_content() const;
+        inline std::size_t size() const noexcept;
+        // Copies content from offset into buffer, returns the number of chars copied
+        inline std::size_t read(std::span<char> buffer, std::size_t offset = 0) const noexcept;
+        // Calls function with the pieces of the content in order
+        template <typename Function>
+        void for_each_chunk(Function&& function) const;
+        // Calls function(owner, piece) for the pieces of [offset, offset + size) in order. owner
+        // keeps piece alive and unchanged once the file changes. It is null for contents stored
+        // in place, their pieces only live as long as the file.
+        template <typename Function>
+        void for_each_shared_chunk(std::size_t offset, std::size_t size, Function&& function) const;
+        inline void change_content(const std::string& new_content);
+        inline void change_content(std::string&& new_content);
+        // The first edit of a content longer than a chunk splits it, later ones cost O(chunk).
+        // Writing beyond the end fills the gap with '\0'.
+        void write(std::size_t offset, std::string_view data);
+        void append(std::string_view data);
+        // Shrinks to size or extends with '\0'
+        void truncate(std::size_t size);
+        // Keeps the content in BlobStore, which stores equal ones once. Contents stored in place,
+        // referred to or chunked keep their own storage.
+        void intern_content();
     private:
-        std::string m_content;
+        // Contents up to this size are stored in place, longer ones are shared between copies
+        static constexpr std::size_t inline_content_size = 31;
+
+        struct InlineContent
+        {
+            std::array<char, inline_content_size> chars;
+            std::uint8_t size;
+        };
+
+        struct ExternalContent
+        {
+            std::shared_ptr<const void> owner;
+            std::string_view content;
+        };
+
+        // Chunked contents are shared as a whole until one of the copies changes
+        using content_type = std::variant<
+            InlineContent,
+            std::shared_ptr<const std::string>,
+            ExternalContent,
+            std::shared_ptr<ChunkedContent>>;
+
+        static inline content_type make_content(std::string&& content);
+        // Like operator=, but not logged
+        void assign(const File& right);
+        void assign(File&& right);
+        template <typename Edit>
+        void edit_content(Edit&& edit);
+        // Logs the whole content as changed if the file system of the file keeps a log
+        void log_content() const;
+        // Updates the totals of the ancestors after the size changed from old_size
+        void resize_in_totals(std::size_t old_size) noexcept;
+
+        content_type m_content;
     };
 
     template <folder_files_iterator Iter>
@@ -89,15 +243,117 @@ namespace server
 
     class Folder : public FileBase
     {
+        friend class FileBase;
+        friend class File;
+        friend class FileSystem;
     private:
-        using container_of_file = std::unordered_set<std::unique_ptr<FileBase>>;
+        // Orders files by name, lookups accept any string_view
+        struct file_name_less
+        {
+            using is_transparent = void;
+
+            inline bool operator()(
+                const file_pointer& left,
+                const file_pointer& right
+            ) const noexcept;
+            inline bool operator()(const file_pointer& left, std::string_view right) const noexcept;
+            inline bool operator()(std::string_view left, const file_pointer& right) const noexcept;
+        };
+
+        using container_of_file = std::pmr::set<file_pointer, file_name_less>;
+
+        // Immutable copy of m_files for readers without locks, names point into the children
+        struct ChildTable
+        {
+            struct Child
+            {
+                std::string_view name;
+                const FileBase* file;
+            };
+
+            explicit ChildTable(std::pmr::vector<Child>&& children) noexcept;
+
+            std::pmr::vector<Child> children;
+        };
+
+        // Shared by the folders of one file system, which points all of them at its own
+        struct Tree
+        {
+            NameIndex& name_index;
+            // Set if the file system serves readers without locks
+            EpochDomain* epoch_domain;
+            // Set if the concurrent members of the file system lock its folders
+            bool synchronized;
+            // Changes whenever a folder of the tree is removed, renamed, moved or overwritten
+            std::atomic<std::uint64_t> structure_generation = 0;
+            // Set while the file system keeps a log, every change of the tree is recorded there
+            WriteAheadLog* log = nullptr;
+
+            // Commits record to log and checkpoints once the log has grown enough
+            void commit(const WriteAheadLog::Record& record);
+        };
+
+        // What the concurrent and lock_free members of FileSystem need of a folder, allocated
+        // once it joins a synchronized tree
+        struct LockState
+        {
+            // Guards m_files
+            std::shared_mutex mutex;
+            std::atomic<const ChildTable*> child_table = nullptr;
+        };
     public:
         using iterator = FolderIteratorBase<container_of_file::iterator>;
         using const_iterator = FolderIteratorBase<container_of_file::const_iterator>;
     private:
-        void copy_files_from_folder(const container_of_file& files);
-        const FileBase& search_file(const std::string& name) const;
-        FileBase& search_file(const std::string& name);
+        template <typename FileType, typename... Args>
+        file_pointer allocate_file(Args&&... args);
+        // Copies the subtree of right below this folder without recursion, the copies are
+        // neither indexed nor published
+        void copy_descendants(const Folder& right);
+        // Detaches and destroys the children, retires them if readers without locks may be
+        // inside. The caller publishes the children again.
+        void clear_files();
+        void attach(FileBase& file);
+        void detach(FileBase& file) noexcept;
+        // Points this folder and the folders below at tree, indexes the files below and
+        // publishes the children of the folders if readers without locks may come
+        void join(Tree& tree);
+        // Takes the files below out of the index, the folders below out of the tree
+        void unindex_files() noexcept;
+        // Publishes a new child table, the old one is retired
+        void publish_children();
+        FileBase& replace(container_of_file::iterator iter, file_pointer file);
+        void retire(file_pointer file);
+        const FileBase* find_published(std::string_view name) const noexcept;
+        inline const ChildTable* published_children() const noexcept;
+        // Null unless readers without locks may be inside
+        inline EpochDomain* epoch_domain() const noexcept;
+        // Null unless the folder belongs to a synchronized file system
+        inline std::shared_mutex* mutex() const noexcept;
+        template <typename Function>
+        void for_each_descendant(Function&& function);
+        inline void bump_structure_generation() noexcept;
+        // The tree of the file system file belongs to if it keeps a log, else null
+        static inline Tree* logged_tree(const FileBase& file) noexcept;
+        // Like operator=, but not logged
+        void assign(const Folder& right);
+        void assign(Folder&& right);
+        // Logs the children of this folder as replacing the ones before
+        void log_assign() const;
+    public:
+        // Of the files and folders below a folder
+        struct Totals
+        {
+            std::uint64_t size = 0;
+            std::uint64_t file_count = 0;
+            std::uint64_t folder_count = 0;
+        };
+    private:
+        // Of file and its descendants, what it adds to the totals of its ancestors
+        static Totals totals_of(const FileBase& file) noexcept;
+        // Applies to this folder and its ancestors
+        void add_to_totals(const Totals& totals) noexcept;
+        void subtract_from_totals(const Totals& totals) noexcept;
     public:
         // What to do with files with the same name
         enum class HowToHandleFilesWithTheSameName
@@ -106,13 +362,28 @@ namespace server
             throw_exception
         };
 
+        // Children in name order, see list
+        struct Page
+        {
+            std::vector<std::reference_wrapper<const FileBase>> files;
+            // Where the next page starts, empty after the last one
+            std::string cursor;
+        };
+
         Folder() = delete;
         Folder(const Folder& right);
-        Folder(const std::string& name);
-        Folder(std::string&& name);
+        Folder(const Folder& right, const allocator_type& allocator);
+        Folder(Folder&& right, const allocator_type& allocator);
+        Folder(std::string_view name, const allocator_type& allocator = {});
+        ~Folder();
 
+        // Replace the children and keep the name, so the parent stays ordered
         Folder& operator=(const Folder& right);
-        Folder& operator=(Folder&&) = default;
+        Folder& operator=(Folder&& right);
+
+        // Changes whenever a folder of the file system this folder belongs to is removed,
+        // renamed, moved or overwritten, always 0 outside of a file system
+        inline std::uint64_t structure_generation() const noexcept;
 
         inline const_iterator cbegin() const noexcept;
         inline const_iterator begin() const noexcept;
@@ -120,90 +391,372 @@ namespace server
         inline const_iterator cend() const noexcept;
         inline const_iterator end() const noexcept;
         inline iterator end() noexcept;
-        inline bool has_parent() const noexcept;
-        inline const Folder& get_parent() const noexcept;
-        inline Folder& get_parent() noexcept;
-        inline void set_parent(Folder& folder) noexcept;
-        bool has_file(const std::string& name) const noexcept;
-        const File& get_file(const std::string& name) const;
-        File& get_file(const std::string& name);
-        const Folder& get_folder(const std::string& name) const;
-        Folder& get_folder(const std::string& name);
+        bool has_file(std::string_view name) const noexcept;
+        const File& get_file(std::string_view name) const;
+        File& get_file(std::string_view name);
+        const Folder& get_folder(std::string_view name) const;
+        Folder& get_folder(std::string_view name);
+        // Like the get members, but a missing name or the wrong kind is returned as the error
+        expected<std::reference_wrapper<const File>, FileSystemError>
+        try_get_file(std::string_view name) const noexcept;
+        expected<std::reference_wrapper<File>, FileSystemError>
+        try_get_file(std::string_view name) noexcept;
+        expected<std::reference_wrapper<const Folder>, FileSystemError>
+        try_get_folder(std::string_view name) const noexcept;
+        expected<std::reference_wrapper<Folder>, FileSystemError>
+        try_get_folder(std::string_view name) noexcept;
         template <typename FileType>
         decltype(auto)
         add(FileType&& file, HowToHandleFilesWithTheSameName how_to_handle_files_with_the_same_name)
         requires std::is_base_of_v<FileBase, std::decay_t<FileType>>;
-        bool remove(const std::string& name) noexcept;
+        bool remove(std::string_view name);
+        // At most limit children after cursor, from the first one for an empty cursor. A cursor
+        // is the last name of a page, so the next one resumes in O(log n) where it stopped even
+        // if children were added or removed meanwhile.
+        Page list(std::string_view cursor, std::size_t limit) const;
+        // In O(1), every change below is added up the parents as it happens. The concurrent
+        // members of FileSystem update them without locks, so they may lag behind a change the
+        // caller does not synchronize with.
+        Totals totals() const noexcept;
     private:
+        void log_add(
+            const FileBase& file,
+            HowToHandleFilesWithTheSameName how_to_handle_files_with_the_same_name
+        ) const;
+
         container_of_file m_files;
-        Folder* m_parent = nullptr;
+        // Of the file system this folder belongs to, if any
+        Tree* m_tree = nullptr;
+        // Out of line, so the folders of a file system without synchronization do not pay for it
+        LockState* m_lock_state = nullptr;
+        std::atomic<std::uint64_t> m_total_size = 0;
+        std::atomic<std::uint64_t> m_file_count = 0;
+        std::atomic<std::uint64_t> m_folder_count = 0;
     };
 
+    // Files and folders are allocated from a pool owned by the file system unless a memory
+    // resource is given, e.g. a std::pmr::monotonic_buffer_resource which must outlive it
     class FileSystem
     {
+        friend class Folder;
     private:
         const Folder& entry_path(const Folder& folder, const std::filesystem::path& path) const;
         Folder& entry_path(Folder& folder, const std::filesystem::path& path);
+        std::string_view absolute_path(const std::filesystem::path& path);
+        // Makes folder the working directory and derives its path and key from the tree
+        void set_working_directory(Folder& folder);
+        // Recomputes the working directory paths after a rename or move may have changed them
+        void refresh_working_directory();
+        // Like entry_path, but a missing or wrong component is returned as the error
+        expected<std::reference_wrapper<const Folder>, FileSystemError>
+        try_entry_path(const Folder& folder, const std::filesystem::path& path) const;
+        expected<std::reference_wrapper<Folder>, FileSystemError>
+        try_entry_path(Folder& folder, const std::filesystem::path& path);
+        expected<std::reference_wrapper<Folder>, FileSystemError>
+        try_entry_absolute_path(std::string_view path);
+        // Like try_entry_path for the components of a StaticPath, unrolled into one step each
+        template <const auto& Components, typename FolderType>
+        static expected<std::reference_wrapper<FolderType>, FileSystemError>
+        try_entry_static_path(FolderType& folder, FolderType& root);
+        // Throws the exception the get members report error with
+        [[noreturn]] static void throw_error(FileSystemError error);
+        void replay(WriteAheadLog::RecordReader& record);
+        // Writes a snapshot for everything before the end of log in the background
+        static void checkpoint(WriteAheadLog& log);
+        // Lexically resolves path against the working directory without touching the tree
+        std::filesystem::path normal_absolute_path(const std::filesystem::path& path) const;
+        // Locks folder, or nothing for a folder outside of a synchronized file system
+        template <typename Lock>
+        static Lock lock_of(const Folder& folder);
+        // Locks the folders on an absolute normal path one after another, keeps only the last
+        template <typename Lock, typename FolderType>
+        static FolderType&
+        lock_folder(FolderType& root, const std::filesystem::path& path, Lock& lock);
+        // Returns once no reader is inside folder, the caller keeps its parent locked
+        static void wait_for_readers(const Folder& folder);
+        // Interns the content of file or of every file below it, see set_deduplication
+        static void intern_contents(FileBase& file);
+        // Follows the published child tables, the caller keeps the epoch domain pinned
+        const Folder& lock_free_entry_path(const std::filesystem::path& path) const;
     public:
+        // Whether the concurrent members may be called from several threads at once
+        enum class Synchronization
+        {
+            none,
+            per_folder_locks,
+            // Also serves the lock_free members, writes copy the child table of their folder
+            lock_free_reads
+        };
+
+        // Operations for apply, kept in order within every folder
+        class Batch
+        {
+            friend class FileSystem;
+        public:
+            // Creates file in the folder at path
+            template <typename FileType>
+            Batch& create(
+                FileType&& file,
+                const std::filesystem::path& path = ".",
+                Folder::HowToHandleFilesWithTheSameName how_to_handle_files_with_the_same_name =
+                    Folder::HowToHandleFilesWithTheSameName::throw_exception
+            )
+            requires std::is_base_of_v<FileBase, std::decay_t<FileType>>;
+            // Removing a file which does not exist does nothing
+            Batch& remove(const std::filesystem::path& path);
+            inline std::size_t size() const noexcept;
+            inline bool empty() const noexcept;
+            inline void clear() noexcept;
+        private:
+            struct Operation
+            {
+                std::filesystem::path folder;
+                // The name to remove or the file to create
+                std::variant<std::string, File, Folder> target;
+                Folder::HowToHandleFilesWithTheSameName how_to_handle_files_with_the_same_name;
+            };
+
+            std::vector<Operation> m_operations;
+        };
+
         FileSystem();
-        FileSystem(const FileSystem&) = default;
+        explicit FileSystem(Synchronization synchronization);
+        explicit FileSystem(std::pmr::memory_resource* resource);
+        FileSystem(const FileSystem& right);
 
         const File& get_file(const std::filesystem::path& path) const;
         File& get_file(const std::filesystem::path& path);
         const Folder& get_folder(const std::filesystem::path& path) const;
         Folder& get_folder(const std::filesystem::path& path);
+        // Probes without exceptions, so a miss costs one lookup and no unwinding. The error tells
+        // whether a component of path is missing or of the wrong kind.
+        expected<std::reference_wrapper<const File>, FileSystemError>
+        try_get_file(const std::filesystem::path& path) const;
+        expected<std::reference_wrapper<File>, FileSystemError>
+        try_get_file(const std::filesystem::path& path);
+        expected<std::reference_wrapper<const Folder>, FileSystemError>
+        try_get_folder(const std::filesystem::path& path) const;
+        expected<std::reference_wrapper<Folder>, FileSystemError>
+        try_get_folder(const std::filesystem::path& path);
         template <typename FileType>
         decltype(auto) create(FileType&& file, const std::filesystem::path& path = ".")
         requires std::is_base_of_v<FileBase, std::decay_t<FileType>>;
+        // The lookups for paths split at compile time, which skip the path cache as resolving
+        // them costs no more than a lookup in it
+        template <PathLiteral Path>
+        const File& get_file(StaticPath<Path> path) const;
+        template <PathLiteral Path>
+        File& get_file(StaticPath<Path> path);
+        template <PathLiteral Path>
+        const Folder& get_folder(StaticPath<Path> path) const;
+        template <PathLiteral Path>
+        Folder& get_folder(StaticPath<Path> path);
+        template <PathLiteral Path>
+        expected<std::reference_wrapper<const File>, FileSystemError>
+        try_get_file(StaticPath<Path> path) const;
+        template <PathLiteral Path>
+        expected<std::reference_wrapper<File>, FileSystemError> try_get_file(StaticPath<Path> path);
+        template <PathLiteral Path>
+        expected<std::reference_wrapper<const Folder>, FileSystemError>
+        try_get_folder(StaticPath<Path> path) const;
+        template <PathLiteral Path>
+        expected<std::reference_wrapper<Folder>, FileSystemError>
+        try_get_folder(StaticPath<Path> path);
+        template <typename FileType, PathLiteral Path>
+        decltype(auto) create(FileType&& file, StaticPath<Path> path)
+        requires std::is_base_of_v<FileBase, std::decay_t<FileType>>;
         bool remove(const std::filesystem::path& path);
-        inline void change_directory(const std::filesystem::path& path);
-        inline std::filesystem::path get_working_directory() const noexcept;
-        std::vector<std::reference_wrapper<const File>> search_file(const std::string& name) const;
-        std::vector<std::reference_wrapper<File>> search_file(const std::string& name);
+        // Like FileBase::rename, but also logged
+        void rename(const std::filesystem::path& path, std::string_view new_name);
+        // Whether name can name a file: neither empty, . nor .. and without a /
+        static bool is_valid_name(std::string_view name) noexcept;
+        // Moves the file or folder at from to the path to, whose folder must exist and must not
+        // hold its name. Only the moved node is relinked in O(log n), its subtree is neither
+        // copied nor visited and keeps its place in the name index.
+        void move_file(const std::filesystem::path& from, const std::filesystem::path& to);
+        void change_content(const std::filesystem::path& path, std::string new_content);
+        // Resolves every folder once and applies all or, throwing the first error, nothing
+        void apply(Batch batch);
+        // Writes the whole tree as a snapshot image, see Snapshot
+        void save_snapshot(const std::filesystem::path& path) const;
+        // Replaces the whole tree with the image at path and goes back to the root, the contents
+        // are read from the mapping until they are changed
+        void load_snapshot(const std::filesystem::path& path);
+        // Replaces the whole tree with the one recovered from the log in directory and records
+        // every later change of the tree there, whether made through the members of this file
+        // system, the concurrent ones or a Folder and File in it. A copy of the file system
+        // keeps no log, and neither do folders and files copied out of the tree until they are
+        // added back, which records them as a whole.
+        void open_log(
+            const std::filesystem::path& directory,
+            const WriteAheadLog::Options& options = {}
+        );
+        // Writes a snapshot in the background and drops the log before it. The snapshot is
+        // rebuilt from the previous one and the log, so changes the log does not record are
+        // not in it. Throws std::logic_error unless open_log was called.
+        void checkpoint();
+        void change_directory(const std::filesystem::path& path);
+        inline std::filesystem::path get_working_directory() const;
+        inline Synchronization synchronization() const noexcept;
+        // Non-const lookups remember up to capacity resolved folders, 0 turns the cache off
+        inline void set_path_cache_capacity(std::size_t capacity);
+        // Whether create, the concurrent adds, apply and change_content intern the contents they
+        // store, see File::intern_content. Off by default.
+        inline void set_deduplication(bool enabled) noexcept;
+        // Sets the gauges of Metrics to the totals of the root
+        void sample_metrics() const;
+        std::vector<std::reference_wrapper<const File>> search_file(std::string_view name) const;
+        std::vector<std::reference_wrapper<File>> search_file(std::string_view name);
+        std::vector<std::reference_wrapper<const File>>
+        search_file_with_prefix(std::string_view prefix) const;
+        std::vector<std::reference_wrapper<File>> search_file_with_prefix(std::string_view prefix);
+        // Throws std::invalid_argument if pattern is not a valid Glob
+        std::vector<std::reference_wrapper<const File>>
+        search_file_matching(std::string_view pattern) const;
+        std::vector<std::reference_wrapper<File>> search_file_matching(std::string_view pattern);
+        std::vector<std::reference_wrapper<const File>>
+        search_file_containing(std::string_view substring) const;
+        std::vector<std::reference_wrapper<File>>
+        search_file_containing(std::string_view substring);
+        // Walks the whole tree in parallel, predicate is called concurrently
+        std::vector<std::reference_wrapper<const File>>
+        search_file_if(const std::function<bool(const File&)>& predicate) const;
+        std::vector<std::reference_wrapper<File>>
+        search_file_if(const std::function<bool(const File&)>& predicate);
+        // Thread-safe with Synchronization::per_folder_locks. Readers of disjoint subtrees never
+        // contend and writers lock only the folder they change, and for a file added, removed
+        // or renamed the shard of the name index holding its name, but the members above must
+        // not run at the same time.
+        void concurrent_visit_file(
+            const std::filesystem::path& path,
+            const std::function<void(const File&)>& visitor
+        ) const;
+        // Only the direct children of the folder are protected while visitor runs
+        void concurrent_visit_folder(
+            const std::filesystem::path& path,
+            const std::function<void(const Folder&)>& visitor
+        ) const;
+        // Calls visitor with Folder::list of the folder while its children are protected
+        void concurrent_list_folder(
+            const std::filesystem::path& path,
+            std::string_view cursor,
+            std::size_t limit,
+            const std::function<void(const Folder::Page&)>& visitor
+        ) const;
+        template <typename FileType>
+        void concurrent_add(
+            FileType&& file,
+            const std::filesystem::path& path,
+            Folder::HowToHandleFilesWithTheSameName how_to_handle_files_with_the_same_name
+        )
+        requires std::is_base_of_v<FileBase, std::decay_t<FileType>>;
+        bool concurrent_remove(const std::filesystem::path& path);
+        // The absolute paths of the files named name, taken while the index keeps removed
+        // files from being destroyed
+        std::vector<std::string> concurrent_search_file(std::string_view name) const;
+        // Thread-safe with Synchronization::lock_free_reads without taking any lock, they may
+        // overlap with the concurrent members
+        void lock_free_visit_file(
+            const std::filesystem::path& path,
+            const std::function<void(const File&)>& visitor
+        ) const;
+        // Calls visitor for every child of the folder
+        void lock_free_visit_folder(
+            const std::filesystem::path& path,
+            const std::function<void(const FileBase&)>& visitor
+        ) const;
+        // Like concurrent_list_folder, the page is read from the published children
+        void lock_free_list_folder(
+            const std::filesystem::path& path,
+            std::string_view cursor,
+            std::size_t limit,
+            const std::function<void(const Folder::Page&)>& visitor
+        ) const;
     private:
+        static std::unique_ptr<std::pmr::memory_resource>
+        make_pool(Synchronization synchronization);
+        static std::unique_ptr<EpochDomain> make_epoch_domain(Synchronization synchronization);
+
+        Synchronization m_synchronization = Synchronization::none;
+        std::unique_ptr<std::pmr::memory_resource> m_pool;
+        std::unique_ptr<EpochDomain> m_epoch_domain;
+        NameIndex m_name_index;
+        Folder::Tree m_tree{
+            .name_index = m_name_index,
+            .epoch_domain = m_epoch_domain.get(),
+            .synchronized = m_synchronization != Synchronization::none,
+        };
         Folder m_root;
         std::filesystem::path m_active_path;
         Folder* m_active_folder;
+        // m_active_path in the form used as key of m_path_cache, empty for the root
+        std::string m_active_key;
+        // Structure generation m_active_path and m_active_key were derived at
+        std::uint64_t m_active_generation = 0;
+        std::string m_path_buffer;
+        PathCache m_path_cache;
+        bool m_deduplication = false;
+        std::unique_ptr<WriteAheadLog> m_log;
     };
 
-    constexpr FileBase::FileBase(const std::string& name) : m_name(name) {}
+    inline FileBase::Kind FileBase::kind() const noexcept
+    {
+        return m_kind;
+    }
 
-    constexpr FileBase::FileBase(std::string&& name) noexcept : m_name(move(name)) {}
+    template <typename Function>
+    decltype(auto) FileBase::visit(Function&& function) const
+    {
+        if (m_kind == Kind::file) {
+            return function(static_cast<const File&>(*this));
+        }
 
-    constexpr File::File(const std::string& name, const std::string& content)
-        : FileBase(name)
-        , m_content(content)
-    {}
+        return function(static_cast<const Folder&>(*this));
+    }
 
-    constexpr server::File::File(const std::string& name, std::string&& content)
-        : FileBase(name)
-        , m_content(move(content))
-    {}
+    template <typename Function>
+    decltype(auto) FileBase::visit(Function&& function)
+    {
+        if (m_kind == Kind::file) {
+            return function(static_cast<File&>(*this));
+        }
 
-    constexpr server::File::File(std::string&& name, const std::string& content)
-        : FileBase(move(name))
-        , m_content(content)
-    {}
+        return function(static_cast<Folder&>(*this));
+    }
 
-    constexpr server::File::File(std::string&& name, std::string&& content) noexcept
-        : FileBase(move(name))
-        , m_content(move(content))
-    {}
+    inline FileBase::allocator_type FileBase::get_allocator() const noexcept
+    {
+        return m_allocator;
+    }
 
-    constexpr std::string FileBase::name() const noexcept
+    inline std::string_view FileBase::name() const noexcept
     {
-        return m_name;
+        return m_name.view();
     }
 
-    constexpr void FileBase::rename(const std::string& new_name)
+    inline std::string FileBase::copy_name() const
     {
-        m_name = new_name;
+        return std::string{ name() };
     }
 
-    constexpr void FileBase::rename(std::string&& new_name) noexcept
+    inline bool FileBase::has_parent() const noexcept
     {
-        using std::move;
-        m_name = new_name;
+        return m_parent != nullptr;
+    }
+
+    inline const Folder& FileBase::get_parent() const noexcept
+    {
+        return *m_parent;
+    }
+
+    inline Folder& FileBase::get_parent() noexcept
+    {
+        return *m_parent;
+    }
+
+    inline void FileBase::set_parent(Folder& folder) noexcept
+    {
+        m_parent = &folder;
     }
 
     template <typename T>
@@ -220,20 +773,140 @@ namespace server
         return static_cast<T&>(*this);
     }
 
-    constexpr std::string File::content() const noexcept
+    inline File::content_type File::make_content(std::string&& content)
+    {
+        using std::make_shared;
+        using std::move;
+        if (content.size() <= inline_content_size) {
+            InlineContent inline_content{};
+            content.copy(inline_content.chars.data(), content.size());
+            inline_content.size = static_cast<std::uint8_t>(content.size());
+            return inline_content;
+        }
+
+        return make_shared<const std::string>(move(content));
+    }
+
+    inline std::string_view File::content() const
     {
-        return m_content;
+        using std::get_if;
+        using std::shared_ptr;
+        if (const auto* shared_content = get_if<shared_ptr<const std::string>>(&m_content)) {
+            return **shared_content;
+        }
+        if (const auto* external_content = get_if<ExternalContent>(&m_content)) {
+            return external_content->content;
+        }
+        if (const auto* chunked_content = get_if<shared_ptr<ChunkedContent>>(&m_content)) {
+            return (*chunked_content)->view();
+        }
+
+        const auto* inline_content = get_if<InlineContent>(&m_content);
+        return { inline_content->chars.data(), inline_content->size };
     }
 
-    constexpr void File::change_content(const std::string& new_content)
+    inline std::string File::copy_content() const
     {
-        m_content = new_content;
+        using std::get_if;
+        using std::shared_ptr;
+        if (const auto* chunked_content = get_if<shared_ptr<ChunkedContent>>(&m_content)) {
+            return (*chunked_content)->flatten();
+        }
+
+        return std::string{ content() };
     }
 
-    constexpr void File::change_content(std::string&& new_content) noexcept
+    inline std::size_t File::size() const noexcept
+    {
+        using std::get_if;
+        using std::shared_ptr;
+        if (const auto* chunked_content = get_if<shared_ptr<ChunkedContent>>(&m_content)) {
+            return (*chunked_content)->size();
+        }
+
+        return content().size();
+    }
+
+    inline std::size_t File::read(std::span<char> buffer, std::size_t offset) const noexcept
+    {
+        using std::get_if;
+        using std::min;
+        using std::shared_ptr;
+        if (const auto* chunked_content = get_if<shared_ptr<ChunkedContent>>(&m_content)) {
+            return (*chunked_content)->read(buffer, offset);
+        }
+
+        const auto file_content = content();
+        if (offset >= file_content.size()) {
+            return 0;
+        }
+
+        return file_content.copy(
+            buffer.data(),
+            min(buffer.size(), file_content.size() - offset),
+            offset
+        );
+    }
+
+    template <typename Function>
+    void File::for_each_chunk(Function&& function) const
+    {
+        using std::get_if;
+        using std::shared_ptr;
+        if (const auto* chunked_content = get_if<shared_ptr<ChunkedContent>>(&m_content)) {
+            (*chunked_content)->for_each_chunk(function);
+        } else {
+            function(content());
+        }
+    }
+
+    template <typename Function>
+    void File::for_each_shared_chunk(
+        std::size_t offset,
+        std::size_t size,
+        Function&& function
+    ) const
+    {
+        using std::get_if;
+        using std::shared_ptr;
+        if (const auto* chunked_content = get_if<shared_ptr<ChunkedContent>>(&m_content)) {
+            (*chunked_content)->for_each_shared_chunk(offset, size, function);
+            return;
+        }
+
+        const auto file_content = content();
+        if (offset >= file_content.size()) {
+            return;
+        }
+
+        shared_ptr<const void> owner;
+        if (const auto* shared_content = get_if<shared_ptr<const std::string>>(&m_content)) {
+            owner = *shared_content;
+        } else if (const auto* external_content = get_if<ExternalContent>(&m_content)) {
+            owner = external_content->owner;
+        }
+        function(owner, file_content.substr(offset, size));
+    }
+
+    inline void File::change_content(const std::string& new_content)
+    {
+        const auto old_size = size();
+        m_content = make_content(std::string{ new_content });
+        resize_in_totals(old_size);
+        if (Folder::logged_tree(*this) != nullptr) {
+            log_content();
+        }
+    }
+
+    inline void File::change_content(std::string&& new_content)
     {
         using std::move;
-        m_content = move(new_content);
+        const auto old_size = size();
+        m_content = make_content(move(new_content));
+        resize_in_totals(old_size);
+        if (Folder::logged_tree(*this) != nullptr) {
+            log_content();
+        }
     }
 
     template <folder_files_iterator Iter>
@@ -260,6 +933,30 @@ namespace server
         return &(*(*this));
     }
 
+    inline bool Folder::file_name_less::operator()(
+        const file_pointer& left,
+        const file_pointer& right
+    ) const noexcept
+    {
+        return left->name() < right->name();
+    }
+
+    inline bool Folder::file_name_less::operator()(
+        const file_pointer& left,
+        std::string_view right
+    ) const noexcept
+    {
+        return left->name() < right;
+    }
+
+    inline bool Folder::file_name_less::operator()(
+        std::string_view left,
+        const file_pointer& right
+    ) const noexcept
+    {
+        return left < right->name();
+    }
+
     inline Folder::const_iterator Folder::cbegin() const noexcept
     {
         return static_cast<const_iterator&&>(m_files.cbegin());
@@ -290,24 +987,99 @@ namespace server
         return static_cast<iterator&&>(m_files.end());
     }
 
-    inline bool Folder::has_parent() const noexcept
+    inline const Folder::ChildTable* Folder::published_children() const noexcept
     {
-        return m_parent != nullptr;
+        return m_lock_state != nullptr ? m_lock_state->child_table.load(std::memory_order_acquire)
+                                       : nullptr;
     }
 
-    inline const Folder& Folder::get_parent() const noexcept
+    inline EpochDomain* Folder::epoch_domain() const noexcept
     {
-        return *m_parent;
+        return m_tree != nullptr ? m_tree->epoch_domain : nullptr;
     }
 
-    inline Folder& Folder::get_parent() noexcept
+    inline std::shared_mutex* Folder::mutex() const noexcept
     {
-        return *m_parent;
+        return m_lock_state != nullptr ? &m_lock_state->mutex : nullptr;
     }
 
-    inline void Folder::set_parent(Folder& folder) noexcept
+    inline void Folder::bump_structure_generation() noexcept
     {
-        m_parent = &folder;
+        if (m_tree != nullptr) {
+            m_tree->structure_generation.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    inline Folder::Tree* Folder::logged_tree(const FileBase& file) noexcept
+    {
+        const Folder* folder = nullptr;
+        if (file.kind() == Kind::folder) {
+            folder = &file.to_actually_type<Folder>();
+        } else if (file.has_parent()) {
+            folder = &file.get_parent();
+        }
+
+        if (folder == nullptr || folder->m_tree == nullptr || folder->m_tree->log == nullptr) {
+            return nullptr;
+        }
+        return folder->m_tree;
+    }
+
+    inline std::uint64_t Folder::structure_generation() const noexcept
+    {
+        return m_tree != nullptr ? m_tree->structure_generation.load(std::memory_order_relaxed)
+                                 : 0;
+    }
+
+    template <typename FileType, typename... Args>
+    file_pointer Folder::allocate_file(Args&&... args)
+    {
+        using std::forward;
+
+        allocator_type allocator = get_allocator();
+        FileType* file;
+        {
+            // Only the allocation, constructing a Folder copies its subtree
+            Measurement measurement{ Operation::allocation };
+            file = allocator.allocate_object<FileType>();
+        }
+        try {
+            allocator.construct(file, forward<Args>(args)...);
+        } catch (...) {
+            allocator.deallocate_object(file);
+            throw;
+        }
+        return file_pointer{ file };
+    }
+
+    // Visits every file below this folder, each folder before its contents, without recursion.
+    // Relies on the parent links of the subtree to climb back up.
+    template <typename Function>
+    void Folder::for_each_descendant(Function&& function)
+    {
+        Folder* folder = this;
+        auto iter = m_files.begin();
+        while (true) {
+            if (iter == folder->m_files.end()) {
+                if (folder == this) {
+                    return;
+                }
+
+                Folder& parent = folder->get_parent();
+                iter = parent.m_files.upper_bound(folder->name());
+                folder = &parent;
+                continue;
+            }
+
+            FileBase& file = **iter;
+            function(file);
+            if (file.kind() == Kind::folder) {
+                folder = &file.to_actually_type<Folder>();
+                iter = folder->m_files.begin();
+            } else {
+                ++iter;
+            }
+        }
     }
 
     template <typename FileType>
@@ -320,29 +1092,47 @@ namespace server
         using std::abort;
         using std::decay_t;
         using std::forward;
-        using std::make_unique;
         using std::runtime_error;
+        using std::string_view;
         using real_type = decay_t<FileType>;
 
-        [[likely]] if (!has_file(file.name())) {
+        Measurement measurement{ Operation::add };
+        LOCAL_HELPER_TRACE("Folder::add");
+        const string_view name = file.name();
+        auto iter = m_files.lower_bound(name);
+        [[likely]] if (iter == m_files.end() || (*iter)->name() != name) {
             auto& added_file =
-                *(*(m_files.insert(make_unique<real_type>(forward<FileType>(file))).first));
+                *(*(m_files.emplace_hint(iter, allocate_file<real_type>(forward<FileType>(file)))));
+            attach(added_file);
+            publish_children();
+            if (logged_tree(*this) != nullptr) {
+                log_add(added_file, how_to_handle_files_with_the_same_name);
+            }
             return static_cast<real_type&>(added_file);
         } else {
             switch (how_to_handle_files_with_the_same_name) {
             case server::Folder::HowToHandleFilesWithTheSameName::overwrite:
                 {
-                    const auto& type = typeid(real_type);
-                    assert(type == typeid(File) || type == typeid(Folder));
-                    FileBase* found_file;
-                    if (type == typeid(File)) {
-                        found_file = &get_file(file.name());
-                    } else {
-                        found_file = &get_folder(file.name());
+                    if ((*iter)->kind() != kind_of<real_type>) {
+                        throw runtime_error{ kind_of<real_type> == Kind::file
+                                                 ? "The name does not refer to a file."
+                                                 : "The name does not refer to a folder." };
                     }
 
-                    static_cast<real_type&>(*found_file) = forward<FileType>(file);
-                    return static_cast<real_type&>(*found_file);
+                    // Readers without locks may still be inside the old one
+                    real_type* added_file = nullptr;
+                    if (epoch_domain() != nullptr) {
+                        added_file = &static_cast<real_type&>(
+                            replace(iter, allocate_file<real_type>(forward<FileType>(file)))
+                        );
+                    } else {
+                        added_file = &static_cast<real_type&>(**iter);
+                        added_file->assign(forward<FileType>(file));
+                    }
+                    if (logged_tree(*this) != nullptr) {
+                        log_add(*added_file, how_to_handle_files_with_the_same_name);
+                    }
+                    return *added_file;
                 }
             case server::Folder::HowToHandleFilesWithTheSameName::throw_exception:
                 throw runtime_error{ "A file with the same name exists" };
@@ -353,23 +1143,302 @@ namespace server
         }
     }
 
+    template <typename FileType>
+    FileSystem::Batch& FileSystem::Batch::create(
+        FileType&& file,
+        const std::filesystem::path& path,
+        Folder::HowToHandleFilesWithTheSameName how_to_handle_files_with_the_same_name
+    )
+    requires std::is_base_of_v<FileBase, std::decay_t<FileType>>
+    {
+        using std::decay_t;
+        using std::forward;
+        using std::in_place_type;
+        using real_type = decay_t<FileType>;
+
+        m_operations.push_back({
+            path,
+            decltype(Operation::target){
+                in_place_type<real_type>,
+                forward<FileType>(file),
+                FileBase::allocator_type{},
+            },
+            how_to_handle_files_with_the_same_name,
+        });
+        return *this;
+    }
+
+    inline std::size_t FileSystem::Batch::size() const noexcept
+    {
+        return m_operations.size();
+    }
+
+    inline bool FileSystem::Batch::empty() const noexcept
+    {
+        return m_operations.empty();
+    }
+
+    inline void FileSystem::Batch::clear() noexcept
+    {
+        m_operations.clear();
+    }
+
     template <typename FileType>
     decltype(auto) FileSystem::create(FileType&& file, const std::filesystem::path& path)
     requires std::is_base_of_v<FileBase, std::decay_t<FileType>>
     {
         using std::forward;
-        return get_folder(path.parent_path()).add(forward<FileType>(file));
+        auto& added_file = get_folder(path).add(
+            forward<FileType>(file),
+            Folder::HowToHandleFilesWithTheSameName::throw_exception
+        );
+        if (m_deduplication) {
+            intern_contents(added_file);
+        }
+
+        return added_file;
+    }
+
+    template <typename FileType, PathLiteral Path>
+    decltype(auto) FileSystem::create(FileType&& file, StaticPath<Path> path)
+    requires std::is_base_of_v<FileBase, std::decay_t<FileType>>
+    {
+        using std::forward;
+        auto& added_file = get_folder(path).add(
+            forward<FileType>(file),
+            Folder::HowToHandleFilesWithTheSameName::throw_exception
+        );
+        if (m_deduplication) {
+            intern_contents(added_file);
+        }
+
+        return added_file;
     }
 
-    inline void FileSystem::change_directory(const std::filesystem::path& path)
+    template <PathLiteral Path>
+    const File& FileSystem::get_file(StaticPath<Path> path) const
     {
-        m_active_folder = &get_folder(path);
-        m_active_path = path;
+        const auto file = try_get_file(path);
+        if (!file) {
+            throw_error(file.error());
+        }
+
+        return *file;
+    }
+
+    template <PathLiteral Path>
+    File& FileSystem::get_file(StaticPath<Path> path)
+    {
+        const auto file = try_get_file(path);
+        if (!file) {
+            throw_error(file.error());
+        }
+
+        return *file;
     }
 
-    inline std::filesystem::path FileSystem::get_working_directory() const noexcept
+    template <PathLiteral Path>
+    const Folder& FileSystem::get_folder(StaticPath<Path> path) const
     {
-        return m_active_path;
+        const auto folder = try_get_folder(path);
+        if (!folder) {
+            throw_error(folder.error());
+        }
+
+        return *folder;
+    }
+
+    template <PathLiteral Path>
+    Folder& FileSystem::get_folder(StaticPath<Path> path)
+    {
+        const auto folder = try_get_folder(path);
+        if (!folder) {
+            throw_error(folder.error());
+        }
+
+        return *folder;
+    }
+
+    template <PathLiteral Path>
+    expected<std::reference_wrapper<const File>, FileSystemError>
+    FileSystem::try_get_file(StaticPath<Path> path) const
+    {
+        const auto folder = try_entry_static_path<StaticPath<Path>::parent_components>(
+            std::as_const(*m_active_folder), m_root
+        );
+        if (!folder) {
+            return unexpected{ folder.error() };
+        }
+
+        return folder->get().try_get_file(path.filename);
+    }
+
+    template <PathLiteral Path>
+    expected<std::reference_wrapper<File>, FileSystemError>
+    FileSystem::try_get_file(StaticPath<Path> path)
+    {
+        const auto folder = try_entry_static_path<StaticPath<Path>::parent_components>(
+            *m_active_folder, m_root
+        );
+        if (!folder) {
+            return unexpected{ folder.error() };
+        }
+
+        return folder->get().try_get_file(path.filename);
+    }
+
+    template <PathLiteral Path>
+    expected<std::reference_wrapper<const Folder>, FileSystemError>
+    FileSystem::try_get_folder(StaticPath<Path>) const
+    {
+        return try_entry_static_path<StaticPath<Path>::components>(
+            std::as_const(*m_active_folder), m_root
+        );
+    }
+
+    template <PathLiteral Path>
+    expected<std::reference_wrapper<Folder>, FileSystemError>
+    FileSystem::try_get_folder(StaticPath<Path>)
+    {
+        return try_entry_static_path<StaticPath<Path>::components>(*m_active_folder, m_root);
+    }
+
+    template <const auto& Components, typename FolderType>
+    expected<std::reference_wrapper<FolderType>, FileSystemError>
+    FileSystem::try_entry_static_path(FolderType& folder, FolderType& root)
+    {
+        using Kind = PathComponent::Kind;
+
+        Measurement measurement{ Operation::path_walk };
+        LOCAL_HELPER_TRACE("FileSystem::entry_path");
+        FolderType* now = &folder;
+        FileSystemError error{};
+        const auto enter = [&]<std::size_t I>() {
+            constexpr auto component = Components[I];
+            if constexpr (component.kind == Kind::root) {
+                now = &root;
+            } else if constexpr (component.kind == Kind::parent) {
+                if (now->has_parent()) {
+                    now = &(now->get_parent());
+                }
+            } else {
+                const auto child = now->try_get_folder(component.name);
+                if (!child) {
+                    error = child.error();
+                    return false;
+                }
+                now = &(child->get());
+            }
+            return true;
+        };
+        const bool found = [&]<std::size_t... I>(std::index_sequence<I...>) {
+            return (enter.template operator()<I>() && ...);
+        }(std::make_index_sequence<Components.size()>{});
+        if (!found) {
+            return unexpected{ error };
+        }
+
+        if constexpr (metrics_enabled) {
+            constexpr auto depth = std::ranges::count_if(
+                Components,
+                [](const PathComponent& component) { return component.kind == Kind::child; }
+            );
+            Metrics::record_path_depth(depth);
+        }
+        return *now;
+    }
+
+    inline std::filesystem::path FileSystem::get_working_directory() const
+    {
+        return m_active_folder->absolute_path();
+    }
+
+    inline FileSystem::Synchronization FileSystem::synchronization() const noexcept
+    {
+        return m_synchronization;
+    }
+
+    inline void FileSystem::set_path_cache_capacity(std::size_t capacity)
+    {
+        m_path_cache.set_capacity(capacity);
+    }
+
+    inline void FileSystem::set_deduplication(bool enabled) noexcept
+    {
+        m_deduplication = enabled;
+    }
+
+    template <typename Lock>
+    Lock FileSystem::lock_of(const Folder& folder)
+    {
+        std::shared_mutex* mutex = folder.mutex();
+        return mutex != nullptr ? Lock{ *mutex } : Lock{};
+    }
+
+    template <typename Lock, typename FolderType>
+    FolderType&
+    FileSystem::lock_folder(FolderType& root, const std::filesystem::path& path, Lock& lock)
+    {
+        using std::next;
+        using std::shared_lock;
+        using std::shared_mutex;
+
+        auto relative_path = path.relative_path();
+        if (!relative_path.empty() && !relative_path.has_filename()) {
+            relative_path = relative_path.parent_path();
+        }
+        if (relative_path.empty()) {
+            lock = lock_of<Lock>(root);
+            return root;
+        }
+
+        // The path is normal, so the walk only goes downwards and never locks against the order
+        FolderType* now = &root;
+        auto parent_lock = lock_of<shared_lock<shared_mutex>>(*now);
+        for (auto iter = relative_path.begin();; ++iter) {
+            FolderType& child = now->get_folder(iter->generic_string());
+            if (next(iter) == relative_path.end()) {
+                lock = lock_of<Lock>(child);
+                return child;
+            }
+
+            auto child_lock = lock_of<shared_lock<shared_mutex>>(child);
+            parent_lock.swap(child_lock);
+            now = &child;
+        }
+    }
+
+    template <typename FileType>
+    void FileSystem::concurrent_add(
+        FileType&& file,
+        const std::filesystem::path& path,
+        Folder::HowToHandleFilesWithTheSameName how_to_handle_files_with_the_same_name
+    )
+    requires std::is_base_of_v<FileBase, std::decay_t<FileType>>
+    {
+        using std::forward;
+        using std::shared_mutex;
+        using std::unique_lock;
+
+        unique_lock<shared_mutex> lock;
+        Folder& folder = lock_folder(m_root, normal_absolute_path(path), lock);
+        if (how_to_handle_files_with_the_same_name
+            == Folder::HowToHandleFilesWithTheSameName::overwrite) {
+            auto iter = folder.m_files.find(file.name());
+            if (iter != folder.m_files.end() && (*iter)->kind() == FileBase::Kind::folder) {
+                wait_for_readers((*iter)->template to_actually_type<Folder>());
+            }
+        }
+
+        if (!m_deduplication) {
+            folder.add(forward<FileType>(file), how_to_handle_files_with_the_same_name);
+            return;
+        }
+
+        // Interned before readers can see the files, copies share the contents anyway
+        std::decay_t<FileType> interned_file{ forward<FileType>(file), file.get_allocator() };
+        intern_contents(interned_file);
+        folder.add(std::move(interned_file), how_to_handle_files_with_the_same_name);
     }
 }  // namespace server
 #endif  // !FILE_SYSTEM_H_
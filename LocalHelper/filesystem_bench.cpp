@@ -0,0 +1,273 @@
+#include <cstddef>
+#include <cstdint>
+
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "filesystem.h"
+using namespace std;
+using namespace server;
+
+// Microbenchmarks of the hot paths of FileSystem. Run with --benchmark_out=<file>
+// --benchmark_out_format=json to keep the results for comparing later runs.
+namespace
+{
+    constexpr auto throw_exception = Folder::HowToHandleFilesWithTheSameName::throw_exception;
+
+    vector<string> make_names(size_t count)
+    {
+        vector<string> names;
+        names.reserve(count);
+        for (size_t index = 0; index < count; ++index) {
+            names.push_back("file" + to_string(index));
+        }
+        return names;
+    }
+
+    // Adds node_count nodes below folder breadth first, fan_out in every folder and every eighth
+    // of them a folder. The first file of every folder is called needle.
+    void fill(Folder& folder, size_t& node_count, size_t fan_out)
+    {
+        vector<Folder*> level{ &folder };
+        while (node_count != 0) {
+            vector<Folder*> next;
+            for (Folder* parent : level) {
+                for (size_t index = 0; index < fan_out && node_count != 0; ++index, --node_count) {
+                    if (index % 8 == 0) {
+                        next.push_back(
+                            &parent->add(Folder{ "folder" + to_string(index) }, throw_exception));
+                    } else {
+                        const auto name = index == 1 ? "needle" : "file" + to_string(index);
+                        parent->add(File{ name, "content" }, throw_exception);
+                    }
+                }
+                if (node_count == 0) {
+                    break;
+                }
+            }
+            level = std::move(next);
+        }
+    }
+
+    // Counts the bytes taken from it and hands them out from new and delete
+    class CountingResource : public pmr::memory_resource
+    {
+    public:
+        size_t allocated() const noexcept
+        {
+            return m_allocated;
+        }
+    private:
+        void* do_allocate(size_t bytes, size_t alignment) override
+        {
+            m_allocated += bytes;
+            return pmr::new_delete_resource()->allocate(bytes, alignment);
+        }
+
+        void do_deallocate(void* pointer, size_t bytes, size_t alignment) override
+        {
+            m_allocated -= bytes;
+            pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+        }
+
+        bool do_is_equal(const memory_resource& right) const noexcept override
+        {
+            return this == &right;
+        }
+
+        size_t m_allocated = 0;
+    };
+}  // namespace
+
+static void folder_add(benchmark::State& state)
+{
+    const auto names = make_names(static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        Folder folder{ "folder" };
+        for (const auto& name : names) {
+            folder.add(File{ name, "" }, throw_exception);
+        }
+        benchmark::DoNotOptimize(folder);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(folder_add)->RangeMultiplier(8)->Range(8, 1 << 15);
+
+static void folder_has_file(benchmark::State& state)
+{
+    const auto names = make_names(static_cast<size_t>(state.range(0)));
+    Folder folder{ "folder" };
+    for (const auto& name : names) {
+        folder.add(File{ name, "" }, throw_exception);
+    }
+
+    size_t index = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(folder.has_file(names[index]));
+        index = index + 1 == names.size() ? 0 : index + 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(folder_has_file)->RangeMultiplier(8)->Range(8, 1 << 15);
+
+// The second argument turns the path cache on
+static void entry_path(benchmark::State& state)
+{
+    FileSystem file_system;
+    file_system.set_path_cache_capacity(state.range(1) != 0 ? 1024 : 0);
+    filesystem::path path = "/";
+    for (int64_t level = 0; level < state.range(0); ++level) {
+        file_system.create(Folder{ "folder" }, path);
+        path /= "folder";
+    }
+    file_system.create(File{ "file", "content" }, path);
+    path /= "file";
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(&file_system.get_file(path));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(entry_path)->ArgsProduct({ { 1, 4, 16, 64 }, { 0, 1 } });
+
+// Building the larger trees takes longer than searching them, they are kept for all runs
+static const FileSystem& searched_file_system(int64_t node_count)
+{
+    static map<int64_t, unique_ptr<FileSystem>> file_systems;
+    auto& file_system = file_systems[node_count];
+    if (file_system == nullptr) {
+        file_system = make_unique<FileSystem>();
+        auto remaining = static_cast<size_t>(node_count);
+        fill(file_system->get_folder("/"), remaining, 32);
+    }
+    return *file_system;
+}
+
+static void search_file(benchmark::State& state)
+{
+    const auto& file_system = searched_file_system(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(file_system.search_file("needle"));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(search_file)->RangeMultiplier(10)->Range(1000, 10'000'000)->Unit(benchmark::kMillisecond);
+
+static void search_file_matching(benchmark::State& state)
+{
+    const auto& file_system = searched_file_system(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(file_system.search_file_matching("*needle*"));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(search_file_matching)
+    ->RangeMultiplier(10)
+    ->Range(1000, 10'000'000)
+    ->Unit(benchmark::kMillisecond);
+
+static void folder_copy(benchmark::State& state)
+{
+    Folder source{ "folder" };
+    auto node_count = static_cast<size_t>(state.range(0));
+    fill(source, node_count, 32);
+
+    for (auto _ : state) {
+        Folder copy{ source };
+        benchmark::DoNotOptimize(copy);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(folder_copy)->RangeMultiplier(10)->Range(100, 100'000)->Unit(benchmark::kMicrosecond);
+
+// Measures what a node costs: the bytes the pool of the file system takes from upstream for a
+// tree of the first argument of nodes, divided by them. The second argument is the
+// Synchronization.
+static void node_memory(benchmark::State& state)
+{
+    const auto node_count = static_cast<size_t>(state.range(0));
+    const auto synchronization = static_cast<FileSystem::Synchronization>(state.range(1));
+    size_t allocated = 0;
+    for (auto _ : state) {
+        CountingResource counting_resource;
+        // The pool takes its upstream from the default resource when it is made
+        pmr::memory_resource* default_resource = pmr::set_default_resource(&counting_resource);
+        {
+            FileSystem file_system{ synchronization };
+            pmr::set_default_resource(default_resource);
+            auto remaining = node_count;
+            fill(file_system.get_folder("/"), remaining, 32);
+            allocated = counting_resource.allocated();
+        }
+    }
+    state.counters["bytes_per_node"] = static_cast<double>(allocated) / node_count;
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(node_memory)
+    ->ArgsProduct({ { 1000, 100'000 }, { 0, 1, 2 } })
+    ->Unit(benchmark::kMillisecond);
+
+static void change_content(benchmark::State& state)
+{
+    FileSystem file_system;
+    file_system.create(File{ "file", "" });
+    const string content(static_cast<size_t>(state.range(0)), 'c');
+
+    for (auto _ : state) {
+        file_system.change_content("/file", content);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(change_content)->RangeMultiplier(16)->Range(16, 16 << 20);
+
+// Made by resize_at_depth_setup before the threads of a run start, one file for each of them
+static unique_ptr<FileSystem> resized_file_system;
+static vector<File*> resized_files;
+
+static void resize_at_depth_setup(const benchmark::State& state)
+{
+    resized_file_system = make_unique<FileSystem>();
+    filesystem::path path = "/";
+    for (int64_t level = 0; level < state.range(0); ++level) {
+        resized_file_system->create(Folder{ "folder" }, path);
+        path /= "folder";
+    }
+    resized_files.clear();
+    for (int thread = 0; thread < state.threads(); ++thread) {
+        resized_files.push_back(
+            &resized_file_system->create(File{ "file" + to_string(thread), "content" }, path));
+    }
+}
+
+static void resize_at_depth_teardown(const benchmark::State&)
+{
+    resized_files.clear();
+    resized_file_system.reset();
+}
+
+// Every thread resizes a file of its own as deep as the argument, so all of them change the
+// totals of the same folders above it
+static void resize_at_depth(benchmark::State& state)
+{
+    File& file = *resized_files[static_cast<size_t>(state.thread_index())];
+    for (auto _ : state) {
+        file.append("x");
+        file.truncate(7);
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(resize_at_depth)
+    ->Setup(resize_at_depth_setup)
+    ->Teardown(resize_at_depth_teardown)
+    ->Arg(1)
+    ->Arg(16)
+    ->Arg(256)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
@@ -0,0 +1,120 @@
+#include "glob.h"
+
+#include <stdexcept>
+
+using std::bitset;
+using std::invalid_argument;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::uint32_t;
+
+namespace
+{
+    // Parses the set starting after the [ at pattern[i] and moves i past its ]
+    bitset<256> parse_set(string_view pattern, size_t& i)
+    {
+        bitset<256> set;
+        const bool negated = i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^');
+        if (negated) {
+            ++i;
+        }
+
+        // A ] right after [ or [! is a member, not the end
+        for (bool first = true; i < pattern.size() && (first || pattern[i] != ']'); first = false) {
+            auto low = static_cast<unsigned char>(pattern[i++]);
+            if (low == '\\' && i < pattern.size()) {
+                low = static_cast<unsigned char>(pattern[i++]);
+            }
+
+            auto high = low;
+            if (i + 1 < pattern.size() && pattern[i] == '-' && pattern[i + 1] != ']') {
+                high = static_cast<unsigned char>(pattern[i + 1]);
+                i += 2;
+            }
+            for (unsigned c = low; c <= high; ++c) {
+                set.set(c);
+            }
+        }
+        if (i == pattern.size()) {
+            throw invalid_argument{ "The pattern has an unterminated set." };
+        }
+
+        ++i;
+        return negated ? ~set : set;
+    }
+}  // namespace
+
+server::Glob::Glob(string_view pattern)
+{
+    m_tokens.reserve(pattern.size());
+    string literal;
+    bool in_prefix = true;
+    const auto end_literal = [&] {
+        if (in_prefix) {
+            m_prefix = literal;
+            in_prefix = false;
+        }
+        if (literal.size() > m_longest_literal.size()) {
+            m_longest_literal = literal;
+        }
+        literal.clear();
+    };
+
+    for (size_t i = 0; i < pattern.size();) {
+        const char c = pattern[i++];
+        if (c == '*') {
+            end_literal();
+            // Consecutive stars match the same as one
+            if (m_tokens.empty() || m_tokens.back().type != Token::Type::star) {
+                m_tokens.push_back({ Token::Type::star, 0 });
+            }
+        } else if (c == '?') {
+            end_literal();
+            m_tokens.push_back({ Token::Type::any, 0 });
+        } else if (c == '[') {
+            m_sets.push_back(parse_set(pattern, i));
+            end_literal();
+            m_tokens.push_back({ Token::Type::set, static_cast<uint32_t>(m_sets.size() - 1) });
+        } else {
+            char value = c;
+            if (c == '\\') {
+                if (i == pattern.size()) {
+                    throw invalid_argument{ "The pattern ends with a backslash." };
+                }
+                value = pattern[i++];
+            }
+            literal.push_back(value);
+            m_tokens.push_back({ Token::Type::literal, static_cast<unsigned char>(value) });
+        }
+    }
+    end_literal();
+}
+
+bool server::Glob::matches(string_view name) const noexcept
+{
+    // Backtracks only to the last star, which is enough as a star matching more chars never
+    // makes an earlier one match fewer
+    size_t token = 0;
+    size_t c = 0;
+    size_t star = m_tokens.size();
+    size_t star_c = 0;
+    while (c < name.size()) {
+        if (token < m_tokens.size() && m_tokens[token].type == Token::Type::star) {
+            star = token++;
+            star_c = c;
+        } else if (token < m_tokens.size() && matches(m_tokens[token], name[c])) {
+            ++token;
+            ++c;
+        } else if (star != m_tokens.size()) {
+            token = star + 1;
+            c = ++star_c;
+        } else {
+            return false;
+        }
+    }
+    while (token < m_tokens.size() && m_tokens[token].type == Token::Type::star) {
+        ++token;
+    }
+    return token == m_tokens.size();
+}
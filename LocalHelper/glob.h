@@ -0,0 +1,76 @@
+#pragma once
+#ifndef GLOB_H_
+#  define GLOB_H_
+#  include <cstddef>
+#  include <cstdint>
+
+#  include <bitset>
+#  include <string>
+#  include <string_view>
+#  include <vector>
+
+namespace server
+{
+    // A file name pattern compiled once and matched many times. * matches any run of chars, ?
+    // any single char, [abc] and [a-z] one char of the set, [!abc] one char outside of it and a
+    // backslash takes the next char literally.
+    class Glob
+    {
+    public:
+        // Throws std::invalid_argument for an unterminated set or a trailing backslash
+        explicit Glob(std::string_view pattern);
+
+        bool matches(std::string_view name) const noexcept;
+        // The chars every match starts with
+        inline std::string_view prefix() const noexcept;
+        // The longest run of chars every match contains, filters candidates before matches
+        inline std::string_view longest_literal() const noexcept;
+    private:
+        struct Token
+        {
+            enum class Type : std::uint8_t
+            {
+                literal,
+                any,
+                star,
+                set
+            };
+
+            Type type;
+            // The char of a literal or the index of a set in m_sets
+            std::uint32_t value;
+        };
+
+        inline bool matches(const Token& token, char c) const noexcept;
+
+        std::vector<Token> m_tokens;
+        std::vector<std::bitset<256>> m_sets;
+        std::string m_prefix;
+        std::string m_longest_literal;
+    };
+
+    inline std::string_view Glob::prefix() const noexcept
+    {
+        return m_prefix;
+    }
+
+    inline std::string_view Glob::longest_literal() const noexcept
+    {
+        return m_longest_literal;
+    }
+
+    inline bool Glob::matches(const Token& token, char c) const noexcept
+    {
+        switch (token.type) {
+        case Token::Type::literal:
+            return static_cast<unsigned char>(c) == token.value;
+        case Token::Type::any:
+            return true;
+        case Token::Type::set:
+            return m_sets[token.value].test(static_cast<unsigned char>(c));
+        default:
+            return false;
+        }
+    }
+}  // namespace server
+#endif  // !GLOB_H_
@@ -0,0 +1,196 @@
+#include "interned_name.h"
+
+#include <array>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <unordered_set>
+using std::array;
+using std::hash;
+using std::length_error;
+using std::lock_guard;
+using std::memory_order_acq_rel;
+using std::memory_order_relaxed;
+using std::size_t;
+using std::string_view;
+using std::uint32_t;
+using std::unordered_set;
+
+namespace
+{
+    constexpr size_t shard_count = 64;
+}  // namespace
+
+// Shards keep threads creating files with different names from contending
+struct server::InternedName::Table
+{
+    struct AtomHash
+    {
+        using is_transparent = void;
+
+        size_t operator()(const Atom* atom) const noexcept
+        {
+            return atom->hash;
+        }
+
+        size_t operator()(string_view name) const noexcept
+        {
+            return hash<string_view>{}(name);
+        }
+    };
+
+    struct AtomEqual
+    {
+        using is_transparent = void;
+
+        bool operator()(const Atom* left, const Atom* right) const noexcept
+        {
+            return left == right;
+        }
+
+        bool operator()(const Atom* left, string_view right) const noexcept
+        {
+            return left->view() == right;
+        }
+
+        bool operator()(string_view left, const Atom* right) const noexcept
+        {
+            return left == right->view();
+        }
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        unordered_set<Atom*, AtomHash, AtomEqual> atoms;
+    };
+
+    // Never destroyed, names in static objects may outlive every other static
+    static Table& instance()
+    {
+        static Table* table = new Table;
+        return *table;
+    }
+
+    Shard& shard_of(size_t hash) noexcept
+    {
+        return shards[hash % shard_count];
+    }
+
+    array<Shard, shard_count> shards;
+};
+
+server::InternedName::InternedName() noexcept : m_chars{}, m_size(0) {}
+
+server::InternedName::InternedName(string_view name)
+{
+    if (name.size() <= inline_size) {
+        std::memcpy(m_chars, name.data(), name.size());
+        m_size = static_cast<std::uint8_t>(name.size());
+    } else {
+        set_atom(intern(name));
+    }
+}
+
+server::InternedName::InternedName(const InternedName& right) noexcept : m_size(right.m_size)
+{
+    std::memcpy(m_chars, right.m_chars, inline_size);
+    if (m_size == interned) {
+        atom()->references.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+server::InternedName::InternedName(InternedName&& right) noexcept : m_size(right.m_size)
+{
+    std::memcpy(m_chars, right.m_chars, inline_size);
+    right.m_size = 0;
+}
+
+server::InternedName& server::InternedName::operator=(const InternedName& right) noexcept
+{
+    if (this != &right) {
+        InternedName copy{ right };
+        *this = static_cast<InternedName&&>(copy);
+    }
+    return *this;
+}
+
+server::InternedName& server::InternedName::operator=(InternedName&& right) noexcept
+{
+    if (this == &right) {
+        return *this;
+    }
+
+    if (m_size == interned) {
+        release(atom());
+    }
+    std::memcpy(m_chars, right.m_chars, inline_size);
+    m_size = right.m_size;
+    right.m_size = 0;
+    return *this;
+}
+
+size_t server::InternedName::interned_count()
+{
+    size_t count = 0;
+    for (auto& shard : Table::instance().shards) {
+        lock_guard lock(shard.mutex);
+        count += shard.atoms.size();
+    }
+
+    return count;
+}
+
+server::InternedName::Atom* server::InternedName::intern(string_view name)
+{
+    if (name.size() > std::numeric_limits<uint32_t>::max()) {
+        throw length_error{ "The name is too long." };
+    }
+
+    const size_t name_hash = hash<string_view>{}(name);
+    auto& shard = Table::instance().shard_of(name_hash);
+    lock_guard lock(shard.mutex);
+    if (auto iter = shard.atoms.find(name); iter != shard.atoms.end()) {
+        // An atom without references is being released and must not come back to life
+        Atom* atom = *iter;
+        uint32_t references = atom->references.load(memory_order_relaxed);
+        while (references != 0) {
+            if (atom->references.compare_exchange_weak(references, references + 1)) {
+                return atom;
+            }
+        }
+        shard.atoms.erase(iter);
+    }
+
+    void* memory = ::operator new(sizeof(Atom) + name.size());
+    Atom* atom = new (memory) Atom{ 1, static_cast<uint32_t>(name.size()), name_hash };
+    std::memcpy(static_cast<char*>(memory) + sizeof(Atom), name.data(), name.size());
+    try {
+        shard.atoms.insert(atom);
+    } catch (...) {
+        ::operator delete(memory);
+        throw;
+    }
+    return atom;
+}
+
+void server::InternedName::release(Atom* atom) noexcept
+{
+    if (atom->references.fetch_sub(1, memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    // Nobody can take a reference any more, but the table may already hold a newer atom
+    auto& shard = Table::instance().shard_of(atom->hash);
+    {
+        lock_guard lock(shard.mutex);
+        if (auto iter = shard.atoms.find(atom); iter != shard.atoms.end()) {
+            shard.atoms.erase(iter);
+        }
+    }
+
+    atom->~Atom();
+    ::operator delete(atom);
+}
@@ -0,0 +1,93 @@
+#pragma once
+#ifndef INTERNED_NAME_H_
+#  define INTERNED_NAME_H_
+#  include <cstddef>
+#  include <cstdint>
+#  include <cstring>
+
+#  include <atomic>
+#  include <string_view>
+
+namespace server
+{
+    // Name of a file in 16 bytes. Names up to inline_size chars are stored in place, longer ones
+    // are interned in a table shared by all threads, so equal names share one refcounted atom.
+    class InternedName
+    {
+    public:
+        static constexpr std::size_t inline_size = 15;
+
+        InternedName() noexcept;
+        explicit InternedName(std::string_view name);
+        InternedName(const InternedName& right) noexcept;
+        InternedName(InternedName&& right) noexcept;
+        inline constexpr ~InternedName();
+
+        InternedName& operator=(const InternedName& right) noexcept;
+        InternedName& operator=(InternedName&& right) noexcept;
+
+        inline std::string_view view() const noexcept;
+        // The number of distinct interned names currently alive
+        static std::size_t interned_count();
+    private:
+        // Followed by the chars of the name
+        struct Atom
+        {
+            std::atomic<std::uint32_t> references;
+            std::uint32_t size;
+            std::size_t hash;
+
+            inline std::string_view view() const noexcept;
+        };
+
+        struct Table;
+
+        static constexpr std::uint8_t interned = 0xFF;
+
+        static Atom* intern(std::string_view name);
+        static void release(Atom* atom) noexcept;
+
+        // The atom of an interned name is kept in the first bytes of m_chars
+        inline Atom* atom() const noexcept;
+        inline void set_atom(Atom* atom) noexcept;
+
+        alignas(Atom*) char m_chars[inline_size];
+        // Size of an inline name or interned
+        std::uint8_t m_size;
+    };
+
+    inline constexpr InternedName::~InternedName()
+    {
+        if (m_size == interned) {
+            release(atom());
+        }
+    }
+
+    inline std::string_view InternedName::view() const noexcept
+    {
+        if (m_size == interned) {
+            return atom()->view();
+        }
+
+        return { m_chars, m_size };
+    }
+
+    inline InternedName::Atom* InternedName::atom() const noexcept
+    {
+        Atom* atom;
+        std::memcpy(&atom, m_chars, sizeof(atom));
+        return atom;
+    }
+
+    inline void InternedName::set_atom(Atom* atom) noexcept
+    {
+        std::memcpy(m_chars, &atom, sizeof(atom));
+        m_size = interned;
+    }
+
+    inline std::string_view InternedName::Atom::view() const noexcept
+    {
+        return { reinterpret_cast<const char*>(this + 1), size };
+    }
+}  // namespace server
+#endif  // !INTERNED_NAME_H_
@@ -0,0 +1,245 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+using std::array;
+using std::atomic;
+using std::lock_guard;
+using std::make_unique;
+using std::memory_order_relaxed;
+using std::mutex;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::uint64_t;
+using std::unique_ptr;
+using std::vector;
+
+namespace
+{
+    constexpr array<string_view, server::Metrics::operation_count> operation_names{
+        "path_walk", "child_lookup", "allocation", "add", "remove", "copy", "change_content",
+        "search"
+    };
+
+    // Written by the thread owning its slot only, so adding needs no atomic read-modify-write
+    class AtomicHistogram
+    {
+    public:
+        void add(uint64_t value) noexcept
+        {
+            const auto bucket = value <= 1
+                ? 0
+                : std::min<size_t>(std::bit_width(value - 1), server::Metrics::bucket_count - 1);
+            increase(m_count, 1);
+            increase(m_sum, value);
+            increase(m_buckets[bucket], 1);
+        }
+
+        void add_to(server::Metrics::Histogram& histogram) const noexcept
+        {
+            histogram.count += m_count.load(memory_order_relaxed);
+            histogram.sum += m_sum.load(memory_order_relaxed);
+            for (size_t bucket = 0; bucket < m_buckets.size(); ++bucket) {
+                histogram.buckets[bucket] += m_buckets[bucket].load(memory_order_relaxed);
+            }
+        }
+    private:
+        static void increase(atomic<uint64_t>& counter, uint64_t value) noexcept
+        {
+            counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+        }
+
+        atomic<uint64_t> m_count = 0;
+        atomic<uint64_t> m_sum = 0;
+        array<atomic<uint64_t>, server::Metrics::bucket_count> m_buckets{};
+    };
+
+    struct Slot
+    {
+        array<AtomicHistogram, server::Metrics::operation_count> operations;
+        AtomicHistogram path_depths;
+    };
+
+    // The slots outlive their threads, a new thread takes over a released one and adds to it
+    struct Registry
+    {
+        mutex slots_mutex;
+        vector<unique_ptr<Slot>> slots;
+        vector<Slot*> released_slots;
+        atomic<uint64_t> node_count = 0;
+        atomic<uint64_t> content_size = 0;
+    };
+
+    Registry& registry()
+    {
+        // Never destroyed, threads may release their slots after the static destructors ran
+        static auto* const registry = new Registry;
+        return *registry;
+    }
+
+    class SlotLease
+    {
+    public:
+        SlotLease()
+        {
+            Registry& slots = registry();
+            lock_guard<mutex> lock{ slots.slots_mutex };
+            if (!slots.released_slots.empty()) {
+                m_slot = slots.released_slots.back();
+                slots.released_slots.pop_back();
+            } else {
+                m_slot = slots.slots.emplace_back(make_unique<Slot>()).get();
+            }
+        }
+
+        SlotLease(const SlotLease&) = delete;
+
+        ~SlotLease()
+        {
+            Registry& slots = registry();
+            lock_guard<mutex> lock{ slots.slots_mutex };
+            slots.released_slots.push_back(m_slot);
+        }
+
+        SlotLease& operator=(const SlotLease&) = delete;
+
+        Slot& slot() const noexcept
+        {
+            return *m_slot;
+        }
+    private:
+        Slot* m_slot;
+    };
+
+    Slot& own_slot()
+    {
+        thread_local const SlotLease lease;
+        return lease.slot();
+    }
+
+    void append_number(string& output, double value)
+    {
+        char buffer[32];
+        const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        output.append(buffer, result.ptr);
+    }
+
+    void append_number(string& output, uint64_t value)
+    {
+        char buffer[24];
+        const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        output.append(buffer, result.ptr);
+    }
+
+    // One series of a histogram family, labels like operation="add" or empty
+    void append_histogram(
+        string& output,
+        string_view name,
+        string_view labels,
+        const server::Metrics::Histogram& histogram,
+        double scale
+    )
+    {
+        uint64_t count = 0;
+        for (size_t bucket = 0; bucket < histogram.buckets.size(); ++bucket) {
+            count += histogram.buckets[bucket];
+            output.append(name).append("_bucket{").append(labels);
+            output.append(labels.empty() ? "le=\"" : ",le=\"");
+            if (bucket + 1 == histogram.buckets.size()) {
+                output.append("+Inf");
+            } else {
+                append_number(output, static_cast<double>(uint64_t{ 1 } << bucket) * scale);
+            }
+            output.append("\"} ");
+            append_number(output, count);
+            output += '\n';
+        }
+
+        string series;
+        if (!labels.empty()) {
+            series.append("{").append(labels).append("}");
+        }
+        output.append(name).append("_sum").append(series) += ' ';
+        append_number(output, static_cast<double>(histogram.sum) * scale);
+        output.append("\n").append(name).append("_count").append(series) += ' ';
+        append_number(output, histogram.count);
+        output += '\n';
+    }
+}  // namespace
+
+void server::Metrics::record(Operation operation, uint64_t nanoseconds) noexcept
+{
+    own_slot().operations[static_cast<size_t>(operation)].add(nanoseconds);
+}
+
+void server::Metrics::record_path_depth(size_t depth) noexcept
+{
+    own_slot().path_depths.add(depth);
+}
+
+void server::Metrics::set_tree_size(uint64_t node_count, uint64_t content_size) noexcept
+{
+    registry().node_count.store(node_count, memory_order_relaxed);
+    registry().content_size.store(content_size, memory_order_relaxed);
+}
+
+server::Metrics::Totals server::Metrics::totals()
+{
+    Registry& slots = registry();
+    Totals totals;
+    {
+        lock_guard<mutex> lock{ slots.slots_mutex };
+        for (const auto& slot : slots.slots) {
+            for (size_t operation = 0; operation < operation_count; ++operation) {
+                slot->operations[operation].add_to(totals.operations[operation]);
+            }
+            slot->path_depths.add_to(totals.path_depths);
+        }
+    }
+    totals.node_count = slots.node_count.load(memory_order_relaxed);
+    totals.content_size = slots.content_size.load(memory_order_relaxed);
+    return totals;
+}
+
+void server::Metrics::write_prometheus(string& output)
+{
+    const auto values = totals();
+    output.append(
+        "# HELP local_helper_operation_seconds Latency of the file system operations.\n"
+        "# TYPE local_helper_operation_seconds histogram\n"
+    );
+    for (size_t operation = 0; operation < operation_count; ++operation) {
+        const auto labels = "operation=\"" + string{ operation_names[operation] } + '"';
+        append_histogram(
+            output, "local_helper_operation_seconds", labels, values.operations[operation], 1e-9
+        );
+    }
+
+    output.append(
+        "# HELP local_helper_path_depth Components of the paths walked.\n"
+        "# TYPE local_helper_path_depth histogram\n"
+    );
+    append_histogram(output, "local_helper_path_depth", {}, values.path_depths, 1);
+
+    output.append(
+        "# HELP local_helper_nodes Files and folders in the tree when last sampled.\n"
+        "# TYPE local_helper_nodes gauge\n"
+        "local_helper_nodes "
+    );
+    append_number(output, values.node_count);
+    output.append(
+        "\n# HELP local_helper_content_bytes Size of the contents when last sampled.\n"
+        "# TYPE local_helper_content_bytes gauge\n"
+        "local_helper_content_bytes "
+    );
+    append_number(output, values.content_size);
+    output += '\n';
+}
@@ -0,0 +1,120 @@
+#pragma once
+#ifndef METRICS_H_
+#  define METRICS_H_
+#  include <cstddef>
+#  include <cstdint>
+
+#  include <array>
+#  include <chrono>
+#  include <string>
+
+namespace server
+{
+    // Operations are measured in builds with LOCAL_HELPER_METRICS defined, Measurement compiles
+    // to nothing in the others
+#  ifdef LOCAL_HELPER_METRICS
+    inline constexpr bool metrics_enabled = true;
+#  else
+    inline constexpr bool metrics_enabled = false;
+#  endif
+
+    // What Metrics tells apart. An operation includes the others it runs, but not itself nested.
+    enum class Operation : std::uint8_t
+    {
+        path_walk,
+        child_lookup,
+        allocation,
+        add,
+        remove,
+        copy,
+        change_content,
+        search
+    };
+
+    // Process-wide latency histograms of the operations of FileSystem and Folder and gauges of
+    // the tree. Every thread records into a slot of its own, reading sums the slots.
+    class Metrics
+    {
+    public:
+        static constexpr std::size_t operation_count = 8;
+        // Bucket i counts the values up to 2^i, the last one also all larger values
+        static constexpr std::size_t bucket_count = 40;
+
+        struct Histogram
+        {
+            std::uint64_t count = 0;
+            std::uint64_t sum = 0;
+            std::array<std::uint64_t, bucket_count> buckets{};
+        };
+
+        struct Totals
+        {
+            // In nanoseconds
+            std::array<Histogram, operation_count> operations;
+            // The components of the paths walked
+            Histogram path_depths;
+            std::uint64_t node_count = 0;
+            std::uint64_t content_size = 0;
+        };
+
+        static void record(Operation operation, std::uint64_t nanoseconds) noexcept;
+        static void record_path_depth(std::size_t depth) noexcept;
+        // See FileSystem::sample_metrics
+        static void set_tree_size(std::uint64_t node_count, std::uint64_t content_size) noexcept;
+        static Totals totals();
+        // Appends the totals in the Prometheus text format
+        static void write_prometheus(std::string& output);
+    };
+
+    // Records the time until it is destroyed as its operation
+    class Measurement
+    {
+    public:
+        inline explicit Measurement(Operation operation) noexcept;
+        Measurement(const Measurement&) = delete;
+        inline ~Measurement();
+
+        Measurement& operator=(const Measurement&) = delete;
+#  ifdef LOCAL_HELPER_METRICS
+    private:
+        // A bit for every operation running on the thread
+        inline static thread_local std::uint32_t s_running = 0;
+
+        std::chrono::steady_clock::time_point m_start;
+        Operation m_operation;
+        bool m_outermost;
+#  endif
+    };
+
+#  ifdef LOCAL_HELPER_METRICS
+    inline Measurement::Measurement(Operation operation) noexcept
+        : m_operation(operation)
+        , m_outermost((s_running & (1U << static_cast<unsigned>(operation))) == 0)
+    {
+        if (m_outermost) {
+            s_running |= 1U << static_cast<unsigned>(operation);
+            m_start = std::chrono::steady_clock::now();
+        }
+    }
+
+    inline Measurement::~Measurement()
+    {
+        using std::chrono::duration_cast;
+        using std::chrono::nanoseconds;
+        using std::chrono::steady_clock;
+
+        if (m_outermost) {
+            const auto elapsed = duration_cast<nanoseconds>(steady_clock::now() - m_start);
+            Metrics::record(m_operation, static_cast<std::uint64_t>(elapsed.count()));
+            s_running &= ~(1U << static_cast<unsigned>(m_operation));
+        }
+    }
+#  else
+    inline Measurement::Measurement(Operation) noexcept
+    {}
+
+    inline Measurement::~Measurement()
+    {}
+#  endif
+}  // namespace server
+#endif  // !METRICS_H_
@@ -0,0 +1,83 @@
+#include "name_index.h"
+
+#include "filesystem.h"
+using std::hash;
+using std::lock_guard;
+using std::make_unique;
+using std::span;
+using std::string;
+using std::string_view;
+
+server::NameIndex::NameIndex(bool synchronized)
+    : m_synchronized(synchronized)
+    , m_shard_count(synchronized ? shard_count : 1)
+    , m_shards(make_unique<Shard[]>(m_shard_count))
+{}
+
+void server::NameIndex::insert(File& file)
+{
+    Shard& shard = shard_of(file.name());
+    const auto lock = this->lock(shard);
+    auto iter = shard.files.lower_bound(file.name());
+    if (iter == shard.files.end() || iter->first != file.name()) {
+        iter = shard.files.emplace_hint(iter, string{ file.name() }, set_of_file{});
+        shard.table_stale = true;
+    }
+
+    iter->second.insert(&file);
+}
+
+void server::NameIndex::erase(File& file) noexcept
+{
+    Shard& shard = shard_of(file.name());
+    const auto lock = this->lock(shard);
+    auto iter = shard.files.find(file.name());
+    if (iter == shard.files.end()) {
+        return;
+    }
+
+    iter->second.erase(&file);
+    if (iter->second.empty()) {
+        shard.files.erase(iter);
+        shard.table_stale = true;
+    }
+}
+
+void server::NameIndex::clear() noexcept
+{
+    for (Shard& shard : shards()) {
+        const auto lock = this->lock(shard);
+        shard.files.clear();
+        shard.table_stale = true;
+    }
+}
+
+span<server::NameIndex::Shard> server::NameIndex::shards() const noexcept
+{
+    return { m_shards.get(), m_shard_count };
+}
+
+server::NameIndex::Shard& server::NameIndex::shard_of(string_view name) const noexcept
+{
+    if (m_shard_count == 1) {
+        return m_shards[0];
+    }
+
+    return m_shards[hash<string_view>{}(name) % m_shard_count];
+}
+
+const server::NameIndex::NameTable& server::NameIndex::Shard::name_table() const
+{
+    const lock_guard table_lock{ table_mutex };
+    if (table_stale) {
+        table.names.clear();
+        table.entries.clear();
+        table.entries.reserve(files.size());
+        for (const auto& [name, files_of_name] : files) {
+            table.entries.emplace_back(table.names.size(), &files_of_name);
+            table.names.append(name).push_back('/');
+        }
+        table_stale = false;
+    }
+    return table;
+}
@@ -0,0 +1,217 @@
+#pragma once
+#ifndef NAME_INDEX_H_
+#  define NAME_INDEX_H_
+#  include <cstddef>
+
+#  include <algorithm>
+#  include <functional>
+#  include <map>
+#  include <memory>
+#  include <mutex>
+#  include <shared_mutex>
+#  include <span>
+#  include <string>
+#  include <string_view>
+#  include <unordered_set>
+#  include <utility>
+#  include <vector>
+#  include "glob.h"
+
+namespace server
+{
+    class File;
+
+    // Every file of a tree grouped by name, ordered so that prefixes form a contiguous range
+    // within each shard
+    class NameIndex
+    {
+    public:
+        // Shards of a synchronized index, writers of names in different ones do not wait for
+        // each other and a search locks one shard at a time
+        static constexpr std::size_t shard_count = 16;
+
+        // A synchronized index may be used from several threads at once, it is split by the
+        // hash of the names into shard_count shards with a lock each
+        explicit NameIndex(bool synchronized = false);
+        NameIndex(const NameIndex&) = delete;
+
+        NameIndex& operator=(const NameIndex&) = delete;
+
+        void insert(File& file);
+        void erase(File& file) noexcept;
+        void clear() noexcept;
+        template <typename Function>
+        void for_each(std::string_view name, Function&& function) const;
+        template <typename Function>
+        void for_each_with_prefix(std::string_view prefix, Function&& function) const;
+        // Every distinct name is tested once however many files have it
+        template <typename Function>
+        void for_each_matching(const Glob& glob, Function&& function) const;
+        template <typename Function>
+        void for_each_containing(std::string_view substring, Function&& function) const;
+    private:
+        using set_of_file = std::unordered_set<File*>;
+
+        // Every name packed into one buffer, each followed by a / which no name contains, so
+        // that a scan runs over contiguous memory instead of the nodes of m_files
+        struct NameTable
+        {
+            std::string names;
+            // Ordered by the offset of the name in names
+            std::vector<std::pair<std::size_t, const set_of_file*>> entries;
+        };
+
+        // The files of the names with one hash modulo the shard count
+        struct Shard
+        {
+            // Rebuilds the table if names were added or removed, the caller holds lock_shared
+            const NameTable& name_table() const;
+
+            std::map<std::string, set_of_file, std::less<>> files;
+            mutable std::shared_mutex mutex;
+            mutable NameTable table;
+            // Set by writers under lock, so readers holding lock_shared only race each other
+            mutable bool table_stale = false;
+            mutable std::mutex table_mutex;
+        };
+
+        std::span<Shard> shards() const noexcept;
+        Shard& shard_of(std::string_view name) const noexcept;
+        inline std::shared_lock<std::shared_mutex> lock_shared(const Shard& shard) const;
+        inline std::unique_lock<std::shared_mutex> lock(const Shard& shard) const;
+        // Calls function for the files of every name in shard containing literal that also
+        // matches
+        template <typename Predicate, typename Function>
+        static void scan(
+            const Shard& shard,
+            std::string_view literal,
+            Predicate&& matches,
+            Function&& function
+        );
+
+        bool m_synchronized;
+        // One unless the index is synchronized
+        std::size_t m_shard_count;
+        std::unique_ptr<Shard[]> m_shards;
+    };
+
+    inline std::shared_lock<std::shared_mutex> NameIndex::lock_shared(const Shard& shard) const
+    {
+        if (!m_synchronized) {
+            return std::shared_lock{ shard.mutex, std::defer_lock };
+        }
+
+        return std::shared_lock{ shard.mutex };
+    }
+
+    inline std::unique_lock<std::shared_mutex> NameIndex::lock(const Shard& shard) const
+    {
+        if (!m_synchronized) {
+            return std::unique_lock{ shard.mutex, std::defer_lock };
+        }
+
+        return std::unique_lock{ shard.mutex };
+    }
+
+    template <typename Function>
+    void NameIndex::for_each(std::string_view name, Function&& function) const
+    {
+        const Shard& shard = shard_of(name);
+        const auto lock = lock_shared(shard);
+        auto iter = shard.files.find(name);
+        if (iter == shard.files.end()) {
+            return;
+        }
+
+        for (File* file : iter->second) {
+            function(*file);
+        }
+    }
+
+    template <typename Function>
+    void NameIndex::for_each_with_prefix(std::string_view prefix, Function&& function) const
+    {
+        for (const Shard& shard : shards()) {
+            const auto lock = lock_shared(shard);
+            for (auto iter = shard.files.lower_bound(prefix);
+                 iter != shard.files.end() && iter->first.starts_with(prefix);
+                 ++iter) {
+                for (File* file : iter->second) {
+                    function(*file);
+                }
+            }
+        }
+    }
+
+    template <typename Function>
+    void NameIndex::for_each_matching(const Glob& glob, Function&& function) const
+    {
+        const auto matches = [&glob](std::string_view name) { return glob.matches(name); };
+        for (const Shard& shard : shards()) {
+            const auto lock = lock_shared(shard);
+            // The range of the prefix is usually much smaller than the table
+            if (glob.prefix().empty()) {
+                scan(shard, glob.longest_literal(), matches, function);
+                continue;
+            }
+
+            for (auto iter = shard.files.lower_bound(glob.prefix());
+                 iter != shard.files.end() && iter->first.starts_with(glob.prefix());
+                 ++iter) {
+                if (matches(iter->first)) {
+                    for (File* file : iter->second) {
+                        function(*file);
+                    }
+                }
+            }
+        }
+    }
+
+    template <typename Function>
+    void NameIndex::for_each_containing(std::string_view substring, Function&& function) const
+    {
+        if (substring.find('/') != std::string_view::npos) {
+            return;
+        }
+
+        for (const Shard& shard : shards()) {
+            const auto lock = lock_shared(shard);
+            scan(shard, substring, [](std::string_view) { return true; }, function);
+        }
+    }
+
+    template <typename Predicate, typename Function>
+    void NameIndex::scan(
+        const Shard& shard,
+        std::string_view literal,
+        Predicate&& matches,
+        Function&& function
+    )
+    {
+        const auto& table = shard.name_table();
+        const std::string_view names{ table.names };
+        const auto& entries = table.entries;
+        auto next = entries.begin();
+        // find skips to candidates with memchr on the first char of literal, so most names are
+        // never looked at one by one
+        for (std::size_t offset = names.find(literal); offset < names.size();
+             offset = names.find(literal, offset)) {
+            auto entry = std::prev(std::upper_bound(
+                next,
+                entries.end(),
+                offset,
+                [](std::size_t position, const auto& entry) { return position < entry.first; }
+            ));
+            next = std::next(entry);
+            const auto end = next == entries.end() ? names.size() : next->first;
+            if (matches(names.substr(entry->first, end - 1 - entry->first))) {
+                for (File* file : *entry->second) {
+                    function(*file);
+                }
+            }
+            // The other occurrences in this name would find it again
+            offset = end;
+        }
+    }
+}  // namespace server
+#endif  // !NAME_INDEX_H_
@@ -0,0 +1,66 @@
+#include "path_cache.h"
+
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::uint64_t;
+
+server::PathCache::PathCache(size_t capacity) : m_capacity(capacity) {}
+
+// The cached folders belong to another tree, so a copy only keeps the capacity
+server::PathCache::PathCache(const PathCache& right) : PathCache(right.m_capacity) {}
+
+void server::PathCache::set_capacity(size_t capacity)
+{
+    m_capacity = capacity;
+    shrink_to(capacity);
+}
+
+server::Folder* server::PathCache::find(string_view path, uint64_t generation)
+{
+    if (m_generation != generation) {
+        clear();
+        m_generation = generation;
+        return nullptr;
+    }
+
+    auto iter = m_index.find(path);
+    if (iter == m_index.end()) {
+        return nullptr;
+    }
+
+    m_entries.splice(m_entries.begin(), m_entries, iter->second);
+    return iter->second->folder;
+}
+
+void server::PathCache::insert(string_view path, Folder& folder)
+{
+    if (m_capacity == 0) {
+        return;
+    }
+
+    auto iter = m_index.find(path);
+    if (iter != m_index.end()) {
+        iter->second->folder = &folder;
+        m_entries.splice(m_entries.begin(), m_entries, iter->second);
+        return;
+    }
+
+    shrink_to(m_capacity - 1);
+    m_entries.push_front(Entry{ string{ path }, &folder });
+    m_index.emplace(m_entries.front().path, m_entries.begin());
+}
+
+void server::PathCache::clear() noexcept
+{
+    m_index.clear();
+    m_entries.clear();
+}
+
+void server::PathCache::shrink_to(size_t size) noexcept
+{
+    while (m_entries.size() > size) {
+        m_index.erase(m_entries.back().path);
+        m_entries.pop_back();
+    }
+}
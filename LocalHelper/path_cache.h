@@ -0,0 +1,61 @@
+#pragma once
+#ifndef PATH_CACHE_H_
+#  define PATH_CACHE_H_
+#  include <cstddef>
+#  include <cstdint>
+
+#  include <list>
+#  include <string>
+#  include <string_view>
+#  include <unordered_map>
+
+namespace server
+{
+    class Folder;
+
+    // Maps absolute paths to the folders they resolved to, dropping the least recently used
+    // entries above capacity. Every entry is discarded once the structure generation of the
+    // tree changes, i.e. after a folder is removed, renamed, moved or overwritten.
+    class PathCache
+    {
+    public:
+        explicit PathCache(std::size_t capacity = 0);
+        PathCache(const PathCache& right);
+
+        PathCache& operator=(const PathCache&) = delete;
+
+        inline std::size_t capacity() const noexcept;
+        inline std::size_t size() const noexcept;
+        void set_capacity(std::size_t capacity);
+        // generation is Folder::structure_generation() of the tree the folders belong to
+        Folder* find(std::string_view path, std::uint64_t generation);
+        void insert(std::string_view path, Folder& folder);
+        void clear() noexcept;
+    private:
+        struct Entry
+        {
+            std::string path;
+            Folder* folder;
+        };
+
+        using list_of_entry = std::list<Entry>;
+
+        void shrink_to(std::size_t size) noexcept;
+
+        std::size_t m_capacity;
+        std::uint64_t m_generation = 0;
+        list_of_entry m_entries;
+        std::unordered_map<std::string_view, list_of_entry::iterator> m_index;
+    };
+
+    inline std::size_t PathCache::capacity() const noexcept
+    {
+        return m_capacity;
+    }
+
+    inline std::size_t PathCache::size() const noexcept
+    {
+        return m_entries.size();
+    }
+}  // namespace server
+#endif  // !PATH_CACHE_H_
@@ -0,0 +1,197 @@
+#include "protocol.h"
+
+#include <limits>
+#include <utility>
+
+using std::length_error;
+using std::move;
+using std::numeric_limits;
+using std::shared_ptr;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::uint32_t;
+using std::uint64_t;
+using std::uint8_t;
+
+namespace
+{
+    template <typename Integer = uint32_t>
+    Integer parse_integer(string_view data) noexcept
+    {
+        Integer value = 0;
+        for (size_t byte = 0; byte < sizeof(Integer); ++byte) {
+            value |= Integer{ static_cast<unsigned char>(data[byte]) } << (byte * 8);
+        }
+        return value;
+    }
+
+    uint32_t to_string_size(size_t size)
+    {
+        if (size > numeric_limits<uint32_t>::max()) {
+            throw length_error{ "The result is too large." };
+        }
+
+        return static_cast<uint32_t>(size);
+    }
+
+    template <typename Integer>
+    void store_integer(char* data, Integer value) noexcept
+    {
+        for (size_t byte = 0; byte < sizeof(Integer); ++byte) {
+            data[byte] = static_cast<char>((value >> (byte * 8)) & 0xFF);
+        }
+    }
+}  // namespace
+
+server::Protocol::Reader::Reader(string_view body) noexcept : m_data(body)
+{}
+
+uint8_t server::Protocol::Reader::read_byte()
+{
+    return static_cast<uint8_t>(take(1)[0]);
+}
+
+uint32_t server::Protocol::Reader::read_integer()
+{
+    return parse_integer(take(sizeof(uint32_t)));
+}
+
+uint64_t server::Protocol::Reader::read_long()
+{
+    return parse_integer<uint64_t>(take(sizeof(uint64_t)));
+}
+
+string_view server::Protocol::Reader::read_string()
+{
+    const auto size = read_integer();
+    return take(size);
+}
+
+string_view server::Protocol::Reader::take(size_t size)
+{
+    if (m_data.size() < size) {
+        throw ProtocolError{ "The frame ends too early." };
+    }
+
+    const auto data = m_data.substr(0, size);
+    m_data.remove_prefix(size);
+    return data;
+}
+
+void server::Protocol::Output::clear() noexcept
+{
+    m_chars.clear();
+    m_pieces.clear();
+    m_shared_size = 0;
+}
+
+server::Protocol::Writer::Writer(Output& output) noexcept : m_output(output)
+{}
+
+server::Protocol::Writer& server::Protocol::Writer::add_byte(uint8_t value)
+{
+    m_output.m_chars += static_cast<char>(value);
+    return *this;
+}
+
+server::Protocol::Writer& server::Protocol::Writer::add_integer(uint32_t value)
+{
+    store_integer(add_raw(sizeof(value)), value);
+    return *this;
+}
+
+server::Protocol::Writer& server::Protocol::Writer::add_long(uint64_t value)
+{
+    store_integer(add_raw(sizeof(value)), value);
+    return *this;
+}
+
+server::Protocol::Writer& server::Protocol::Writer::add_string(string_view value)
+{
+    add_integer(to_string_size(value.size()));
+    m_output.m_chars += value;
+    return *this;
+}
+
+server::Protocol::Writer& server::Protocol::Writer::add_string(Output&& value)
+{
+    add_integer(to_string_size(value.size()));
+    const auto offset = m_output.m_chars.size();
+    m_output.m_chars += value.m_chars;
+    for (auto& piece : value.m_pieces) {
+        piece.position += offset;
+        m_output.m_pieces.push_back(move(piece));
+    }
+    m_output.m_shared_size += value.m_shared_size;
+    value.clear();
+    return *this;
+}
+
+char* server::Protocol::Writer::add_raw(size_t size)
+{
+    auto& chars = m_output.m_chars;
+    chars.resize(chars.size() + size);
+    return chars.data() + chars.size() - size;
+}
+
+server::Protocol::Writer&
+server::Protocol::Writer::add_shared(shared_ptr<const void> owner, string_view data)
+{
+    if (owner == nullptr || data.size() < Output::min_shared_size) {
+        m_output.m_chars += data;
+    } else {
+        m_output.m_pieces.push_back({ m_output.m_chars.size(), move(owner), data });
+        m_output.m_shared_size += data.size();
+    }
+
+    return *this;
+}
+
+server::Protocol::Writer::Mark server::Protocol::Writer::begin_string()
+{
+    const auto start = mark();
+    add_raw(sizeof(uint32_t));
+    return start;
+}
+
+void server::Protocol::Writer::end_string(const Mark& mark)
+{
+    const auto size = to_string_size(m_output.size() - mark.size - sizeof(uint32_t));
+    store_integer(m_output.m_chars.data() + mark.chars, size);
+}
+
+server::Protocol::Writer::Mark server::Protocol::Writer::begin_frame(uint32_t id)
+{
+    const auto start = begin_string();
+    add_integer(id);
+    return start;
+}
+
+void server::Protocol::Writer::rewind(const Mark& mark) noexcept
+{
+    auto& pieces = m_output.m_pieces;
+    m_output.m_chars.resize(mark.chars);
+    pieces.erase(pieces.begin() + static_cast<std::ptrdiff_t>(mark.pieces), pieces.end());
+    m_output.m_shared_size = mark.size - mark.chars;
+}
+
+size_t server::Protocol::frame_size(string_view data)
+{
+    if (data.size() < sizeof(uint32_t)) {
+        return 0;
+    }
+
+    const auto size = parse_integer(data);
+    if (size > max_frame_size || size < header_size - sizeof(uint32_t)) {
+        throw ProtocolError{ "The frame size is invalid." };
+    }
+
+    const size_t frame_size = sizeof(uint32_t) + size;
+    return data.size() < frame_size ? 0 : frame_size;
+}
+
+uint32_t server::Protocol::frame_id(string_view frame) noexcept
+{
+    return parse_integer(frame.substr(sizeof(uint32_t)));
+}
@@ -0,0 +1,242 @@
+#pragma once
+#ifndef PROTOCOL_H_
+#  define PROTOCOL_H_
+#  include <cstddef>
+#  include <cstdint>
+
+#  include <memory>
+#  include <stdexcept>
+#  include <string>
+#  include <string_view>
+#  include <vector>
+
+namespace server
+{
+    // A request which does not follow the protocol
+    class ProtocolError : public std::runtime_error
+    {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    // Binary frames of the server. A frame is the little-endian u32 size of the rest, the u32
+    // id chosen by the client and a body: the opcode and its arguments in a request, the status
+    // and the results in the response with the same id. Strings are a u32 size and the chars.
+    //
+    // get path                                  -> content
+    // read path u64 offset u32 size             -> the content in range, shorter at the end
+    // stat path                                 -> kind, u64 size (0 for a folder)
+    // create folder kind name overwrite content -> (content only for Kind::file)
+    // remove path                               -> u8 whether it existed
+    // search name                               -> u32 count, absolute paths
+    // list path cursor u32 limit                -> u32 count, (kind, name) of every child in
+    //                                              the page, the cursor of the next page
+    // batch u32 count, request bodies           -> u32 count, response bodies
+    // metrics                                   -> Metrics in the Prometheus text format
+    // trace                                     -> the spans of Tracer as Chrome trace JSON
+    //
+    // Any status but ok comes with a message instead of the results. The requests of a batch
+    // run in order, except that the gets, reads and stats between two other requests run grouped
+    // by folder. They fail one by one, a batch is not atomic, but one whose results together do
+    // not fit a frame is answered with failed as a whole.
+    class Protocol
+    {
+    public:
+        static constexpr std::size_t header_size = 8;
+        // Larger frames close the connection
+        static constexpr std::uint32_t max_frame_size = std::uint32_t{ 16 } << 20;
+        // The limit of a list which is 0 or larger, see Folder::list
+        static constexpr std::uint32_t max_list_size = 4096;
+
+        enum class Opcode : std::uint8_t
+        {
+            get,
+            read,
+            stat,
+            create,
+            remove,
+            search,
+            list,
+            batch,
+            metrics,
+            trace
+        };
+
+        enum class Status : std::uint8_t
+        {
+            ok,
+            not_found,
+            not_a_file,
+            not_a_folder,
+            bad_request,
+            failed
+        };
+
+        enum class Kind : std::uint8_t
+        {
+            file,
+            folder
+        };
+
+        // The results of stat and of list for every child
+        struct Stat
+        {
+            Kind kind;
+            std::uint64_t size;
+        };
+
+        struct Entry
+        {
+            Kind kind;
+            std::string name;
+        };
+
+        // The results of list, an empty cursor after the last page
+        struct Page
+        {
+            std::vector<Entry> entries;
+            std::string cursor;
+        };
+
+        // Reads a body in order, throws ProtocolError when it ends too early
+        class Reader
+        {
+        public:
+            explicit Reader(std::string_view body) noexcept;
+
+            std::uint8_t read_byte();
+            std::uint32_t read_integer();
+            std::uint64_t read_long();
+            std::string_view read_string();
+            inline bool at_end() const noexcept;
+        private:
+            std::string_view take(std::size_t size);
+
+            std::string_view m_data;
+        };
+
+        class Writer;
+
+        // What a connection has to send: chars written in place and between them pieces of
+        // contents, which are sent from where they are stored
+        class Output
+        {
+            friend class Writer;
+        public:
+            // Shorter pieces are copied, that costs less than another buffer to gather
+            static constexpr std::size_t min_shared_size = 4096;
+
+            inline std::size_t size() const noexcept;
+            inline bool empty() const noexcept;
+            // Calls function with the data to send in order
+            template <typename Function>
+            void for_each_buffer(Function&& function) const;
+            void clear() noexcept;
+        private:
+            struct Piece
+            {
+                // The number of chars in place before it
+                std::size_t position;
+                std::shared_ptr<const void> owner;
+                std::string_view data;
+            };
+
+            std::string m_chars;
+            std::vector<Piece> m_pieces;
+            std::size_t m_shared_size = 0;
+        };
+
+        // Appends values to output
+        class Writer
+        {
+        public:
+            struct Mark
+            {
+                std::size_t chars;
+                std::size_t pieces;
+                std::size_t size;
+            };
+
+            explicit Writer(Output& output) noexcept;
+
+            Writer& add_byte(std::uint8_t value);
+            Writer& add_integer(std::uint32_t value);
+            Writer& add_long(std::uint64_t value);
+            // The strings throw std::length_error if they do not fit their u32 size
+            Writer& add_string(std::string_view value);
+            // Moves value to the end as a string
+            Writer& add_string(Output&& value);
+            // Appends size chars for the caller to fill in
+            char* add_raw(std::size_t size);
+            // Appends data without copying it if owner keeps it alive
+            Writer& add_shared(std::shared_ptr<const void> owner, std::string_view data);
+            // Starts a string made of the values added until end_string with the returned mark.
+            // end_string throws std::length_error if they do not fit its u32 size, the caller
+            // rewinds what it added.
+            Mark begin_string();
+            void end_string(const Mark& mark);
+            // A frame is a string starting with its id
+            Mark begin_frame(std::uint32_t id);
+            inline void end_frame(const Mark& mark);
+            // Where the next value goes, rewind drops everything added after
+            inline Mark mark() const noexcept;
+            void rewind(const Mark& mark) noexcept;
+        private:
+            Output& m_output;
+        };
+
+        // The whole size of the frame at the start of data, 0 while it is incomplete. Throws
+        // ProtocolError if the frame is larger than max_frame_size.
+        static std::size_t frame_size(std::string_view data);
+        static std::uint32_t frame_id(std::string_view frame) noexcept;
+        static inline std::string_view frame_body(std::string_view frame) noexcept;
+    };
+
+    inline bool Protocol::Reader::at_end() const noexcept
+    {
+        return m_data.empty();
+    }
+
+    inline std::size_t Protocol::Output::size() const noexcept
+    {
+        return m_chars.size() + m_shared_size;
+    }
+
+    inline bool Protocol::Output::empty() const noexcept
+    {
+        return size() == 0;
+    }
+
+    template <typename Function>
+    void Protocol::Output::for_each_buffer(Function&& function) const
+    {
+        const std::string_view chars{ m_chars };
+        std::size_t position = 0;
+        for (const auto& piece : m_pieces) {
+            if (piece.position != position) {
+                function(chars.substr(position, piece.position - position));
+                position = piece.position;
+            }
+            function(piece.data);
+        }
+        if (position != chars.size()) {
+            function(chars.substr(position));
+        }
+    }
+
+    inline void Protocol::Writer::end_frame(const Mark& mark)
+    {
+        end_string(mark);
+    }
+
+    inline Protocol::Writer::Mark Protocol::Writer::mark() const noexcept
+    {
+        return { m_output.m_chars.size(), m_output.m_pieces.size(), m_output.size() };
+    }
+
+    inline std::string_view Protocol::frame_body(std::string_view frame) noexcept
+    {
+        return frame.substr(header_size);
+    }
+}  // namespace server
+#endif  // !PROTOCOL_H_
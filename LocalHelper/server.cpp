@@ -1 +1,520 @@
 #include "server.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <utility>
+
+#include "filesystem.h"
+#include "metrics.h"
+#include "trace.h"
+using std::invalid_argument;
+using std::logic_error;
+using std::make_unique;
+using std::numeric_limits;
+using std::runtime_error;
+using std::shared_ptr;
+using std::size_t;
+using std::span;
+using std::string;
+using std::string_view;
+using std::uint32_t;
+using std::uint8_t;
+using std::vector;
+namespace filesystem = std::filesystem;
+
+namespace
+{
+    filesystem::path read_path(server::Protocol::Reader& request)
+    {
+        const auto path = request.read_string();
+        if (!path.starts_with('/')) {
+            throw server::ProtocolError{ "Paths must be absolute." };
+        }
+
+        return filesystem::path{ path };
+    }
+
+    uint32_t to_size(size_t size)
+    {
+        if (size > numeric_limits<uint32_t>::max()) {
+            throw runtime_error{ "The result is too large." };
+        }
+
+        return static_cast<uint32_t>(size);
+    }
+
+    constexpr auto ok = static_cast<uint8_t>(server::Protocol::Status::ok);
+
+    void fail(server::Protocol::Writer& response, server::Protocol::Status status,
+              string_view message)
+    {
+        response.add_byte(static_cast<uint8_t>(status)).add_string(message);
+    }
+
+    void fail(server::Protocol::Writer& response, server::FileSystemError error)
+    {
+        using server::FileSystemError;
+        using server::Protocol;
+
+        switch (error) {
+        case FileSystemError::not_found:
+            fail(response, Protocol::Status::not_found, "Unknown filename.");
+            break;
+        case FileSystemError::not_a_file:
+            fail(response, Protocol::Status::not_a_file, "The name does not refer to a file.");
+            break;
+        case FileSystemError::not_a_folder:
+            fail(response, Protocol::Status::not_a_folder, "The name does not refer to a folder.");
+            break;
+        }
+    }
+
+    // Runs execute, an exception replaces what it wrote with a status and a message
+    template <typename Function>
+    void answer_or_fail(server::Protocol::Writer& response, Function&& execute)
+    {
+        using server::Protocol;
+
+        const auto mark = response.mark();
+        try {
+            execute();
+        } catch (const server::ProtocolError& error) {
+            response.rewind(mark);
+            fail(response, Protocol::Status::bad_request, error.what());
+        } catch (const invalid_argument& error) {
+            response.rewind(mark);
+            fail(response, Protocol::Status::not_found, error.what());
+        } catch (const std::exception& error) {
+            response.rewind(mark);
+            fail(response, Protocol::Status::failed, error.what());
+        }
+    }
+
+    // Gets, reads and stats run grouped by folder inside a batch
+    bool is_lookup(string_view body) noexcept
+    {
+        using server::Protocol;
+
+        if (body.empty()) {
+            return false;
+        }
+
+        const auto opcode = static_cast<Protocol::Opcode>(body.front());
+        return opcode == Protocol::Opcode::get || opcode == Protocol::Opcode::read
+            || opcode == Protocol::Opcode::stat;
+    }
+
+    server::Protocol::Kind kind_of(const server::FileBase& file) noexcept
+    {
+        return file.kind() == server::FileBase::Kind::file ? server::Protocol::Kind::file
+                                                           : server::Protocol::Kind::folder;
+    }
+}  // namespace
+
+server::Server::Server(FileSystem& file_system) : Server(file_system, Options{})
+{}
+
+server::Server::Server(FileSystem& file_system, const Options& options)
+    : m_file_system(file_system), m_options(options)
+{
+    if (file_system.synchronization() == FileSystem::Synchronization::none) {
+        throw invalid_argument{ "The file system is not synchronized." };
+    }
+    if (m_options.thread_count == 0) {
+        m_options.thread_count = std::max(std::thread::hardware_concurrency(), 1U);
+    }
+}
+
+server::Server::~Server()
+{
+    stop();
+}
+
+void server::Server::start()
+{
+    if (!m_threads.empty()) {
+        throw logic_error{ "The server is already running." };
+    }
+
+    // A loop and a listener for every thread on Linux, the threads share both on Windows
+#ifdef _WIN32
+    const size_t loop_count = 1;
+#else
+    const size_t loop_count = m_options.thread_count;
+#endif
+    m_port = m_options.port;
+    for (size_t index = 0; index < loop_count; ++index) {
+        m_listeners.push_back(Socket::listen(m_port));
+        m_port = m_listeners.back().local_port();
+        m_loops.push_back(make_unique<EventLoop>());
+    }
+    for (size_t index = 0; index < m_options.thread_count; ++index) {
+        EventLoop& loop = *m_loops[index % loop_count];
+        Socket& listener = m_listeners[index % loop_count];
+        m_threads.emplace_back([this, &loop, &listener] {
+            accept_connections(loop, listener);
+            loop.run();
+        });
+    }
+}
+
+void server::Server::stop() noexcept
+{
+    for (const auto& loop : m_loops) {
+        loop->stop();
+    }
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+
+    m_threads.clear();
+    m_listeners.clear();
+    m_loops.clear();
+}
+
+server::Task server::Server::accept_connections(EventLoop& loop, Socket& listener)
+{
+    while (!loop.is_stopping()) {
+        Socket socket = co_await loop.accept(listener);
+        if (socket.is_open()) {
+            serve(loop, std::move(socket));
+        }
+    }
+}
+
+server::Task server::Server::serve(EventLoop& loop, Socket socket)
+{
+    string input(receive_size, '\0');
+    size_t filled = 0;
+    Protocol::Output output;
+    vector<ConstBuffer> buffers;
+    for (;;) {
+        const size_t received = co_await loop.receive(socket, span{ input }.subspan(filled));
+        if (received == 0) {
+            co_return;
+        }
+        filled += received;
+
+        // Answers every complete frame before sending, so pipelined requests share a send
+        size_t consumed = 0;
+        try {
+            for (;;) {
+                const string_view rest{ input.data() + consumed, filled - consumed };
+                const size_t size = Protocol::frame_size(rest);
+                if (size == 0) {
+                    break;
+                }
+                answer(rest.substr(0, size), output);
+                consumed += size;
+            }
+        } catch (const ProtocolError&) {
+            // Nothing after a frame of invalid size can be framed
+            co_return;
+        }
+
+        std::memmove(input.data(), input.data() + consumed, filled - consumed);
+        filled -= consumed;
+        if (filled == input.size()) {
+            input.resize(input.size() * 2);
+        } else if (filled == 0 && input.size() > receive_size) {
+            input.resize(receive_size);
+            input.shrink_to_fit();
+        }
+
+        // The contents are gathered from where they are stored
+        output.for_each_buffer([&buffers](string_view data) {
+            buffers.emplace_back(data.data(), data.size());
+        });
+        for (size_t first = 0; first < buffers.size();) {
+            size_t sent = co_await loop.send(socket, span{ buffers }.subspan(first));
+            if (sent == 0) {
+                co_return;
+            }
+            for (; first < buffers.size() && buffers[first].size() <= sent; ++first) {
+                sent -= buffers[first].size();
+            }
+            if (sent != 0) {
+                buffers[first].remove_prefix(sent);
+            }
+        }
+        buffers.clear();
+        output.clear();
+    }
+}
+
+void server::Server::answer(string_view frame, Protocol::Output& output)
+{
+    LOCAL_HELPER_TRACE("Server::answer");
+    Protocol::Writer response{ output };
+    const auto mark = response.begin_frame(Protocol::frame_id(frame));
+    const auto body = response.mark();
+    Protocol::Reader request{ Protocol::frame_body(frame) };
+    execute(request, response);
+    try {
+        response.end_frame(mark);
+    } catch (const std::length_error& error) {
+        // e.g. a batch of several large gets, each of which fits on its own
+        response.rewind(body);
+        fail(response, Protocol::Status::failed, error.what());
+        response.end_frame(mark);
+    }
+}
+
+void server::Server::execute(Protocol::Reader& request, Protocol::Writer& response)
+{
+    answer_or_fail(response, [&] {
+        const auto opcode = static_cast<Protocol::Opcode>(request.read_byte());
+        if (opcode == Protocol::Opcode::batch) {
+            execute_batch(request, response);
+        } else {
+            execute_single(opcode, request, response);
+        }
+    });
+}
+
+void server::Server::execute_single(
+    Protocol::Opcode opcode,
+    Protocol::Reader& request,
+    Protocol::Writer& response
+)
+{
+    using HowToHandleFilesWithTheSameName = Folder::HowToHandleFilesWithTheSameName;
+
+    switch (opcode) {
+    case Protocol::Opcode::get:
+    case Protocol::Opcode::read:
+    case Protocol::Opcode::stat:
+        look_up(read_lookup(opcode, request), response);
+        break;
+    case Protocol::Opcode::create: {
+        const auto folder = read_path(request);
+        const auto kind = static_cast<Protocol::Kind>(request.read_byte());
+        const auto name = request.read_string();
+        if (!FileSystem::is_valid_name(name)) {
+            throw ProtocolError{ "Invalid filename." };
+        }
+        const auto how_to_handle_files_with_the_same_name = request.read_byte() != 0
+            ? HowToHandleFilesWithTheSameName::overwrite
+            : HowToHandleFilesWithTheSameName::throw_exception;
+        if (kind == Protocol::Kind::file) {
+            File file{ name, string{ request.read_string() } };
+            m_file_system.concurrent_add(
+                std::move(file), folder, how_to_handle_files_with_the_same_name
+            );
+        } else if (kind == Protocol::Kind::folder) {
+            m_file_system.concurrent_add(
+                Folder{ name }, folder, how_to_handle_files_with_the_same_name
+            );
+        } else {
+            throw ProtocolError{ "Unknown kind." };
+        }
+        response.add_byte(ok);
+        break;
+    }
+    case Protocol::Opcode::remove: {
+        const auto path = read_path(request);
+        response.add_byte(ok).add_byte(m_file_system.concurrent_remove(path));
+        break;
+    }
+    case Protocol::Opcode::search: {
+        const auto name = request.read_string();
+        const auto paths = m_file_system.concurrent_search_file(name);
+        response.add_byte(ok).add_integer(to_size(paths.size()));
+        for (const auto& path : paths) {
+            response.add_string(path);
+        }
+        break;
+    }
+    case Protocol::Opcode::list: {
+        const auto path = read_path(request);
+        const auto cursor = request.read_string();
+        auto limit = request.read_integer();
+        if (limit == 0 || limit > Protocol::max_list_size) {
+            limit = Protocol::max_list_size;
+        }
+        m_file_system.concurrent_list_folder(path, cursor, limit, [&](const Folder::Page& page) {
+            response.add_byte(ok).add_integer(to_size(page.files.size()));
+            for (const FileBase& file : page.files) {
+                response.add_byte(static_cast<uint8_t>(kind_of(file))).add_string(file.name());
+            }
+            response.add_string(page.cursor);
+        });
+        break;
+    }
+    case Protocol::Opcode::metrics: {
+        string text;
+        m_file_system.sample_metrics();
+        Metrics::write_prometheus(text);
+        response.add_byte(ok).add_string(text);
+        break;
+    }
+    case Protocol::Opcode::trace: {
+        string text;
+        Tracer::write_chrome_trace(text);
+        response.add_byte(ok).add_string(text);
+        break;
+    }
+    case Protocol::Opcode::batch:
+        throw ProtocolError{ "Batches cannot be nested." };
+    default:
+        throw ProtocolError{ "Unknown opcode." };
+    }
+}
+
+void server::Server::execute_batch(Protocol::Reader& request, Protocol::Writer& response)
+{
+    const auto count = request.read_integer();
+    vector<string_view> bodies;
+    for (uint32_t index = 0; index < count; ++index) {
+        bodies.push_back(request.read_string());
+    }
+
+    response.add_byte(ok).add_integer(count);
+    for (size_t begin = 0; begin < bodies.size();) {
+        auto end = begin;
+        while (end < bodies.size() && is_lookup(bodies[end])) {
+            ++end;
+        }
+        if (end != begin) {
+            look_up(span{ bodies }.subspan(begin, end - begin), response);
+            begin = end;
+            continue;
+        }
+
+        Protocol::Reader single{ bodies[begin] };
+        const auto mark = response.begin_string();
+        answer_or_fail(response, [&] {
+            execute_single(static_cast<Protocol::Opcode>(single.read_byte()), single, response);
+        });
+        response.end_string(mark);
+        ++begin;
+    }
+}
+
+server::Server::Lookup
+server::Server::read_lookup(Protocol::Opcode opcode, Protocol::Reader& request)
+{
+    const auto path = read_path(request).lexically_normal();
+    Lookup lookup{ path, {}, opcode };
+    if (opcode == Protocol::Opcode::read) {
+        lookup.offset = request.read_long();
+        lookup.size = request.read_integer();
+    }
+    // e.g. "/" or "/folder/", which name a folder without a parent to look it up in
+    if (path.has_filename()) {
+        lookup.folder = path.parent_path();
+        lookup.name = path.filename().generic_string();
+    }
+    return lookup;
+}
+
+void server::Server::look_up(const Lookup& lookup, Protocol::Writer& response) const
+{
+    m_file_system.concurrent_visit_folder(lookup.folder, [&](const Folder& folder) {
+        look_up(folder, lookup, response);
+    });
+}
+
+void server::Server::look_up(span<const string_view> bodies, Protocol::Writer& response) const
+{
+    struct PendingLookup
+    {
+        Lookup lookup;
+        size_t index;
+    };
+
+    // The responses are written in order once every group ran
+    vector<Protocol::Output> results(bodies.size());
+    vector<PendingLookup> lookups;
+    for (size_t index = 0; index < bodies.size(); ++index) {
+        Protocol::Writer result{ results[index] };
+        answer_or_fail(result, [&] {
+            Protocol::Reader request{ bodies[index] };
+            const auto opcode = static_cast<Protocol::Opcode>(request.read_byte());
+            lookups.push_back({ read_lookup(opcode, request), index });
+        });
+    }
+
+    std::stable_sort(lookups.begin(), lookups.end(), [](const auto& left, const auto& right) {
+        return left.lookup.folder < right.lookup.folder;
+    });
+    for (auto begin = lookups.begin(); begin != lookups.end();) {
+        const auto end = std::find_if(begin, lookups.end(), [&](const PendingLookup& pending) {
+            return pending.lookup.folder != begin->lookup.folder;
+        });
+        try {
+            m_file_system.concurrent_visit_folder(begin->lookup.folder, [&](const Folder& folder) {
+                for (auto pending = begin; pending != end; ++pending) {
+                    Protocol::Writer result{ results[pending->index] };
+                    answer_or_fail(result, [&] { look_up(folder, pending->lookup, result); });
+                }
+            });
+        } catch (...) {
+            // The folder itself was not found, so none of the group ran
+            const auto error = std::current_exception();
+            for (auto pending = begin; pending != end; ++pending) {
+                Protocol::Writer result{ results[pending->index] };
+                answer_or_fail(result, [&] { std::rethrow_exception(error); });
+            }
+        }
+        begin = end;
+    }
+
+    for (auto& result : results) {
+        response.add_string(std::move(result));
+    }
+}
+
+void server::Server::look_up(
+    const Folder& folder,
+    const Lookup& lookup,
+    Protocol::Writer& response
+)
+{
+    const auto stat = lookup.opcode == Protocol::Opcode::stat;
+    if (lookup.name.empty()) {
+        if (stat) {
+            response.add_byte(ok).add_byte(static_cast<uint8_t>(Protocol::Kind::folder));
+            response.add_long(0);
+        } else {
+            fail(response, FileSystemError::not_a_file);
+        }
+        return;
+    }
+
+    const auto file = folder.try_get_file(lookup.name);
+    if (!file) {
+        if (stat && file.error() == FileSystemError::not_a_file) {
+            response.add_byte(ok).add_byte(static_cast<uint8_t>(Protocol::Kind::folder));
+            response.add_long(0);
+        } else {
+            fail(response, file.error());
+        }
+        return;
+    }
+
+    const File& found = *file;
+    if (stat) {
+        response.add_byte(ok).add_byte(static_cast<uint8_t>(Protocol::Kind::file));
+        response.add_long(found.size());
+        return;
+    }
+
+    auto offset = found.size();
+    auto size = found.size();
+    if (lookup.opcode == Protocol::Opcode::read) {
+        offset = std::min<uint64_t>(lookup.offset, found.size());
+        size = std::min<uint64_t>(lookup.size, found.size() - offset);
+    } else {
+        offset = 0;
+    }
+    response.add_byte(ok).add_integer(to_size(size));
+    found.for_each_shared_chunk(offset, size, [&](shared_ptr<const void> owner, string_view piece) {
+        response.add_shared(std::move(owner), piece);
+    });
+}
@@ -1,10 +1,98 @@
 #pragma once
 #ifndef SERVER_H_
 #  define SERVER_H_
+#  include <cstddef>
+#  include <cstdint>
+
+#  include <filesystem>
+#  include <memory>
+#  include <span>
+#  include <string>
+#  include <string_view>
+#  include <thread>
+#  include <vector>
+
+#  include "event_loop.h"
+#  include "protocol.h"
 
 namespace server
 {
-    
+    class FileSystem;
+    class Folder;
+
+    // Serves a file system over TCP, see Protocol. Each connection is a coroutine answering its
+    // requests in order, the connections are spread over one thread per core.
+    class Server
+    {
+    public:
+        struct Options
+        {
+            // 0 picks a free port, see port
+            std::uint16_t port = 7070;
+            // 0 runs one thread per core
+            std::size_t thread_count = 0;
+        };
+
+        // file_system must be synchronized and outlive the server, only its concurrent members
+        // are used
+        explicit Server(FileSystem& file_system);
+        Server(FileSystem& file_system, const Options& options);
+        Server(const Server&) = delete;
+        ~Server();
+
+        Server& operator=(const Server&) = delete;
+
+        // Listens and returns, the threads serve until stop
+        void start();
+        // Closes every connection and waits for the threads
+        void stop() noexcept;
+        // The port listened on once started
+        inline std::uint16_t port() const noexcept;
+    private:
+        static constexpr std::size_t receive_size = std::size_t{ 64 } << 10;
+
+        Task accept_connections(EventLoop& loop, Socket& listener);
+        Task serve(EventLoop& loop, Socket socket);
+        // Appends the response to the request frame to output
+        void answer(std::string_view frame, Protocol::Output& output);
+        // Writes the response body, a failure as its status and message
+        void execute(Protocol::Reader& request, Protocol::Writer& response);
+        void execute_single(
+            Protocol::Opcode opcode,
+            Protocol::Reader& request,
+            Protocol::Writer& response
+        );
+        void execute_batch(Protocol::Reader& request, Protocol::Writer& response);
+        // A get, read or stat of name in folder, an empty name is the folder itself
+        struct Lookup
+        {
+            std::filesystem::path folder;
+            std::string name;
+            Protocol::Opcode opcode;
+            // The range of a read
+            std::uint64_t offset = 0;
+            std::uint64_t size = 0;
+        };
+
+        static Lookup read_lookup(Protocol::Opcode opcode, Protocol::Reader& request);
+        void look_up(const Lookup& lookup, Protocol::Writer& response) const;
+        // Lookups of a batch, each folder is locked once for all of its lookups. Appends their
+        // responses in order.
+        void look_up(std::span<const std::string_view> bodies, Protocol::Writer& response) const;
+        // Contents are added as pieces shared with the file, so they are never copied
+        static void look_up(const Folder& folder, const Lookup& lookup, Protocol::Writer& response);
+
+        FileSystem& m_file_system;
+        Options m_options;
+        std::uint16_t m_port = 0;
+        std::vector<std::unique_ptr<EventLoop>> m_loops;
+        std::vector<Socket> m_listeners;
+        std::vector<std::thread> m_threads;
+    };
+
+    inline std::uint16_t Server::port() const noexcept
+    {
+        return m_port;
+    }
 }  // namespace server
 #endif  // !SERVER_H_
-
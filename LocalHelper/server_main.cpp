@@ -0,0 +1,52 @@
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "filesystem.h"
+#include "server.h"
+using namespace std;
+using namespace server;
+
+namespace
+{
+    volatile sig_atomic_t interrupted = 0;
+
+    void interrupt(int)
+    {
+        interrupted = 1;
+    }
+}  // namespace
+
+// LocalHelperServer [port [thread count]] serves an empty file system until interrupted
+int main(int argc, char* argv[])
+{
+    try {
+        Server::Options options;
+        if (argc > 1) {
+            options.port = static_cast<uint16_t>(stoul(argv[1]));
+        }
+        if (argc > 2) {
+            options.thread_count = stoul(argv[2]);
+        }
+
+        FileSystem file_system{ FileSystem::Synchronization::lock_free_reads };
+        Server server{ file_system, options };
+        signal(SIGINT, interrupt);
+        signal(SIGTERM, interrupt);
+        server.start();
+        cout << "Listening on port " << server.port() << endl;
+        while (interrupted == 0) {
+            this_thread::sleep_for(chrono::milliseconds{ 100 });
+        }
+        server.stop();
+    } catch (const exception& error) {
+        cerr << error.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
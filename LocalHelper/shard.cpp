@@ -0,0 +1,283 @@
+#include "shard.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
+#include "client.h"
+#include "filesystem.h"
+using std::invalid_argument;
+using std::lock_guard;
+using std::make_unique;
+using std::mutex;
+using std::shared_ptr;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::uint16_t;
+using std::uint32_t;
+using std::uint64_t;
+using std::unique_ptr;
+using std::vector;
+namespace filesystem = std::filesystem;
+
+namespace
+{
+    server::Folder::HowToHandleFilesWithTheSameName to_how_to_handle(bool overwrite) noexcept
+    {
+        using HowToHandleFilesWithTheSameName = server::Folder::HowToHandleFilesWithTheSameName;
+
+        return overwrite ? HowToHandleFilesWithTheSameName::overwrite
+                         : HowToHandleFilesWithTheSameName::throw_exception;
+    }
+
+    server::Protocol::Kind kind_of(const server::FileBase& file) noexcept
+    {
+        return file.kind() == server::FileBase::Kind::file ? server::Protocol::Kind::file
+                                                           : server::Protocol::Kind::folder;
+    }
+}  // namespace
+
+unique_ptr<server::Shard::PendingSearch> server::Shard::start_search(string_view name)
+{
+    class FinishedSearch final : public PendingSearch
+    {
+    public:
+        explicit FinishedSearch(vector<string>&& paths) noexcept : m_paths(std::move(paths))
+        {}
+
+        vector<string> wait() override
+        {
+            return std::move(m_paths);
+        }
+    private:
+        vector<string> m_paths;
+    };
+
+    return make_unique<FinishedSearch>(search(name));
+}
+
+server::LocalShard::LocalShard(FileSystem& file_system) : m_file_system(file_system)
+{
+    if (file_system.synchronization() == FileSystem::Synchronization::none) {
+        throw invalid_argument{ "The file system is not synchronized." };
+    }
+}
+
+string server::LocalShard::get(string_view path)
+{
+    string content;
+    m_file_system.concurrent_visit_file(filesystem::path{ path }, [&](const File& file) {
+        content.reserve(file.size());
+        file.for_each_chunk([&](string_view chunk) { content += chunk; });
+    });
+    return content;
+}
+
+string server::LocalShard::read(string_view path, uint64_t offset, uint32_t size)
+{
+    string content;
+    m_file_system.concurrent_visit_file(filesystem::path{ path }, [&](const File& file) {
+        const auto begin = std::min<uint64_t>(offset, file.size());
+        const auto count = std::min<uint64_t>(size, file.size() - begin);
+        content.reserve(count);
+        file.for_each_shared_chunk(begin, count, [&](shared_ptr<const void>, string_view piece) {
+            content += piece;
+        });
+    });
+    return content;
+}
+
+server::Protocol::Stat server::LocalShard::stat(string_view path)
+{
+    const filesystem::path absolute_path{ path };
+    if (!absolute_path.has_relative_path()) {
+        return { Protocol::Kind::folder, 0 };
+    }
+
+    Protocol::Stat result{};
+    const auto name = absolute_path.filename().generic_string();
+    m_file_system.concurrent_visit_folder(absolute_path.parent_path(), [&](const Folder& folder) {
+        const auto file = folder.try_get_file(name);
+        if (file) {
+            result = { Protocol::Kind::file, file->get().size() };
+        } else if (file.error() == FileSystemError::not_a_file) {
+            result = { Protocol::Kind::folder, 0 };
+        } else {
+            throw invalid_argument{ "Unknown filename." };
+        }
+    });
+    return result;
+}
+
+void server::LocalShard::create(
+    string_view folder,
+    Protocol::Kind kind,
+    string_view name,
+    string_view content,
+    bool overwrite
+)
+{
+    if (!FileSystem::is_valid_name(name)) {
+        throw invalid_argument{ "Invalid filename." };
+    }
+
+    const filesystem::path path{ folder };
+    if (kind == Protocol::Kind::file) {
+        m_file_system.concurrent_add(
+            File{ name, string{ content } }, path, to_how_to_handle(overwrite)
+        );
+    } else {
+        m_file_system.concurrent_add(Folder{ name }, path, to_how_to_handle(overwrite));
+    }
+}
+
+bool server::LocalShard::remove(string_view path)
+{
+    return m_file_system.concurrent_remove(filesystem::path{ path });
+}
+
+vector<string> server::LocalShard::search(string_view name)
+{
+    return m_file_system.concurrent_search_file(name);
+}
+
+vector<server::Protocol::Entry> server::LocalShard::list(string_view path)
+{
+    vector<Protocol::Entry> entries;
+    m_file_system.concurrent_visit_folder(filesystem::path{ path }, [&](const Folder& folder) {
+        entries.reserve(static_cast<size_t>(std::distance(folder.begin(), folder.end())));
+        for (const FileBase& file : folder) {
+            entries.push_back({ kind_of(file), file.copy_name() });
+        }
+    });
+    return entries;
+}
+
+server::RemoteShard::RemoteShard(string host, uint16_t port)
+    : m_host(std::move(host)), m_port(port)
+{}
+
+// Holds its connection until the results are received, one left waiting is closed
+class server::RemoteShard::RemoteSearch final : public PendingSearch
+{
+public:
+    RemoteSearch(RemoteShard& shard, unique_ptr<Client> client) noexcept
+        : m_shard(shard), m_client(std::move(client))
+    {}
+
+    vector<string> wait() override
+    {
+        // A failure status leaves the connection usable
+        try {
+            auto paths = m_client->end_search();
+            m_shard.release(std::move(m_client));
+            return paths;
+        } catch (...) {
+            m_shard.release(std::move(m_client));
+            throw;
+        }
+    }
+private:
+    RemoteShard& m_shard;
+    unique_ptr<Client> m_client;
+};
+
+server::RemoteShard::~RemoteShard() = default;
+
+unique_ptr<server::Client> server::RemoteShard::acquire()
+{
+    {
+        lock_guard<mutex> lock{ m_mutex };
+        if (!m_idle.empty()) {
+            auto client = std::move(m_idle.back());
+            m_idle.pop_back();
+            return client;
+        }
+    }
+    return make_unique<Client>(m_host, m_port);
+}
+
+template <typename Function>
+decltype(auto) server::RemoteShard::with_client(Function&& function)
+{
+    auto client = acquire();
+
+    // A failure status leaves the connection usable
+    struct Release
+    {
+        RemoteShard& shard;
+        unique_ptr<Client>& client;
+
+        ~Release()
+        {
+            shard.release(std::move(client));
+        }
+    } release{ *this, client };
+    return function(*client);
+}
+
+void server::RemoteShard::release(unique_ptr<Client> client) noexcept
+{
+    if (!client->is_connected()) {
+        return;
+    }
+
+    lock_guard<mutex> lock{ m_mutex };
+    try {
+        m_idle.push_back(std::move(client));
+    } catch (...) {
+        // Closes the connection instead
+    }
+}
+
+string server::RemoteShard::get(string_view path)
+{
+    return with_client([&](Client& client) { return client.get(path); });
+}
+
+string server::RemoteShard::read(string_view path, uint64_t offset, uint32_t size)
+{
+    return with_client([&](Client& client) { return client.read(path, offset, size); });
+}
+
+server::Protocol::Stat server::RemoteShard::stat(string_view path)
+{
+    return with_client([&](Client& client) { return client.stat(path); });
+}
+
+void server::RemoteShard::create(
+    string_view folder,
+    Protocol::Kind kind,
+    string_view name,
+    string_view content,
+    bool overwrite
+)
+{
+    with_client([&](Client& client) { client.create(folder, kind, name, content, overwrite); });
+}
+
+bool server::RemoteShard::remove(string_view path)
+{
+    return with_client([&](Client& client) { return client.remove(path); });
+}
+
+vector<string> server::RemoteShard::search(string_view name)
+{
+    return with_client([&](Client& client) { return client.search(name); });
+}
+
+unique_ptr<server::Shard::PendingSearch> server::RemoteShard::start_search(string_view name)
+{
+    auto client = acquire();
+    client->begin_search(name);
+    return make_unique<RemoteSearch>(*this, std::move(client));
+}
+
+vector<server::Protocol::Entry> server::RemoteShard::list(string_view path)
+{
+    return with_client([&](Client& client) { return client.list(path); });
+}
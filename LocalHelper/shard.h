@@ -0,0 +1,124 @@
+#pragma once
+#ifndef SHARD_H_
+#  define SHARD_H_
+#  include <cstdint>
+
+#  include <memory>
+#  include <mutex>
+#  include <string>
+#  include <string_view>
+#  include <vector>
+
+#  include "protocol.h"
+
+namespace server
+{
+    class Client;
+    class FileSystem;
+
+    // Stores the subtrees of the mount points of a ShardedFileSystem which it owns, each at its
+    // absolute path. Paths are absolute and normal, the members are called from several threads
+    // at once and throw as FileSystem does. The operations are those of Protocol.
+    class Shard
+    {
+    public:
+        // A search started by start_search, wait returns its results
+        class PendingSearch
+        {
+        public:
+            virtual ~PendingSearch() = default;
+
+            virtual std::vector<std::string> wait() = 0;
+        };
+
+        virtual ~Shard() = default;
+
+        virtual std::string get(std::string_view path) = 0;
+        virtual std::string read(std::string_view path, std::uint64_t offset, std::uint32_t size)
+            = 0;
+        virtual Protocol::Stat stat(std::string_view path) = 0;
+        // content is ignored for a folder
+        virtual void create(
+            std::string_view folder,
+            Protocol::Kind kind,
+            std::string_view name,
+            std::string_view content,
+            bool overwrite
+        ) = 0;
+        virtual bool remove(std::string_view path) = 0;
+        virtual std::vector<std::string> search(std::string_view name) = 0;
+        // Lets the searches of several shards wait for their servers at the same time without a
+        // thread each. Unless overridden it searches right away.
+        virtual std::unique_ptr<PendingSearch> start_search(std::string_view name);
+        virtual std::vector<Protocol::Entry> list(std::string_view path) = 0;
+    };
+
+    // A synchronized FileSystem of this process, which must outlive the shard
+    class LocalShard final : public Shard
+    {
+    public:
+        explicit LocalShard(FileSystem& file_system);
+
+        std::string get(std::string_view path) override;
+        std::string read(std::string_view path, std::uint64_t offset, std::uint32_t size)
+            override;
+        Protocol::Stat stat(std::string_view path) override;
+        void create(
+            std::string_view folder,
+            Protocol::Kind kind,
+            std::string_view name,
+            std::string_view content,
+            bool overwrite
+        ) override;
+        bool remove(std::string_view path) override;
+        std::vector<std::string> search(std::string_view name) override;
+        std::vector<Protocol::Entry> list(std::string_view path) override;
+    private:
+        FileSystem& m_file_system;
+    };
+
+    // A Server on another node. Concurrent calls are sent over connections of their own, which
+    // are kept open for later calls.
+    class RemoteShard final : public Shard
+    {
+    public:
+        RemoteShard(std::string host, std::uint16_t port);
+        RemoteShard(const RemoteShard&) = delete;
+        ~RemoteShard() override;
+
+        RemoteShard& operator=(const RemoteShard&) = delete;
+
+        std::string get(std::string_view path) override;
+        std::string read(std::string_view path, std::uint64_t offset, std::uint32_t size)
+            override;
+        Protocol::Stat stat(std::string_view path) override;
+        void create(
+            std::string_view folder,
+            Protocol::Kind kind,
+            std::string_view name,
+            std::string_view content,
+            bool overwrite
+        ) override;
+        bool remove(std::string_view path) override;
+        std::vector<std::string> search(std::string_view name) override;
+        // Sends the search and receives the results in wait
+        std::unique_ptr<PendingSearch> start_search(std::string_view name) override;
+        std::vector<Protocol::Entry> list(std::string_view path) override;
+    private:
+        class RemoteSearch;
+
+        // An idle connection or a new one
+        std::unique_ptr<Client> acquire();
+        // Calls function with an idle connection or a new one
+        template <typename Function>
+        decltype(auto) with_client(Function&& function);
+        // Keeps client for later calls unless it broke
+        void release(std::unique_ptr<Client> client) noexcept;
+
+        std::string m_host;
+        std::uint16_t m_port;
+        std::mutex m_mutex;
+        std::vector<std::unique_ptr<Client>> m_idle;
+    };
+}  // namespace server
+#endif  // !SHARD_H_
@@ -0,0 +1,362 @@
+#include "sharded_filesystem.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+using std::invalid_argument;
+using std::numeric_limits;
+using std::runtime_error;
+using std::shared_lock;
+using std::shared_mutex;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::uint32_t;
+using std::uint64_t;
+using std::unique_lock;
+using std::unique_ptr;
+using std::vector;
+namespace filesystem = std::filesystem;
+
+namespace
+{
+    constexpr auto any_shard = numeric_limits<size_t>::max();
+
+    // The form of the keys of the mount points, "/" or without a trailing separator
+    string normal_path(string_view path)
+    {
+        if (!path.starts_with('/')) {
+            throw invalid_argument{ "Paths must be absolute." };
+        }
+
+        auto normal = filesystem::path{ path }.lexically_normal().generic_string();
+        if (normal.size() > 1 && normal.back() == '/') {
+            normal.pop_back();
+        }
+        return normal;
+    }
+
+    string_view parent_of(string_view path) noexcept
+    {
+        const auto separator = path.rfind('/');
+        return separator == 0 ? path.substr(0, 1) : path.substr(0, separator);
+    }
+
+    string child_of(string_view folder, string_view name)
+    {
+        string path{ folder };
+        if (path.size() > 1) {
+            path += '/';
+        }
+        path += name;
+        return path;
+    }
+
+    // Whether shard stores a folder at path, throws if it is a file
+    bool has_folder(server::Shard& shard, string_view path)
+    {
+        try {
+            if (shard.stat(path).kind == server::Protocol::Kind::file) {
+                throw runtime_error{ "The name does not refer to a folder." };
+            }
+            return true;
+        } catch (const invalid_argument&) {
+            return false;
+        }
+    }
+}  // namespace
+
+server::ShardedFileSystem::ShardedFileSystem(unique_ptr<Shard> root_shard)
+{
+    m_shards.push_back(std::move(root_shard));
+    m_mounts.try_emplace("/", 0);
+}
+
+size_t server::ShardedFileSystem::add_shard(unique_ptr<Shard> shard)
+{
+    unique_lock<shared_mutex> lock{ m_mutex };
+    m_shards.push_back(std::move(shard));
+    return m_shards.size() - 1;
+}
+
+void server::ShardedFileSystem::mount(string_view path, size_t shard)
+{
+    unique_lock<shared_mutex> lock{ m_mutex };
+    if (shard >= m_shards.size()) {
+        throw invalid_argument{ "Unknown shard." };
+    }
+    const auto normal = normal_path(path);
+    if (m_mounts.contains(normal)) {
+        throw runtime_error{ "The folder is already a mount point." };
+    }
+
+    Shard& parent = *m_shards[find_mount(normal)->second.shard];
+    if (!has_folder(parent, normal)) {
+        const auto name = normal.substr(normal.rfind('/') + 1);
+        parent.create(parent_of(normal), Protocol::Kind::folder, name, {}, false);
+    } else if (!parent.list(normal).empty()) {
+        throw runtime_error{ "Only an empty folder can be mounted." };
+    }
+
+    make_folders(*m_shards[shard], normal);
+    m_mounts.try_emplace(normal, shard);
+}
+
+void server::ShardedFileSystem::move_mount(string_view path, size_t shard)
+{
+    unique_lock<shared_mutex> lock{ m_mutex };
+    if (shard >= m_shards.size()) {
+        throw invalid_argument{ "Unknown shard." };
+    }
+    const auto mount = m_mounts.find(normal_path(path));
+    if (mount == m_mounts.end()) {
+        throw runtime_error{ "The folder is not a mount point." };
+    }
+
+    move_mount(mount, shard);
+}
+
+bool server::ShardedFileSystem::rebalance()
+{
+    unique_lock<shared_mutex> lock{ m_mutex };
+    vector<uint64_t> loads(m_shards.size());
+    for (const auto& [path, mount] : m_mounts) {
+        loads[mount.shard] += mount.operations.load(std::memory_order_relaxed);
+    }
+    const auto busiest = static_cast<size_t>(
+        std::distance(loads.begin(), std::max_element(loads.begin(), loads.end()))
+    );
+    const auto idlest = static_cast<size_t>(
+        std::distance(loads.begin(), std::min_element(loads.begin(), loads.end()))
+    );
+
+    // The one after which the busier of the two shards is least busy
+    auto best = m_mounts.end();
+    auto best_load = loads[busiest];
+    for (auto mount = m_mounts.begin(); mount != m_mounts.end(); ++mount) {
+        const auto operations = mount->second.operations.load(std::memory_order_relaxed);
+        if (mount->second.shard != busiest || operations == 0) {
+            continue;
+        }
+        const auto load = std::max(loads[busiest] - operations, loads[idlest] + operations);
+        if (load < best_load) {
+            best = mount;
+            best_load = load;
+        }
+    }
+
+    for (auto& [path, mount] : m_mounts) {
+        mount.operations.store(0, std::memory_order_relaxed);
+    }
+    if (best == m_mounts.end()) {
+        return false;
+    }
+
+    move_mount(best, idlest);
+    return true;
+}
+
+vector<server::ShardedFileSystem::Mount> server::ShardedFileSystem::mounts() const
+{
+    shared_lock<shared_mutex> lock{ m_mutex };
+    vector<Mount> mounts;
+    mounts.reserve(m_mounts.size());
+    for (const auto& [path, mount] : m_mounts) {
+        mounts.push_back({ path, mount.shard, mount.operations.load(std::memory_order_relaxed) });
+    }
+    return mounts;
+}
+
+string server::ShardedFileSystem::get(string_view path)
+{
+    shared_lock<shared_mutex> lock{ m_mutex };
+    const auto normal = normal_path(path);
+    return route(normal).get(normal);
+}
+
+string server::ShardedFileSystem::read(string_view path, uint64_t offset, uint32_t size)
+{
+    shared_lock<shared_mutex> lock{ m_mutex };
+    const auto normal = normal_path(path);
+    return route(normal).read(normal, offset, size);
+}
+
+server::Protocol::Stat server::ShardedFileSystem::stat(string_view path)
+{
+    shared_lock<shared_mutex> lock{ m_mutex };
+    const auto normal = normal_path(path);
+    return route(normal).stat(normal);
+}
+
+void server::ShardedFileSystem::create(
+    string_view folder,
+    Protocol::Kind kind,
+    string_view name,
+    string_view content,
+    bool overwrite
+)
+{
+    shared_lock<shared_mutex> lock{ m_mutex };
+    const auto normal = normal_path(folder);
+    if (m_mounts.contains(child_of(normal, name))) {
+        throw runtime_error{ "A mount point cannot be replaced." };
+    }
+
+    route(normal).create(normal, kind, name, content, overwrite);
+}
+
+bool server::ShardedFileSystem::remove(string_view path)
+{
+    shared_lock<shared_mutex> lock{ m_mutex };
+    const auto normal = normal_path(path);
+    if (m_mounts.contains(normal) || has_mount_below(normal, any_shard)) {
+        throw runtime_error{ "A mount point cannot be removed." };
+    }
+
+    return route(normal).remove(normal);
+}
+
+vector<string> server::ShardedFileSystem::search(string_view name)
+{
+    shared_lock<shared_mutex> lock{ m_mutex };
+    // Remote shards mostly wait for their servers, so every search is sent before any results
+    // are received
+    vector<unique_ptr<Shard::PendingSearch>> searches;
+    searches.reserve(m_shards.size());
+    for (const auto& shard : m_shards) {
+        searches.push_back(shard->start_search(name));
+    }
+    vector<vector<string>> found(m_shards.size());
+    for (size_t index = 0; index < searches.size(); ++index) {
+        found[index] = searches[index]->wait();
+    }
+
+    // A shard may still hold files of a mount point which moved away
+    vector<string> paths;
+    for (size_t index = 0; index < found.size(); ++index) {
+        for (auto& path : found[index]) {
+            if (find_mount(path)->second.shard == index) {
+                paths.push_back(std::move(path));
+            }
+        }
+    }
+    return paths;
+}
+
+vector<server::Protocol::Entry> server::ShardedFileSystem::list(string_view path)
+{
+    shared_lock<shared_mutex> lock{ m_mutex };
+    const auto normal = normal_path(path);
+    return route(normal).list(normal);
+}
+
+server::ShardedFileSystem::mount_map::const_iterator
+server::ShardedFileSystem::find_mount(string_view path) const
+{
+    for (;;) {
+        const auto mount = m_mounts.find(path);
+        if (mount != m_mounts.end()) {
+            return mount;
+        }
+        path = parent_of(path);
+    }
+}
+
+server::Shard& server::ShardedFileSystem::route(string_view path)
+{
+    const auto mount = find_mount(path);
+    mount->second.operations.fetch_add(1, std::memory_order_relaxed);
+    return *m_shards[mount->second.shard];
+}
+
+bool server::ShardedFileSystem::has_mount_below(string_view path, size_t shard) const
+{
+    const auto prefix = path.size() > 1 ? string{ path } + '/' : string{ path };
+    for (auto mount = m_mounts.lower_bound(prefix);
+         mount != m_mounts.end() && mount->first.starts_with(prefix); ++mount) {
+        if (mount->first != path && (shard == any_shard || mount->second.shard == shard)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void server::ShardedFileSystem::move_mount(mount_map::iterator mount, size_t shard)
+{
+    const auto from = mount->second.shard;
+    if (from == shard) {
+        return;
+    }
+
+    make_folders(*m_shards[shard], mount->first);
+    try {
+        copy_subtree(*m_shards[from], *m_shards[shard], mount->first);
+    } catch (...) {
+        // The mount stays where it was, so a later move must not find half a copy. The shard
+        // which failed the copy may fail this as well, the first error is the one to report.
+        try {
+            drop_subtree(shard, mount->first);
+        } catch (...) {
+        }
+        throw;
+    }
+    mount->second.shard = shard;
+    drop_subtree(from, mount->first);
+}
+
+void server::ShardedFileSystem::make_folders(Shard& shard, string_view path)
+{
+    string folder = "/";
+    for (const auto& name : filesystem::path{ path }.relative_path()) {
+        const auto child = child_of(folder, name.generic_string());
+        if (!has_folder(shard, child)) {
+            shard.create(folder, Protocol::Kind::folder, name.generic_string(), {}, false);
+        }
+        folder = child;
+    }
+}
+
+void server::ShardedFileSystem::copy_subtree(Shard& from, Shard& to, const string& path) const
+{
+    for (const auto& entry : from.list(path)) {
+        const auto child = child_of(path, entry.name);
+        if (entry.kind == Protocol::Kind::file) {
+            to.create(path, Protocol::Kind::file, entry.name, from.get(child), true);
+        } else if (m_mounts.contains(child)) {
+            make_folders(to, child);
+        } else {
+            // Overwriting would drop what to stores below it for its own mount points
+            if (!has_folder(to, child)) {
+                to.create(path, Protocol::Kind::folder, entry.name, {}, false);
+            }
+            copy_subtree(from, to, child);
+        }
+    }
+}
+
+void server::ShardedFileSystem::drop_subtree(size_t shard, const string& path) const
+{
+    Shard& from = *m_shards[shard];
+    for (const auto& entry : from.list(path)) {
+        const auto child = child_of(path, entry.name);
+        if (entry.kind == Protocol::Kind::file) {
+            from.remove(child);
+            continue;
+        }
+
+        // Keeps the mount points of the shard and the folders on the way to them
+        const auto mount = m_mounts.find(child);
+        if (mount != m_mounts.end() && mount->second.shard == shard) {
+            continue;
+        }
+        if (has_mount_below(child, shard)) {
+            drop_subtree(shard, child);
+        } else {
+            from.remove(child);
+        }
+    }
+}
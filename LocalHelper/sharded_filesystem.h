@@ -0,0 +1,97 @@
+#pragma once
+#ifndef SHARDED_FILESYSTEM_H_
+#  define SHARDED_FILESYSTEM_H_
+#  include <cstddef>
+#  include <cstdint>
+
+#  include <atomic>
+#  include <functional>
+#  include <map>
+#  include <memory>
+#  include <shared_mutex>
+#  include <string>
+#  include <string_view>
+#  include <vector>
+
+#  include "protocol.h"
+#  include "shard.h"
+
+namespace server
+{
+    // A tree split by path prefix across shards, e.g. the FileSystems of other nodes running a
+    // Server. Every mount point is a folder whose subtree down to the mount points below it is
+    // stored by one shard, at the same paths. The shard of its parent keeps an empty folder in
+    // its place so that it is listed. The root is mounted on the first shard.
+    //
+    // Thread-safe, mounting and moving wait for the calls in flight. Failures are thrown as
+    // FileSystem does.
+    class ShardedFileSystem
+    {
+    public:
+        struct Mount
+        {
+            std::string path;
+            std::size_t shard;
+            // The calls routed to it since the last rebalance
+            std::uint64_t operations;
+        };
+
+        explicit ShardedFileSystem(std::unique_ptr<Shard> root_shard);
+
+        // Returns the index of shard
+        std::size_t add_shard(std::unique_ptr<Shard> shard);
+        // Mounts the folder at path on shard, it must be missing or empty
+        void mount(std::string_view path, std::size_t shard);
+        // Copies the subtree of the mount point at path to shard, then drops it from the shard
+        // it was on. A failure leaves it where it was.
+        void move_mount(std::string_view path, std::size_t shard);
+        // Moves the mount point which best evens out the calls of the busiest and the idlest
+        // shard, if any does, and starts counting again. Returns whether one moved.
+        bool rebalance();
+        std::vector<Mount> mounts() const;
+
+        std::string get(std::string_view path);
+        std::string read(std::string_view path, std::uint64_t offset, std::uint32_t size);
+        Protocol::Stat stat(std::string_view path);
+        // content is ignored for a folder
+        void create(
+            std::string_view folder,
+            Protocol::Kind kind,
+            std::string_view name,
+            std::string_view content,
+            bool overwrite
+        );
+        // Mount points and the folders above them cannot be removed
+        bool remove(std::string_view path);
+        // Asks every shard at once
+        std::vector<std::string> search(std::string_view name);
+        std::vector<Protocol::Entry> list(std::string_view path);
+    private:
+        struct MountPoint
+        {
+            std::size_t shard;
+            // Counted under the shared lock
+            mutable std::atomic<std::uint64_t> operations = 0;
+        };
+
+        using mount_map = std::map<std::string, MountPoint, std::less<>>;
+
+        // The innermost mount point holding path
+        mount_map::const_iterator find_mount(std::string_view path) const;
+        // The shard storing path, counts the call to its mount point
+        Shard& route(std::string_view path);
+        // Whether a mount point of shard, or of any shard if it is npos, lies below path
+        bool has_mount_below(std::string_view path, std::size_t shard) const;
+        void move_mount(mount_map::iterator mount, std::size_t shard);
+        // Creates the folders on the way to path which shard misses
+        static void make_folders(Shard& shard, std::string_view path);
+        // The files and folders of from below path, without the subtrees of other mount points
+        void copy_subtree(Shard& from, Shard& to, const std::string& path) const;
+        void drop_subtree(std::size_t shard, const std::string& path) const;
+
+        mutable std::shared_mutex m_mutex;
+        std::vector<std::unique_ptr<Shard>> m_shards;
+        mount_map m_mounts;
+    };
+}  // namespace server
+#endif  // !SHARDED_FILESYSTEM_H_
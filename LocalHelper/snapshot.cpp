@@ -0,0 +1,344 @@
+#include "snapshot.h"
+
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef _WIN32
+#  ifndef NOMINMAX
+#    define NOMINMAX
+#  endif
+#  include <io.h>
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+#include "filesystem.h"
+#include "trace.h"
+using std::memcmp;
+using std::move;
+using std::pair;
+using std::runtime_error;
+using std::shared_ptr;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::uint64_t;
+using std::vector;
+namespace filesystem = std::filesystem;
+
+namespace
+{
+    constexpr uint64_t align(uint64_t offset) noexcept
+    {
+        return (offset + 7) & ~uint64_t{ 7 };
+    }
+
+    void check_byte_order()
+    {
+        if constexpr (std::endian::native != std::endian::little) {
+            throw runtime_error{ "Snapshots are only supported on little-endian machines." };
+        }
+    }
+
+    bool synchronize_file(std::FILE* file) noexcept
+    {
+#ifdef _WIN32
+        return _commit(_fileno(file)) == 0;
+#else
+        return fsync(fileno(file)) == 0;
+#endif
+    }
+
+    // Makes a rename into directory survive a crash. NTFS journals it without being asked.
+    void synchronize_directory([[maybe_unused]] const filesystem::path& directory)
+    {
+#ifndef _WIN32
+        const int descriptor = open(directory.c_str(), O_RDONLY);
+        const bool synchronized = descriptor >= 0 && fsync(descriptor) == 0;
+        if (descriptor >= 0) {
+            close(descriptor);
+        }
+        if (!synchronized) {
+            throw runtime_error{ "Cannot synchronize " + directory.string() };
+        }
+#endif
+    }
+}  // namespace
+
+#ifdef _WIN32
+server::MappedFile::MappedFile(const filesystem::path& path)
+{
+    m_file = CreateFileW(
+        path.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr
+    );
+    if (m_file == INVALID_HANDLE_VALUE) {
+        m_file = nullptr;
+        throw runtime_error{ "Cannot open " + path.string() };
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size)) {
+        unmap();
+        throw runtime_error{ "Cannot read the size of " + path.string() };
+    }
+    m_size = static_cast<size_t>(size.QuadPart);
+    if (m_size == 0) {
+        return;
+    }
+
+    m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void* data =
+        m_mapping == nullptr ? nullptr : MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr) {
+        unmap();
+        throw runtime_error{ "Cannot map " + path.string() };
+    }
+    m_data = static_cast<const char*>(data);
+}
+
+void server::MappedFile::unmap() noexcept
+{
+    if (m_data != nullptr) {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping != nullptr) {
+        CloseHandle(m_mapping);
+    }
+    if (m_file != nullptr) {
+        CloseHandle(m_file);
+    }
+}
+#else
+server::MappedFile::MappedFile(const filesystem::path& path)
+{
+    const int descriptor = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (descriptor < 0) {
+        throw runtime_error{ "Cannot open " + path.string() };
+    }
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0) {
+        close(descriptor);
+        throw runtime_error{ "Cannot read the size of " + path.string() };
+    }
+    m_size = static_cast<size_t>(status.st_size);
+    if (m_size != 0) {
+        void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (data == MAP_FAILED) {
+            close(descriptor);
+            throw runtime_error{ "Cannot map " + path.string() };
+        }
+        m_data = static_cast<const char*>(data);
+    }
+
+    // The mapping stays valid without the descriptor
+    close(descriptor);
+}
+
+void server::MappedFile::unmap() noexcept
+{
+    if (m_data != nullptr) {
+        munmap(const_cast<char*>(m_data), m_size);
+    }
+}
+#endif
+
+server::MappedFile::~MappedFile()
+{
+    unmap();
+}
+
+void server::Snapshot::write(const Folder& root, const filesystem::path& path)
+{
+    LOCAL_HELPER_TRACE("Snapshot::write");
+    check_byte_order();
+
+    vector<Node> nodes{ Node{ Node::folder, 0, 0, 0, 0 } };
+    vector<const FileBase*> files{ &root };
+    string strings;
+    uint64_t content_size = 0;
+    for (size_t index = 0; index < files.size(); ++index) {
+        if (nodes[index].kind != Node::folder) {
+            continue;
+        }
+
+        nodes[index].offset = files.size();
+        for (const auto& file : files[index]->to_actually_type<Folder>()) {
+            Node node{ Node::folder, static_cast<std::uint32_t>(file.name().size()),
+                       strings.size(), 0, 0 };
+            strings += file.name();
+            if (file.kind() == FileBase::Kind::file) {
+                const auto size = file.to_actually_type<File>().size();
+                node.kind = Node::file;
+                node.offset = content_size;
+                node.size = size;
+                content_size = align(content_size + size);
+            }
+
+            nodes.push_back(node);
+            files.push_back(&file);
+            ++nodes[index].size;
+        }
+    }
+
+    Header header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.node_size = sizeof(Node);
+    header.node_count = nodes.size();
+    header.node_offset = sizeof(Header);
+    header.string_offset = header.node_offset + nodes.size() * sizeof(Node);
+    header.string_size = strings.size();
+    header.content_offset = align(header.string_offset + strings.size());
+    header.content_size = content_size;
+
+    // Written next to the target, fsynced and renamed over it, so a crash leaves either the old
+    // image or the whole new one
+    auto temporary_path = path;
+    temporary_path += ".tmp";
+    {
+        const std::unique_ptr<std::FILE, int (*)(std::FILE*)> output{
+            std::fopen(temporary_path.string().c_str(), "wb"), &std::fclose
+        };
+        if (output == nullptr) {
+            throw runtime_error{ "Cannot open " + temporary_path.string() };
+        }
+
+        bool written = true;
+        const auto write = [&output, &written](const void* data, size_t size) {
+            written = written && std::fwrite(data, 1, size, output.get()) == size;
+        };
+        const char padding[8] = {};
+        write(&header, sizeof(header));
+        write(nodes.data(), nodes.size() * sizeof(Node));
+        write(strings.data(), strings.size());
+        write(padding, header.content_offset - header.string_offset - strings.size());
+        for (size_t index = 0; index < files.size(); ++index) {
+            if (nodes[index].kind == Node::file) {
+                const File& file = files[index]->to_actually_type<File>();
+                file.for_each_shared_chunk(
+                    0, file.size(), [&write](const shared_ptr<const void>&, string_view piece) {
+                        write(piece.data(), piece.size());
+                    }
+                );
+                write(padding, align(file.size()) - file.size());
+            }
+        }
+
+        if (!written || std::fflush(output.get()) != 0 || !synchronize_file(output.get())) {
+            throw runtime_error{ "Cannot write " + temporary_path.string() };
+        }
+    }
+    filesystem::rename(temporary_path, path);
+    synchronize_directory(path.has_parent_path() ? path.parent_path() : filesystem::path{ "." });
+}
+
+server::Snapshot::Snapshot(const filesystem::path& path)
+{
+    check_byte_order();
+
+    m_file = std::make_shared<const MappedFile>(path);
+    const string_view data = m_file->data();
+    if (data.size() < sizeof(Header)) {
+        throw runtime_error{ "The snapshot is truncated." };
+    }
+
+    m_header = reinterpret_cast<const Header*>(data.data());
+    if (memcmp(m_header->magic, magic, sizeof(magic)) != 0) {
+        throw runtime_error{ "The file is not a snapshot." };
+    }
+    if (m_header->version != version || m_header->node_size != sizeof(Node)) {
+        throw runtime_error{ "The snapshot version is not supported." };
+    }
+
+    const auto in_file = [&data](uint64_t offset, uint64_t size) noexcept {
+        return offset <= data.size() && size <= data.size() - offset;
+    };
+    if (m_header->node_offset % alignof(Node) != 0
+        || m_header->node_count > (data.size() - sizeof(Header)) / sizeof(Node)
+        || !in_file(m_header->node_offset, m_header->node_count * sizeof(Node))
+        || !in_file(m_header->string_offset, m_header->string_size)
+        || !in_file(m_header->content_offset, m_header->content_size)) {
+        throw runtime_error{ "The snapshot is truncated." };
+    }
+
+    m_nodes = reinterpret_cast<const Node*>(data.data() + m_header->node_offset);
+    m_strings = data.substr(m_header->string_offset, m_header->string_size);
+    m_contents = data.substr(m_header->content_offset, m_header->content_size);
+    validate();
+}
+
+void server::Snapshot::validate() const
+{
+    const uint64_t node_count = m_header->node_count;
+    if (node_count == 0 || m_nodes[0].kind != Node::folder) {
+        throw runtime_error{ "The snapshot has no root folder." };
+    }
+
+    // Breadth-first order: the children of every folder follow those of the previous one
+    uint64_t next_child = 1;
+    for (uint64_t index = 0; index < node_count; ++index) {
+        const Node& node = m_nodes[index];
+        const bool valid_name = node.name_offset <= m_strings.size()
+                                && node.name_size <= m_strings.size() - node.name_offset;
+        bool valid_node = false;
+        if (node.kind == Node::file) {
+            valid_node = node.offset <= m_contents.size()
+                         && node.size <= m_contents.size() - node.offset;
+        } else if (node.kind == Node::folder) {
+            valid_node = node.offset == next_child && node.size <= node_count - next_child;
+            next_child += valid_node ? node.size : 0;
+        }
+
+        if (!valid_name || !valid_node) {
+            throw runtime_error{ "The snapshot is corrupted." };
+        }
+    }
+
+    if (next_child != node_count) {
+        throw runtime_error{ "The snapshot is corrupted." };
+    }
+}
+
+void server::Snapshot::materialize(Folder& folder) const
+{
+    LOCAL_HELPER_TRACE("Snapshot::materialize");
+    using HowToHandle = Folder::HowToHandleFilesWithTheSameName;
+
+    vector<pair<uint64_t, Folder*>> unvisited_folders{ { 0, &folder } };
+    while (!unvisited_folders.empty()) {
+        const auto [index, now] = unvisited_folders.back();
+        unvisited_folders.pop_back();
+        const Node& node = m_nodes[index];
+        for (uint64_t child = node.offset; child < node.offset + node.size; ++child) {
+            const Node& child_node = m_nodes[child];
+            const auto name = m_strings.substr(child_node.name_offset, child_node.name_size);
+            if (name.empty() || name.find('/') != string_view::npos) {
+                throw runtime_error{ "The snapshot is corrupted." };
+            }
+
+            if (child_node.kind == Node::file) {
+                const auto content = m_contents.substr(child_node.offset, child_node.size);
+                now->add(File{ name, m_file, content }, HowToHandle::throw_exception);
+            } else {
+                Folder& added_folder = now->add(Folder{ name }, HowToHandle::throw_exception);
+                unvisited_folders.emplace_back(child, &added_folder);
+            }
+        }
+    }
+}
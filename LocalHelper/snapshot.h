@@ -0,0 +1,101 @@
+#pragma once
+#ifndef SNAPSHOT_H_
+#  define SNAPSHOT_H_
+#  include <cstddef>
+#  include <cstdint>
+
+#  include <filesystem>
+#  include <memory>
+#  include <string_view>
+
+namespace server
+{
+    class Folder;
+
+    // Read-only view of a whole file mapped into memory
+    class MappedFile
+    {
+    public:
+        explicit MappedFile(const std::filesystem::path& path);
+        MappedFile(const MappedFile&) = delete;
+        ~MappedFile();
+
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        inline std::string_view data() const noexcept;
+    private:
+        void unmap() noexcept;
+
+        const char* m_data = nullptr;
+        std::size_t m_size = 0;
+#  ifdef _WIN32
+        void* m_file = nullptr;
+        void* m_mapping = nullptr;
+#  endif
+    };
+
+    // Versioned binary image of a folder tree: a header, a flat node table in breadth-first
+    // order so that the children of a folder are contiguous, a string pool with the names and
+    // the contents, each starting at a multiple of 8 bytes. Integers are little-endian.
+    class Snapshot
+    {
+    public:
+        static constexpr std::uint32_t version = 1;
+
+        struct Header
+        {
+            char magic[8];
+            std::uint32_t version;
+            // sizeof(Node) of the writer
+            std::uint32_t node_size;
+            std::uint64_t node_count;
+            std::uint64_t node_offset;
+            std::uint64_t string_offset;
+            std::uint64_t string_size;
+            std::uint64_t content_offset;
+            std::uint64_t content_size;
+        };
+
+        struct Node
+        {
+            enum Kind : std::uint32_t
+            {
+                file,
+                folder
+            };
+
+            Kind kind;
+            std::uint32_t name_size;
+            std::uint64_t name_offset;
+            // Offset of the content for a file, index of the first child for a folder
+            std::uint64_t offset;
+            // Size of the content for a file, number of children for a folder
+            std::uint64_t size;
+        };
+
+        // The image is on the disk once it returns
+        static void write(const Folder& root, const std::filesystem::path& path);
+
+        // Maps and validates the image
+        explicit Snapshot(const std::filesystem::path& path);
+
+        // Adds the tree of the image to folder, the contents stay in the mapping until changed
+        void materialize(Folder& folder) const;
+    private:
+        static constexpr char magic[8] = { 'L', 'H', 'S', 'N', 'A', 'P', '\0', '\0' };
+
+        void validate() const;
+
+        std::shared_ptr<const MappedFile> m_file;
+        const Header* m_header;
+        const Node* m_nodes;
+        std::string_view m_strings;
+        std::string_view m_contents;
+    };
+
+    inline std::string_view MappedFile::data() const noexcept
+    {
+        return { m_data, m_size };
+    }
+}  // namespace server
+#endif  // !SNAPSHOT_H_
@@ -0,0 +1,109 @@
+#pragma once
+#ifndef STATIC_PATH_H_
+#  define STATIC_PATH_H_
+#  include <cstddef>
+#  include <cstdint>
+
+#  include <algorithm>
+#  include <array>
+#  include <string_view>
+
+namespace server
+{
+    // A string literal passed as template argument
+    template <std::size_t Size>
+    struct PathLiteral
+    {
+        consteval PathLiteral(const char (&path)[Size]) noexcept
+        {
+            std::copy_n(path, Size, value);
+        }
+
+        char value[Size];
+    };
+
+    // A step of a path walk, . and empty components need none
+    struct PathComponent
+    {
+        enum class Kind : std::uint8_t
+        {
+            root,
+            parent,
+            child
+        };
+
+        Kind kind;
+        std::string_view name;
+    };
+
+    // A path split into its components at compile time, so the FileSystem members taking it walk
+    // the tree without parsing the path or allocating. As with std::filesystem::path, the
+    // filename is what follows the last /.
+    template <PathLiteral Path>
+    class StaticPath
+    {
+    public:
+        static constexpr std::string_view string{ Path.value, sizeof(Path.value) - 1 };
+    private:
+        // By hand, as GCC 12 rejects find in constant expressions over a template argument
+        static constexpr std::size_t find_separator(std::string_view part, std::size_t begin)
+        {
+            for (; begin < part.size() && part[begin] != '/'; ++begin) {}
+            return begin;
+        }
+
+        static constexpr std::size_t filename_begin()
+        {
+            auto begin = string.size();
+            for (; begin > 0 && string[begin - 1] != '/'; --begin) {}
+            return begin;
+        }
+
+        // Calls add for every step of walking part
+        template <typename Function>
+        static constexpr void split(std::string_view part, Function&& add)
+        {
+            if (!part.empty() && part[0] == '/') {
+                add(PathComponent{ PathComponent::Kind::root, {} });
+            }
+            for (std::size_t begin = 0; begin < part.size();) {
+                const auto end = find_separator(part, begin);
+                const auto name = part.substr(begin, end - begin);
+                if (name == "..") {
+                    add(PathComponent{ PathComponent::Kind::parent, name });
+                } else if (!name.empty() && name != ".") {
+                    add(PathComponent{ PathComponent::Kind::child, name });
+                }
+                begin = end + 1;
+            }
+        }
+
+        static constexpr std::size_t count(std::string_view part)
+        {
+            std::size_t count = 0;
+            split(part, [&count](const PathComponent&) { ++count; });
+            return count;
+        }
+
+        template <std::size_t Size>
+        static constexpr std::array<PathComponent, Size> split(std::string_view part)
+        {
+            std::array<PathComponent, Size> components{};
+            std::size_t i = 0;
+            split(part, [&](const PathComponent& component) { components[i++] = component; });
+            return components;
+        }
+
+        static constexpr std::string_view parent_part = string.substr(0, filename_begin());
+    public:
+        static constexpr std::string_view filename = string.substr(filename_begin());
+        // The steps to the folder at the path and to the folder holding filename
+        static constexpr auto components = split<count(string)>(string);
+        static constexpr auto parent_components = split<count(parent_part)>(parent_part);
+    };
+
+    // E.g. file_system.get_folder(static_path<"../folder">)
+    template <PathLiteral Path>
+    inline constexpr StaticPath<Path> static_path{};
+}  // namespace server
+#endif  // !STATIC_PATH_H_
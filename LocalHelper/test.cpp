@@ -1,21 +1,1253 @@
 #include <concepts>
 
-#include <format>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <span>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include "blob_store.h"
+#include "client.h"
 #include "filesystem.h"
+#include "glob.h"
+#include "protocol.h"
+#include "server.h"
+#include "snapshot.h"
+#include "static_path.h"
 using namespace std;
 using namespace server;
 
+// Runs every test and reports the failed ones, so the exit code is that of all of them
+namespace
+{
+    constexpr auto throw_exception = Folder::HowToHandleFilesWithTheSameName::throw_exception;
+    constexpr auto overwrite = Folder::HowToHandleFilesWithTheSameName::overwrite;
+
+    // Unlike assert, also checks in release builds
+    void check(bool condition, const string& what)
+    {
+        if (!condition) {
+            throw logic_error{ what };
+        }
+    }
+
+    template <typename Exception, typename Function>
+    void check_throws(Function&& function, const string& what)
+    {
+        try {
+            function();
+        } catch (const Exception&) {
+            return;
+        }
+        throw logic_error{ what + " did not throw" };
+    }
+
+    // The names of the children of folder in order
+    string names_of(const Folder& folder)
+    {
+        string names;
+        for (const auto& file : folder) {
+            names += names.empty() ? "" : " ";
+            names += file.name();
+        }
+        return names;
+    }
+
+    // The totals of folder counted by walking it
+    Folder::Totals walk(const Folder& folder)
+    {
+        Folder::Totals totals;
+        for (const auto& file : folder) {
+            if (file.kind() == FileBase::Kind::file) {
+                totals.size += file.to_actually_type<File>().size();
+                ++totals.file_count;
+            } else {
+                const auto below = walk(file.to_actually_type<Folder>());
+                totals.size += below.size;
+                totals.file_count += below.file_count;
+                totals.folder_count += below.folder_count + 1;
+            }
+        }
+        return totals;
+    }
+
+    void check_totals(const Folder& folder, const string& what)
+    {
+        const auto totals = folder.totals();
+        const auto walked = walk(folder);
+        check(
+            totals.size == walked.size && totals.file_count == walked.file_count
+                && totals.folder_count == walked.folder_count,
+            what + ": totals " + to_string(totals.size) + " " + to_string(totals.file_count) + " "
+                + to_string(totals.folder_count) + " instead of " + to_string(walked.size) + " "
+                + to_string(walked.file_count) + " " + to_string(walked.folder_count)
+        );
+    }
+
+    void create_relative_to_working_directory()
+    {
+        FileSystem fs;
+        fs.create(File{ "file1", "file1" });
+        fs.create(Folder{ "folder1" });
+        fs.change_directory("folder1");
+        fs.create(File{ "file2", "file2" });
+        fs.create(File{ "file3", "file3" }, "..");
+
+        check(names_of(fs.get_folder("/")) == "file1 file3 folder1", "children of /");
+        check(fs.get_file("/folder1/file2").content() == "file2", "content of file2");
+    }
+
+    void apply_rolls_back_a_failed_batch()
+    {
+        for (const auto synchronization :
+             { FileSystem::Synchronization::none, FileSystem::Synchronization::lock_free_reads }) {
+            FileSystem fs{ synchronization };
+            fs.create(File{ "file1", "file1" });
+            fs.create(Folder{ "folder1" });
+            fs.create(File{ "file2", "file2" }, "/folder1");
+            fs.create(Folder{ "ingest" });
+            fs.create(File{ "f1", "f1" }, "/ingest");
+            const auto totals = fs.get_folder("/").totals();
+
+            // Every kind of change comes before the duplicate name that fails the batch
+            FileSystem::Batch batch;
+            batch.remove("/ingest/f1");
+            batch.create(File{ "new", "new" }, "/ingest");
+            batch.create(File{ "file1", "overwritten" }, "/", overwrite);
+            batch.remove("/folder1");
+            batch.create(File{ "file2", "file2" }, "/ingest");
+            batch.create(File{ "file1", "duplicate" }, "/");
+            check_throws<runtime_error>([&] { fs.apply(batch); }, "a batch with a duplicate");
+
+            check(names_of(fs.get_folder("/")) == "file1 folder1 ingest", "children of / restored");
+            check(names_of(fs.get_folder("/ingest")) == "f1", "children of /ingest restored");
+            check(fs.get_file("/file1").content() == "file1", "overwritten file restored");
+            check(fs.get_file("/folder1/file2").content() == "file2", "removed folder restored");
+            check(fs.search_file("f1").size() == 1, "removed file indexed again");
+            check(fs.search_file("new").empty(), "added file no longer indexed");
+            check(fs.search_file("file2").size() == 1, "second file2 no longer indexed");
+            const auto restored = fs.get_folder("/").totals();
+            check(
+                restored.size == totals.size && restored.file_count == totals.file_count,
+                "totals restored"
+            );
+            check_totals(fs.get_folder("/"), "after the rollback");
+
+            // A missing folder fails the batch before anything changes
+            FileSystem::Batch missing_folder;
+            missing_folder.remove("/file1");
+            missing_folder.create(File{ "file", "" }, "/missing");
+            check_throws<runtime_error>(
+                [&] { fs.apply(missing_folder); }, "a batch into a missing folder"
+            );
+            check(fs.get_folder("/").has_file("file1"), "file1 kept");
+        }
+    }
+
+    // A directory of its own below the temporary one, empty at first and removed afterwards
+    class TemporaryDirectory
+    {
+    public:
+        explicit TemporaryDirectory(const string& name)
+            : m_path(filesystem::temp_directory_path() / ("local_helper_" + name))
+        {
+            filesystem::remove_all(m_path);
+            filesystem::create_directories(m_path);
+        }
+
+        ~TemporaryDirectory()
+        {
+            error_code error;
+            filesystem::remove_all(m_path, error);
+        }
+
+        const filesystem::path& path() const noexcept
+        {
+            return m_path;
+        }
+    private:
+        filesystem::path m_path;
+    };
+
+    string read_file(const filesystem::path& path)
+    {
+        ifstream file{ path, ios::binary };
+        return { istreambuf_iterator<char>{ file }, istreambuf_iterator<char>{} };
+    }
+
+    void write_file(const filesystem::path& path, const string& data)
+    {
+        ofstream file{ path, ios::binary | ios::trunc };
+        file.write(data.data(), static_cast<streamsize>(data.size()));
+    }
+
+    // Every path below folder with the content of the files, one per line
+    string contents_of(const Folder& folder, const string& path = "")
+    {
+        string contents;
+        for (const auto& file : folder) {
+            const auto file_path = path + "/" + string{ file.name() };
+            contents += file_path;
+            if (file.kind() == FileBase::Kind::file) {
+                contents += " ";
+                contents += file.to_actually_type<File>().content();
+                contents += "\n";
+            } else {
+                contents += "\n" + contents_of(file.to_actually_type<Folder>(), file_path);
+            }
+        }
+        return contents;
+    }
+
+    void snapshot_round_trip()
+    {
+        const TemporaryDirectory directory{ "snapshot" };
+        const auto path = directory.path() / "snapshot.img";
+
+        FileSystem fs;
+        fs.create(Folder{ "a" });
+        fs.create(Folder{ "b" }, "/a");
+        fs.create(Folder{ "empty" });
+        fs.create(File{ "x", "hello" }, "/a/b");
+        fs.create(File{ "empty_file", "" }, "/a");
+        fs.create(File{ "big", string(ChunkedContent::chunk_size + 3, 'q') }, "/");
+        fs.get_file("/big").write(ChunkedContent::chunk_size - 1, "ab");
+        fs.save_snapshot(path);
+
+        FileSystem loaded;
+        loaded.create(File{ "old", "old" });
+        loaded.load_snapshot(path);
+        check(names_of(loaded.get_folder("/")) == "a big empty", "children of / loaded");
+        check(names_of(loaded.get_folder("/a")) == "b empty_file", "children of /a loaded");
+        check(loaded.get_file("/a/b/x").content() == "hello", "content of x loaded");
+        check(loaded.get_file("/a/empty_file").content().empty(), "empty file loaded");
+        check(loaded.get_file("/big").content() == fs.get_file("/big").content(), "chunked file");
+        check(loaded.search_file("x").size() == 1 && loaded.search_file("old").empty(), "index");
+        check_totals(loaded.get_folder("/"), "after loading");
+
+        // Contents read from the mapping can still be changed
+        loaded.change_content("/a/b/x", "world");
+        check(loaded.get_file("/a/b/x").content() == "world", "changed after loading");
+    }
+
+    void snapshot_rejects_corrupt_images()
+    {
+        const TemporaryDirectory directory{ "corrupt_snapshot" };
+        const auto path = directory.path() / "snapshot.img";
+
+        FileSystem fs;
+        fs.create(Folder{ "a" });
+        fs.create(File{ "x", "hello" }, "/a");
+        fs.save_snapshot(path);
+        const string image = read_file(path);
+        Snapshot::Header header;
+        memcpy(&header, image.data(), sizeof(header));
+
+        const auto check_rejected = [&](const string& corrupt, const string& what) {
+            write_file(path, corrupt);
+            FileSystem loaded;
+            loaded.create(File{ "kept", "kept" });
+            check_throws<runtime_error>([&] { loaded.load_snapshot(path); }, what);
+            check(loaded.get_folder("/").has_file("kept"), what + " left the tree alone");
+        };
+
+        check_rejected(image.substr(0, sizeof(header) - 1), "a truncated header");
+        check_rejected(image.substr(0, image.size() - 1), "a truncated image");
+        check_rejected("X" + image.substr(1), "a wrong magic");
+
+        const auto with_header = [&image](const Snapshot::Header& changed) {
+            string corrupt = image;
+            memcpy(corrupt.data(), &changed, sizeof(changed));
+            return corrupt;
+        };
+
+        auto changed = header;
+        ++changed.version;
+        check_rejected(with_header(changed), "another version");
+        changed = header;
+        changed.node_count = ~uint64_t{ 0 } / sizeof(Snapshot::Node);
+        check_rejected(with_header(changed), "too many nodes");
+        changed = header;
+        changed.string_size += image.size();
+        check_rejected(with_header(changed), "strings beyond the end");
+
+        const auto with_node = [&](uint64_t index, const function<void(Snapshot::Node&)>& change) {
+            string corrupt = image;
+            Snapshot::Node node;
+            const auto offset = header.node_offset + index * sizeof(node);
+            memcpy(&node, corrupt.data() + offset, sizeof(node));
+            change(node);
+            memcpy(corrupt.data() + offset, &node, sizeof(node));
+            return corrupt;
+        };
+
+        // The nodes are the root, a and x
+        check_rejected(
+            with_node(0, [](Snapshot::Node& node) { node.kind = Snapshot::Node::file; }),
+            "a root file"
+        );
+        check_rejected(with_node(0, [](Snapshot::Node& node) { ++node.size; }), "extra children");
+        check_rejected(
+            with_node(1, [](Snapshot::Node& node) { node.offset = 0; }), "a folder holding the root"
+        );
+        check_rejected(
+            with_node(2, [&](Snapshot::Node& node) { node.size = header.content_size + 1; }),
+            "a content beyond the end"
+        );
+        check_rejected(with_node(2, [](Snapshot::Node& node) { node.name_size = 0; }), "no name");
+    }
+
+    void log_replays_up_to_a_torn_tail()
+    {
+        const TemporaryDirectory directory{ "wal" };
+        {
+            FileSystem fs;
+            fs.open_log(directory.path(), { WriteAheadLog::Durability::every_commit });
+            fs.create(Folder{ "a" });
+            fs.create(File{ "x", "hello" }, "/a");
+            fs.rename("/a/x", "y");
+            fs.create(File{ "last", "last" });
+        }
+
+        // Cut the last record short as a crash during its write would
+        filesystem::path last_segment;
+        for (const auto& entry : filesystem::directory_iterator{ directory.path() }) {
+            const auto name = entry.path().filename().string();
+            if (name.starts_with("wal.") && filesystem::file_size(entry.path()) != 0) {
+                last_segment = max(last_segment, entry.path());
+            }
+        }
+        check(!last_segment.empty(), "a log segment was written");
+        filesystem::resize_file(last_segment, filesystem::file_size(last_segment) - 1);
+
+        {
+            FileSystem fs;
+            fs.open_log(directory.path());
+            check(fs.get_file("/a/y").content() == "hello", "records before the torn one");
+            check(!fs.get_folder("/").has_file("last"), "the torn record is dropped");
+            fs.create(File{ "after", "after" });
+        }
+
+        // Records written after replaying a torn tail are not hidden behind it
+        FileSystem fs;
+        fs.open_log(directory.path());
+        check(fs.get_file("/a/y").content() == "hello", "records before the torn one again");
+        check(!fs.get_folder("/").has_file("last"), "the torn record stays dropped");
+        check(fs.get_file("/after").content() == "after", "the record after the torn one");
+
+        check_throws<logic_error>([] { FileSystem{}.checkpoint(); }, "a checkpoint without a log");
+    }
+
+    void log_follows_folder_and_file_changes()
+    {
+        const TemporaryDirectory directory{ "wal_layers" };
+        string expected;
+        {
+            FileSystem fs{ FileSystem::Synchronization::lock_free_reads };
+            fs.open_log(directory.path());
+            Folder& root = fs.get_folder("/");
+
+            // A logged create into a folder which only Folder::add made
+            Folder& a = root.add(Folder{ "a" }, throw_exception);
+            fs.create(File{ "x", "hello" }, "/a");
+            File& x = fs.get_file("/a/x");
+            x.append(" world");
+            x.write(0, "J");
+            x.truncate(9);
+            x.rename("y");
+            a.add(File{ "z", "zz" }, throw_exception);
+            a.add(File{ "z", "replaced" }, overwrite);
+            a.add(Folder{ "b" }, throw_exception);
+            a.remove("b");
+            fs.get_file("/a/z").change_content("changed");
+
+            Folder copy{ "copy" };
+            copy.add(File{ "c", "c" }, throw_exception);
+            root.add(copy, throw_exception);
+            fs.get_file("/copy/c") = File{ "ignored", "assigned" };
+            root.add(Folder{ "target" }, throw_exception);
+            fs.get_folder("/target") = fs.get_folder("/copy");
+            fs.get_folder("/copy") = move(fs.get_folder("/a"));
+
+            fs.concurrent_add(File{ "w", "w" }, "/target", throw_exception);
+            fs.concurrent_add(File{ "v", "v" }, "/target", throw_exception);
+            fs.concurrent_remove("/target/v");
+
+            // Moves logged after the working directory moved away from its lexical path
+            fs.create(Folder{ "m" }, "/");
+            fs.create(Folder{ "n" }, "/m");
+            fs.change_directory("/m/n");
+            fs.create(File{ "f", "f" });
+            fs.move_file("/m", "/target/m");
+            fs.move_file("f", "../g");
+            FileSystem::Batch batch;
+            batch.create(File{ "h", "h" }, ".", throw_exception);
+            batch.create(File{ "i", "i" }, "..", throw_exception);
+            fs.apply(move(batch));
+            expected = contents_of(root);
+        }
+
+        FileSystem fs;
+        fs.open_log(directory.path());
+        check(contents_of(fs.get_folder("/")) == expected, "the changes replayed");
+        check(names_of(fs.get_folder("/a")).empty(), "the folder moved from stays empty");
+        check(fs.get_file("/copy/y").content() == "Jello wor", "the edits of y replayed");
+        check(fs.get_file("/target/m/n/h").content() == "h", "a batch in the working directory");
+        check(fs.get_file("/target/m/i").content() == "i", "a batch above the working directory");
+        check(fs.get_file("/target/m/g").content() == "f", "the move below the working directory");
+        check_totals(fs.get_folder("/"), "after the replay");
+    }
+
+    // Runs function on a thread of its own, run_threads rethrows the first exception of any
+    void run_threads(vector<function<void()>> functions)
+    {
+        vector<exception_ptr> errors(functions.size());
+        vector<thread> threads;
+        for (size_t index = 0; index < functions.size(); ++index) {
+            threads.emplace_back([&functions, &errors, index] {
+                try {
+                    functions[index]();
+                } catch (...) {
+                    errors[index] = current_exception();
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        for (const auto& error : errors) {
+            if (error) {
+                rethrow_exception(error);
+            }
+        }
+    }
+
+    void lock_free_readers_beside_writers()
+    {
+        constexpr int kept_count = 8;
+        constexpr int writer_count = 2;
+        constexpr int reader_count = 3;
+        constexpr int round_count = 2000;
+
+        FileSystem fs{ FileSystem::Synchronization::lock_free_reads };
+        fs.create(Folder{ "a" });
+        for (int index = 0; index < kept_count; ++index) {
+            fs.create(File{ "kept" + to_string(index), "kept" }, "/a");
+        }
+
+        // Writers add, overwrite and remove files and folders beside the kept files, so the
+        // child table of /a is replaced and the old ones retired while readers are in it
+        atomic<int> running_writers = writer_count;
+        vector<function<void()>> threads;
+        for (int writer = 0; writer < writer_count; ++writer) {
+            threads.emplace_back([&fs, &running_writers, writer] {
+                const auto prefix = "w" + to_string(writer) + "_";
+                for (int round = 0; round < round_count; ++round) {
+                    const auto name = prefix + to_string(round % 8);
+                    fs.concurrent_add(File{ name, string(round % 64, 'x') }, "/a", overwrite);
+                    if (round % 2 != 0) {
+                        fs.concurrent_remove("/a/" + name);
+                    }
+                    fs.concurrent_add(Folder{ prefix + "folder" }, "/a", overwrite);
+                    fs.concurrent_add(File{ "f", "f" }, "/a/" + prefix + "folder", overwrite);
+                }
+                --running_writers;
+            });
+        }
+        for (int reader = 0; reader < reader_count; ++reader) {
+            threads.emplace_back([&fs, &running_writers] {
+                do {
+                    int kept = 0;
+                    fs.lock_free_visit_folder("/a", [&kept](const FileBase& file) {
+                        kept += file.name().starts_with("kept") ? 1 : 0;
+                    });
+                    check(kept == kept_count, "every kept file seen without locks");
+                    fs.lock_free_visit_file("/a/kept0", [](const File& file) {
+                        check(file.content() == "kept", "a kept file read without locks");
+                    });
+                    fs.lock_free_list_folder("/a", "", 4, [](const Folder::Page& page) {
+                        check(page.files.size() == 4, "a page read without locks");
+                    });
+                    fs.concurrent_visit_file("/a/kept1", [](const File& file) {
+                        check(file.content() == "kept", "a kept file read under a lock");
+                    });
+                    check(fs.concurrent_search_file("kept2").size() == 1, "a kept file found");
+                } while (running_writers != 0);
+            });
+        }
+        run_threads(move(threads));
+
+        check(
+            fs.get_folder("/a").totals().file_count == kept_count + 4 * writer_count + 2,
+            "the files left by the writers"
+        );
+        check_totals(fs.get_folder("/"), "after the writers");
+    }
+
+    void chunked_edits_at_chunk_boundaries()
+    {
+        constexpr auto chunk_size = ChunkedContent::chunk_size;
+        string expected(2 * chunk_size + 10, 'a');
+        for (size_t index = 0; index < expected.size(); ++index) {
+            expected[index] = static_cast<char>('a' + index % 26);
+        }
+
+        FileSystem fs;
+        fs.create(File{ "file", expected });
+        File& file = fs.get_file("/file");
+        const File copy = file;
+
+        const auto check_content = [&](const string& what) {
+            check(file.size() == expected.size(), what + ": size");
+            check(file.content() == expected, what + ": content");
+            string pieces;
+            file.for_each_chunk([&pieces](string_view piece) { pieces += piece; });
+            check(pieces == expected, what + ": chunks");
+            string read(chunk_size + 2, '\0');
+            const auto offset = min(chunk_size - 1, expected.size());
+            read.resize(file.read(read, offset));
+            check(read == expected.substr(offset, chunk_size + 2), what + ": read");
+            check_totals(fs.get_folder("/"), what);
+        };
+
+        // Ending at a boundary, starting at one and spanning one
+        file.write(chunk_size - 2, "XY");
+        expected.replace(chunk_size - 2, 2, "XY");
+        check_content("a write up to a boundary");
+        file.write(chunk_size, "Z");
+        expected.replace(chunk_size, 1, "Z");
+        check_content("a write from a boundary");
+        file.write(2 * chunk_size - 1, "123");
+        expected.replace(2 * chunk_size - 1, 3, "123");
+        check_content("a write across a boundary");
+
+        // Filling the last chunk exactly, then starting a new one
+        const string filler(chunk_size - 10, 'f');
+        file.append(filler);
+        expected += filler;
+        check_content("an append to a boundary");
+        file.append("g");
+        expected += "g";
+        check_content("an append past a boundary");
+
+        file.truncate(2 * chunk_size);
+        expected.resize(2 * chunk_size);
+        check_content("a truncation to a boundary");
+        file.truncate(chunk_size + 1);
+        expected.resize(chunk_size + 1);
+        check_content("a truncation past a boundary");
+        file.truncate(chunk_size + 5);
+        expected.resize(chunk_size + 5);
+        check_content("an extension");
+        file.write(chunk_size * 2 + 3, "end");
+        expected.resize(chunk_size * 2 + 3);
+        expected += "end";
+        check_content("a write beyond the end");
+        file.truncate(0);
+        expected.clear();
+        check_content("a truncation to nothing");
+
+        check(copy.size() == 2 * chunk_size + 10 && copy.content()[chunk_size - 2] != 'X', "copy");
+    }
+
+    void list_resumes_across_changes()
+    {
+        FileSystem fs;
+        fs.create(Folder{ "a" });
+        for (const auto* name : { "b", "d", "f", "h", "j", "l" }) {
+            fs.create(File{ name, "" }, "/a");
+        }
+        Folder& folder = fs.get_folder("/a");
+
+        const auto names_on = [](const Folder::Page& page) {
+            string names;
+            for (const FileBase& file : page.files) {
+                names += file.name();
+            }
+            return names;
+        };
+
+        auto page = as_const(folder).list("", 2);
+        check(names_on(page) == "bd" && page.cursor == "d", "first page");
+
+        // Before the cursor, right after it and removing the cursor itself
+        fs.create(File{ "c", "" }, "/a");
+        fs.create(File{ "e", "" }, "/a");
+        fs.remove("/a/d");
+        page = as_const(folder).list(page.cursor, 2);
+        check(names_on(page) == "ef" && page.cursor == "f", "page after changes");
+
+        fs.remove("/a/h");
+        fs.remove("/a/j");
+        page = as_const(folder).list(page.cursor, 2);
+        check(names_on(page) == "l" && page.cursor.empty(), "last page");
+
+        page = as_const(folder).list("e", 1);
+        check(names_on(page) == "f" && page.cursor == "f", "a full page before the end");
+        page = as_const(folder).list("l", 1);
+        check(page.files.empty() && page.cursor.empty(), "a page after the end");
+        page = as_const(folder).list("", 0);
+        check(page.files.empty() && page.cursor.empty(), "a zero limit");
+    }
+
+    void totals_follow_every_change()
+    {
+        FileSystem fs;
+        const Folder& root = fs.get_folder("/");
+        fs.create(Folder{ "a" });
+        fs.create(Folder{ "b" }, "/a");
+        fs.create(File{ "x", "12345" }, "/a/b");
+        fs.create(File{ "y", "12" }, "/a");
+        check_totals(root, "after adding");
+        check(root.totals().size == 7 && root.totals().folder_count == 2, "root after adding");
+
+        fs.create(Folder{ "c" });
+        fs.move_file("/a/b", "/c/b");
+        check_totals(root, "after moving");
+        check_totals(fs.get_folder("/a"), "of the source after moving");
+        check(fs.get_folder("/c").totals().size == 5, "destination after moving");
+
+        fs.change_content("/c/b/x", "123");
+        fs.get_file("/a/y").append("345");
+        check_totals(root, "after changing contents");
+        check(fs.get_folder("/c").totals().size == 3, "destination after changing");
+
+        FileSystem::Batch batch;
+        batch.create(File{ "y", string(10, 'y') }, "/a", overwrite);
+        fs.apply(move(batch));
+        check_totals(root, "after overwriting");
+        fs.remove("/c/b");
+        check_totals(root, "after removing");
+        check(fs.get_folder("/c").totals().file_count == 0, "destination after removing");
+        check(root.totals().size == 10 && root.totals().file_count == 1, "root after removing");
+    }
+
+    void move_file_keeps_the_index()
+    {
+        FileSystem fs;
+        fs.create(Folder{ "a" });
+        fs.create(Folder{ "b" }, "/a");
+        fs.create(File{ "x", "x" }, "/a/b");
+        fs.create(Folder{ "c" });
+
+        check_throws<runtime_error>([&] { fs.move_file("/a", "/a/b/a"); }, "a move into itself");
+        check_throws<runtime_error>([&] { fs.move_file("/a", "/a/a"); }, "a move into itself");
+        check_throws<invalid_argument>([&] { fs.move_file("/a/z", "/c/z"); }, "a missing file");
+        check_throws<invalid_argument>([&] { fs.move_file("/a", "/missing/a"); }, "no folder");
+        fs.create(File{ "b", "" }, "/c");
+        check_throws<runtime_error>([&] { fs.move_file("/a/b", "/c/b"); }, "a taken name");
+        check(names_of(fs.get_folder("/a")) == "b" && fs.search_file("x").size() == 1, "unchanged");
+
+        // Within a folder a move is a rename
+        fs.move_file("/a/b/x", "/a/b/renamed");
+        check(names_of(fs.get_folder("/a/b")) == "renamed", "renamed in place");
+        check(fs.search_file("x").empty() && fs.search_file("renamed").size() == 1, "rename");
+
+        fs.move_file("/a/b", "/c/d");
+        check(names_of(fs.get_folder("/a")).empty(), "the source after moving");
+        check(names_of(fs.get_folder("/c")) == "b d", "the destination after moving");
+        const auto found = fs.search_file("renamed");
+        check(found.size() == 1 && found.front().get().absolute_path() == "/c/d/renamed", "path");
+        check(&fs.get_file("/c/d/renamed") == &found.front().get(), "index and tree agree");
+        check_throws<invalid_argument>([&] { fs.get_folder("/a/b"); }, "the old path");
+
+        // Moving the folder holding the working directory keeps it there
+        fs.change_directory("/c/d");
+        fs.move_file("/c/d", "/a/d");
+        check(fs.get_folder(".").has_file("renamed"), "the working directory moves along");
+        fs.remove("/a/d");
+        check(fs.search_file("renamed").empty(), "removed after moving");
+    }
+
+    void assign_a_descendant()
+    {
+        const auto make = [](FileSystem& fs) {
+            fs.create(Folder{ "a" });
+            fs.create(Folder{ "b" }, "/a");
+            fs.create(File{ "x", "x" }, "/a");
+            fs.create(Folder{ "c" }, "/a/b");
+            fs.create(File{ "y", "yy" }, "/a/b");
+            fs.create(File{ "z", "zzz" }, "/a/b/c");
+        };
+
+        {
+            FileSystem fs;
+            make(fs);
+            fs.get_folder("/a") = as_const(fs).get_folder("/a/b");
+            check(names_of(fs.get_folder("/a")) == "c y", "children after copying");
+            check(fs.get_file("/a/c/z").content() == "zzz", "descendants after copying");
+            check(fs.search_file("x").empty() && fs.search_file("z").size() == 1, "index");
+            check_totals(fs.get_folder("/"), "after copying");
+        }
+        {
+            FileSystem fs;
+            make(fs);
+            fs.get_folder("/a") = move(fs.get_folder("/a/b"));
+            check(names_of(fs.get_folder("/a")) == "c y", "children after moving");
+            check(fs.get_file("/a/c/z").content() == "zzz", "descendants after moving");
+            check(fs.search_file("x").empty() && fs.search_file("z").size() == 1, "index");
+            check_totals(fs.get_folder("/"), "after moving");
+        }
+        {
+            // A copy of an ancestor added below it
+            FileSystem fs;
+            make(fs);
+            fs.get_folder("/a/b/c").add(as_const(fs).get_folder("/a"), throw_exception);
+            check(fs.get_file("/a/b/c/a/b/c/z").content() == "zzz", "ancestor copied below");
+            check(names_of(fs.get_folder("/a/b/c/a/b/c")) == "z", "the copy stops at itself");
+            check(fs.search_file("z").size() == 2, "index after copying an ancestor");
+            check_totals(fs.get_folder("/"), "after copying an ancestor");
+        }
+        {
+            Folder folder{ "a" };
+            folder.add(Folder{ "b" }, throw_exception).add(File{ "x", "x" }, throw_exception);
+            folder = as_const(folder);
+            check(names_of(folder) == "b" && folder.get_folder("b").has_file("x"), "self");
+            const Folder copy = folder;
+            folder.get_folder("b") = copy;
+            check(folder.get_folder("b").get_folder("b").has_file("x"), "assigning a copy");
+            check_totals(folder, "after assigning a copy");
+        }
+    }
+
+    void deduplication_shares_blobs()
+    {
+        // The store is shared by the whole process, so only its growth is checked
+        const auto blob_count = BlobStore::blob_count();
+        const auto blob_size = BlobStore::blob_size();
+        const auto check_store = [&](size_t count, size_t size, const string& what) {
+            check(BlobStore::blob_count() == blob_count + count, what + ": blob count");
+            check(BlobStore::blob_size() == blob_size + size, what + ": blob size");
+        };
+        // Longer than what is stored in place and shorter than a chunk
+        const string payload(100, 'p');
+        const string other(60, 'q');
+
+        FileSystem fs;
+        fs.set_deduplication(true);
+        fs.create(Folder{ "a" });
+        fs.create(File{ "x", payload }, "/a");
+        FileSystem::Batch batch;
+        batch.create(File{ "y", payload }, "/a");
+        batch.create(File{ "z", other }, "/a");
+        fs.apply(move(batch));
+        check_store(2, payload.size() + other.size(), "after create and apply");
+        check(
+            fs.get_file("/a/x").content().data() == fs.get_file("/a/y").content().data(),
+            "equal payloads share one blob"
+        );
+
+        fs.change_content("/a/z", payload);
+        check_store(1, payload.size(), "after changing the only holder of a blob");
+        check(
+            fs.get_file("/a/z").content().data() == fs.get_file("/a/x").content().data(),
+            "a changed content shares the blob"
+        );
+
+        fs.remove("/a/x");
+        fs.remove("/a/y");
+        check_store(1, payload.size(), "while a holder is left");
+        fs.remove("/a/z");
+        check_store(0, 0, "after removing the last holder");
+
+        fs.set_deduplication(false);
+        fs.create(File{ "w", payload }, "/a");
+        check_store(0, 0, "without deduplication");
+    }
+
+    void glob_patterns()
+    {
+        check(Glob{ "*.log" }.matches("a.log") && Glob{ "*.log" }.matches(".log"), "star");
+        check(!Glob{ "*.log" }.matches("a.logx") && !Glob{ "*.log" }.matches("alog"), "star");
+        check(Glob{ "a?c" }.matches("abc") && !Glob{ "a?c" }.matches("ac"), "question mark");
+        check(Glob{ "**" }.matches("") && Glob{ "" }.matches("") && !Glob{ "" }.matches("a"), "");
+
+        check(Glob{ "[a-c]x" }.matches("bx") && !Glob{ "[a-c]x" }.matches("dx"), "range");
+        check(!Glob{ "[!a-c]x" }.matches("bx") && Glob{ "[!a-c]x" }.matches("dx"), "negation");
+        check(Glob{ "[ab]" }.matches("b") && !Glob{ "[ab]" }.matches("ab"), "set");
+        check(Glob{ "[]]" }.matches("]") && Glob{ "[!]]" }.matches("a"), "a bracket in a set");
+        check(Glob{ "[*?]" }.matches("*") && !Glob{ "[*?]" }.matches("a"), "specials in a set");
+
+        check(Glob{ "\\*" }.matches("*") && !Glob{ "\\*" }.matches("a"), "escaped star");
+        check(Glob{ "a\\?" }.matches("a?") && !Glob{ "a\\?" }.matches("ab"), "escaped ?");
+        check(Glob{ "\\[a]" }.matches("[a]") && !Glob{ "\\[a]" }.matches("a"), "escaped set");
+        check(Glob{ "\\\\" }.matches("\\"), "escaped backslash");
+
+        // A later star has to take back what an earlier one did not need
+        check(Glob{ "a*b*c" }.matches("aXbYbZc") && !Glob{ "a*b*c" }.matches("aXbYbZ"), "stars");
+        check(Glob{ "*aab" }.matches("aaaab") && !Glob{ "*aab" }.matches("aaaba"), "star retries");
+        check(Glob{ "*a*a*a*b" }.matches(string(50, 'a') + "b"), "many stars");
+        check(!Glob{ "*a*a*a*b" }.matches(string(50, 'a')), "many stars without a match");
+        check(Glob{ "*?" }.matches("a") && !Glob{ "*?" }.matches(""), "star and question mark");
+
+        check(Glob{ "ab*cde?f" }.prefix() == "ab", "prefix");
+        check(Glob{ "ab*cde?f" }.longest_literal() == "cde", "longest literal");
+        check(Glob{ "\\*x*" }.prefix() == "*x", "escaped prefix");
+
+        check_throws<invalid_argument>([] { Glob{ "[ab" }; }, "an unterminated set");
+        check_throws<invalid_argument>([] { Glob{ "a\\" }; }, "a trailing backslash");
+
+        FileSystem fs;
+        fs.create(Folder{ "a" });
+        for (const auto* name : { "x.log", "y.log", "x.txt", "[x]", "*" }) {
+            fs.create(File{ name, "" }, "/a");
+        }
+        check(fs.search_file_matching("*.log").size() == 2, "searching by pattern");
+        check(fs.search_file_matching("x.*").size() == 2, "searching by prefix");
+        check(fs.search_file_matching("\\[x]").size() == 1, "searching an escaped set");
+        check(fs.search_file_matching("\\*").size() == 1, "searching an escaped star");
+        check_throws<invalid_argument>([&] { fs.search_file_matching("[x"); }, "a bad pattern");
+    }
+
+    // What a lookup of path found: its absolute path or why it failed
+    template <typename Found>
+    string outcome_of(const Found& found)
+    {
+        if (!found) {
+            return "error " + to_string(static_cast<int>(found.error()));
+        }
+        return found->get().absolute_path();
+    }
+
+    void path_cache_follows_changes()
+    {
+        FileSystem cached;
+        cached.set_path_cache_capacity(64);
+        FileSystem uncached;
+        uncached.set_path_cache_capacity(0);
+
+        const auto change = [&](const function<void(FileSystem&)>& function) {
+            function(cached);
+            function(uncached);
+        };
+        const auto check_paths = [&](const string& what) {
+            for (const char* path :
+                 { "/a", "/a/b", "/a/b/c", "/a/e", "/a/e/c", "/d", "/d/b", "/d/b/c", "b/c", "e/c",
+                   "./b/../b/c", "..", "../d/b", "missing/..", "file1/..", "b/../file1",
+                   "/a/file1/..", "/a/missing/../b", "x", "e/b", "../x" }) {
+                check(
+                    outcome_of(cached.try_get_folder(path))
+                        == outcome_of(uncached.try_get_folder(path)),
+                    what + ": the folder at " + path
+                );
+                check(
+                    outcome_of(cached.try_get_file(path))
+                        == outcome_of(uncached.try_get_file(path)),
+                    what + ": the file at " + path
+                );
+            }
+        };
+
+        change([](FileSystem& fs) {
+            fs.create(Folder{ "a" });
+            fs.create(Folder{ "b" }, "/a");
+            fs.create(Folder{ "c" }, "/a/b");
+            fs.create(File{ "file1", "file1" }, "/a");
+            fs.create(Folder{ "d" });
+            fs.change_directory("/a");
+        });
+        check_paths("at first");
+        // Paths stepping back over a file or a missing folder fail as when walking them
+        check_throws<runtime_error>([&] { cached.get_folder("file1/.."); }, "a file then ..");
+        check_throws<invalid_argument>([&] { cached.get_folder("missing/.."); }, "missing then ..");
+
+        change([](FileSystem& fs) { fs.remove("/a/b"); });
+        check_paths("after removing a folder");
+        change([](FileSystem& fs) {
+            fs.create(Folder{ "b" }, "/a");
+            fs.create(Folder{ "c" }, "/a/b");
+        });
+        check_paths("after creating it again");
+        change([](FileSystem& fs) { fs.rename("/a/b", "e"); });
+        check_paths("after renaming a folder");
+        change([](FileSystem& fs) { fs.get_folder("/a").add(Folder{ "e" }, overwrite); });
+        check_paths("after overwriting a folder");
+        change([](FileSystem& fs) {
+            fs.create(Folder{ "b" }, "/a");
+            fs.create(Folder{ "c" }, "/a/b");
+        });
+        check_paths("before moving a folder");
+        change([](FileSystem& fs) { fs.move_file("/a/b", "/d/b"); });
+        check_paths("after moving a folder");
+        change([](FileSystem& fs) { fs.move_file("/d/b", "/a/e/b"); });
+        check_paths("after moving it below another");
+
+        // The working directory itself and its ancestors
+        change([](FileSystem& fs) {
+            fs.rename("/a", "f");
+            fs.create(Folder{ "a" }, "/");
+            fs.create(Folder{ "x" }, "/a");
+            fs.create(Folder{ "x" }, "/");
+        });
+        check_paths("after renaming the working directory");
+        check(cached.get_working_directory() == "/f", "the renamed working directory");
+        change([](FileSystem& fs) { fs.move_file("/f", "/d/f"); });
+        check_paths("after moving the working directory");
+        check(cached.get_working_directory() == "/d/f", "the moved working directory");
+        change([](FileSystem& fs) {
+            fs.rename("/d", "g");
+            fs.create(Folder{ "d" }, "/");
+        });
+        check_paths("after renaming an ancestor of the working directory");
+        check(cached.get_working_directory() == "/g/f", "below the renamed ancestor");
+    }
+
+    // What a throwing lookup or create returned: the absolute path of the file or what it threw
+    string outcome_of_call(const function<const FileBase&()>& function)
+    {
+        try {
+            return function().absolute_path();
+        } catch (const invalid_argument&) {
+            return "invalid_argument";
+        } catch (const runtime_error&) {
+            return "runtime_error";
+        }
+    }
+
+    // Compares every member taking a StaticPath with the one taking the same path at run time
+    template <PathLiteral... Paths>
+    void check_static_paths()
+    {
+        const auto make = [](FileSystem& fs) {
+            fs.create(Folder{ "a" });
+            fs.create(Folder{ "b" }, "/a");
+            fs.create(File{ "file1", "file1" }, "/a");
+            fs.change_directory("/a/b");
+        };
+        FileSystem fs;
+        make(fs);
+        FileSystem runtime_fs;
+        make(runtime_fs);
+
+        int created = 0;
+        const auto check_path = [&]<PathLiteral Path>(StaticPath<Path> static_path) {
+            const filesystem::path path{ string{ StaticPath<Path>::string } };
+            const auto what = "the path \"" + path.string() + "\"";
+            check(
+                outcome_of(fs.try_get_file(static_path)) == outcome_of(fs.try_get_file(path)),
+                what + ": try_get_file"
+            );
+            check(
+                outcome_of(fs.try_get_folder(static_path)) == outcome_of(fs.try_get_folder(path)),
+                what + ": try_get_folder"
+            );
+            check(
+                outcome_of(as_const(fs).try_get_file(static_path))
+                    == outcome_of(as_const(fs).try_get_file(path)),
+                what + ": const try_get_file"
+            );
+            check(
+                outcome_of(as_const(fs).try_get_folder(static_path))
+                    == outcome_of(as_const(fs).try_get_folder(path)),
+                what + ": const try_get_folder"
+            );
+            check(
+                outcome_of_call([&]() -> const FileBase& { return fs.get_file(static_path); })
+                    == outcome_of_call([&]() -> const FileBase& { return fs.get_file(path); }),
+                what + ": get_file"
+            );
+            check(
+                outcome_of_call([&]() -> const FileBase& { return fs.get_folder(static_path); })
+                    == outcome_of_call([&]() -> const FileBase& { return fs.get_folder(path); }),
+                what + ": get_folder"
+            );
+            check(
+                outcome_of_call([&]() -> const FileBase& {
+                    return as_const(fs).get_folder(static_path);
+                }) == outcome_of_call([&]() -> const FileBase& {
+                    return as_const(fs).get_folder(path);
+                }),
+                what + ": const get_folder"
+            );
+
+            const auto name = "created" + to_string(created++);
+            check(
+                outcome_of_call([&]() -> const FileBase& {
+                    return fs.create(File{ name, "" }, static_path);
+                }) == outcome_of_call([&]() -> const FileBase& {
+                    return runtime_fs.create(File{ name, "" }, path);
+                }),
+                what + ": create"
+            );
+        };
+        (check_path(static_path<Paths>), ...);
+        check(
+            contents_of(fs.get_folder("/")) == contents_of(runtime_fs.get_folder("/")),
+            "the same files created"
+        );
+    }
+
+    void static_paths_match_runtime_paths()
+    {
+        check_static_paths<
+            "..", ".", "/", "../", "/a", "/a/", "/a/b/..", "/a/./b", "../b/../file1",
+            "/a/file1", "/a/file1/", "/a/file1/..", "/a/file1/x", "missing/..", "/a/missing",
+            "/..", "..//b">();
+    }
+
+    // The bytes of a request frame with the body add writes
+    string request_frame(uint32_t id, const function<void(Protocol::Writer&)>& add)
+    {
+        Protocol::Output output;
+        Protocol::Writer request{ output };
+        const auto mark = request.begin_frame(id);
+        add(request);
+        request.end_frame(mark);
+        string frame;
+        output.for_each_buffer([&frame](string_view data) { frame += data; });
+        return frame;
+    }
+
+    // The next frame from socket without its size, empty once the connection is closed
+    string receive_frame(Socket& socket)
+    {
+        string frame;
+        const auto receive = [&](size_t size) {
+            const auto start = frame.size();
+            frame.resize(start + size);
+            for (size_t received = 0; received < size;) {
+                const auto count = socket.receive_some(span{ frame }.subspan(start + received));
+                if (count == 0) {
+                    return false;
+                }
+                received += count;
+            }
+            return true;
+        };
+
+        if (!receive(sizeof(uint32_t))) {
+            return {};
+        }
+        const auto size = Protocol::Reader{ frame }.read_integer();
+        frame.clear();
+        if (!receive(size)) {
+            return {};
+        }
+        return frame;
+    }
+
+    // The status of a response body read by response, which is left at the results
+    Protocol::Status read_status(Protocol::Reader& response)
+    {
+        return static_cast<Protocol::Status>(response.read_byte());
+    }
+
+    void add_get(Protocol::Writer& request, string_view path)
+    {
+        request.add_byte(static_cast<uint8_t>(Protocol::Opcode::get)).add_string(path);
+    }
+
+    void server_answers_a_client()
+    {
+        FileSystem fs{ FileSystem::Synchronization::per_folder_locks };
+        fs.create(Folder{ "a" });
+        fs.create(File{ "x", "hello" }, "/a");
+        Server server{ fs, { .port = 0, .thread_count = 2 } };
+        server.start();
+        Client client{ "127.0.0.1", server.port() };
+
+        check(client.get("/a/x") == "hello", "get");
+        client.create("/a", Protocol::Kind::file, "y", "world", false);
+        client.create("/a", Protocol::Kind::folder, "b", "", false);
+        check(fs.get_file("/a/y").content() == "world", "a created file");
+        check(fs.get_folder("/").get_folder("a").has_file("b"), "a created folder");
+        client.create("/a", Protocol::Kind::file, "y", "again", true);
+        check(client.get("/a/y") == "again", "an overwritten file");
+        check(client.search("y") == vector<string>{ "/a/y" }, "search");
+        check(client.search("missing").empty(), "a search without results");
+
+        const auto stat = client.stat("/a/x");
+        check(stat.kind == Protocol::Kind::file && stat.size == 5, "stat of a file");
+        check(client.stat("/a").kind == Protocol::Kind::folder, "stat of a folder");
+        check(client.stat("/").kind == Protocol::Kind::folder, "stat of the root");
+
+        auto page = client.list("/a", "", 2);
+        check(page.entries.size() == 2 && page.cursor == "x", "the first page");
+        check(page.entries[0].name == "b" && page.entries[0].kind == Protocol::Kind::folder, "b");
+        page = client.list("/a", page.cursor, 2);
+        check(page.entries.size() == 1 && page.entries[0].name == "y", "the last page");
+        check(page.cursor.empty(), "no cursor after the last page");
+        check(client.list("/a").size() == 3, "every child");
+
+        // A range beyond the end is cut short rather than failing
+        check(client.read("/a/x", 1, 3) == "ell", "a read inside the content");
+        check(client.read("/a/x", 3, 100) == "lo", "a read past the end");
+        check(client.read("/a/x", 100, 1).empty(), "a read after the end");
+
+        check(client.remove("/a/y") && !client.remove("/a/y"), "remove");
+        check_throws<invalid_argument>([&] { client.get("/a/missing"); }, "a missing file");
+        check_throws<invalid_argument>([&] { client.list("/missing"); }, "a missing folder");
+        check_throws<runtime_error>([&] { client.get("/a"); }, "a get of a folder");
+        check_throws<runtime_error>(
+            [&] { client.create("/a", Protocol::Kind::file, "x", "", false); }, "a taken name"
+        );
+        check(client.is_connected(), "failures keep the connection");
+        check(client.get("/a/x") == "hello", "a get after failures");
+    }
+
+    void server_answers_raw_frames()
+    {
+        FileSystem fs{ FileSystem::Synchronization::per_folder_locks };
+        fs.create(Folder{ "a" });
+        fs.create(File{ "x", "hello" }, "/a");
+        fs.create(Folder{ "b" });
+        fs.create(File{ "y", "yy" }, "/b");
+        Server server{ fs, { .port = 0, .thread_count = 1 } };
+        server.start();
+        Socket socket = Socket::connect("127.0.0.1", server.port());
+
+        // Pipelined in one send and answered in order
+        socket.send_all(
+            request_frame(1, [](Protocol::Writer& request) { add_get(request, "/a/x"); })
+            + request_frame(2, [](Protocol::Writer& request) { add_get(request, "/a/missing"); })
+            + request_frame(3, [](Protocol::Writer& request) { add_get(request, "a/x"); })
+            + request_frame(4, [](Protocol::Writer& request) { request.add_byte(0xFF); })
+        );
+        const pair<uint32_t, Protocol::Status> expected[] = {
+            { 1, Protocol::Status::ok },
+            { 2, Protocol::Status::not_found },
+            { 3, Protocol::Status::bad_request },
+            { 4, Protocol::Status::bad_request },
+        };
+        for (const auto& [id, status] : expected) {
+            const auto frame = receive_frame(socket);
+            check(!frame.empty(), "a response to every pipelined frame");
+            Protocol::Reader response{ frame };
+            check(response.read_integer() == id, "responses in order");
+            check(read_status(response) == status, "the status of " + to_string(id));
+            if (status == Protocol::Status::ok) {
+                check(response.read_string() == "hello", "the pipelined get");
+            }
+        }
+
+        // Lookups grouped by folder around a create, one of them in a missing folder
+        const auto batch = request_frame(5, [](Protocol::Writer& request) {
+            request.add_byte(static_cast<uint8_t>(Protocol::Opcode::batch)).add_integer(7);
+            const auto add_body = [&request](const function<void(Protocol::Writer&)>& add) {
+                const auto mark = request.begin_string();
+                add(request);
+                request.end_string(mark);
+            };
+            add_body([](Protocol::Writer& body) { add_get(body, "/a/x"); });
+            add_body([](Protocol::Writer& body) { add_get(body, "/missing/x"); });
+            add_body([](Protocol::Writer& body) { add_get(body, "/b/y"); });
+            add_body([](Protocol::Writer& body) {
+                body.add_byte(static_cast<uint8_t>(Protocol::Opcode::read)).add_string("/a/x");
+                body.add_long(3).add_integer(10);
+            });
+            add_body([](Protocol::Writer& body) {
+                body.add_byte(static_cast<uint8_t>(Protocol::Opcode::create)).add_string("/a");
+                body.add_byte(static_cast<uint8_t>(Protocol::Kind::file)).add_string("z");
+                body.add_byte(0).add_string("zz");
+            });
+            add_body([](Protocol::Writer& body) { add_get(body, "/a/z"); });
+            add_body([](Protocol::Writer& body) {
+                body.add_byte(static_cast<uint8_t>(Protocol::Opcode::stat)).add_string("/a");
+            });
+        });
+        socket.send_all(batch);
+        const auto frame = receive_frame(socket);
+        Protocol::Reader response{ frame };
+        check(response.read_integer() == 5, "the id of the batch");
+        check(read_status(response) == Protocol::Status::ok, "the status of the batch");
+        check(response.read_integer() == 7, "a response for every request of the batch");
+        vector<string> results;
+        for (int index = 0; index < 7; ++index) {
+            results.emplace_back(response.read_string());
+        }
+        check(response.at_end(), "nothing after the batch");
+        const auto content_of = [](string_view result) {
+            Protocol::Reader reader{ result };
+            check(read_status(reader) == Protocol::Status::ok, "the status of a lookup");
+            return string{ reader.read_string() };
+        };
+        check(content_of(results[0]) == "hello", "the first lookup of the batch");
+        Protocol::Reader missing{ results[1] };
+        check(read_status(missing) == Protocol::Status::not_found, "a lookup in a missing folder");
+        check(content_of(results[2]) == "yy", "a lookup in another folder");
+        check(content_of(results[3]) == "lo", "a read of the batch cut short");
+        Protocol::Reader created{ results[4] };
+        check(read_status(created) == Protocol::Status::ok && created.at_end(), "the create");
+        check(content_of(results[5]) == "zz", "a lookup after the create sees it");
+        Protocol::Reader stat{ results[6] };
+        check(read_status(stat) == Protocol::Status::ok, "the stat of the batch");
+        check(static_cast<Protocol::Kind>(stat.read_byte()) == Protocol::Kind::folder, "folder");
+
+        // Names no folder can hold are rejected before anything is created
+        const auto create_named = [](uint32_t id, string_view name) {
+            return request_frame(id, [name](Protocol::Writer& request) {
+                request.add_byte(static_cast<uint8_t>(Protocol::Opcode::create)).add_string("/a");
+                request.add_byte(static_cast<uint8_t>(Protocol::Kind::folder)).add_string(name);
+                request.add_byte(0);
+            });
+        };
+        socket.send_all(
+            create_named(6, "") + create_named(7, ".") + create_named(8, "..")
+            + create_named(9, "c/d")
+        );
+        for (uint32_t id = 6; id <= 9; ++id) {
+            const auto frame = receive_frame(socket);
+            Protocol::Reader response{ frame };
+            check(response.read_integer() == id, "responses to invalid names in order");
+            check(read_status(response) == Protocol::Status::bad_request, "an invalid name");
+        }
+        check(names_of(fs.get_folder("/a")) == "x z", "no folder of an invalid name");
+
+        // Nothing after a frame of invalid size can be framed, so the connection is closed
+        string oversized = request_frame(10, [](Protocol::Writer& request) { add_get(request, "/"); });
+        const auto size = Protocol::max_frame_size + 1;
+        for (size_t byte = 0; byte < sizeof(size); ++byte) {
+            oversized[byte] = static_cast<char>((size >> (byte * 8)) & 0xFF);
+        }
+        socket.send_all(oversized);
+        check(receive_frame(socket).empty(), "a malformed frame closes the connection");
+    }
+}  // namespace
+
 int main()
 {
-    FileSystem fs;
-    fs.create(File{ "file1", "file1" });
-    fs.create(Folder{ "folder1" });
-    fs.change_directory("folder1");
-    fs.create(File{ "file2", "file2" });
-    fs.create(File{ "file3", "file3" }, "..");
-
-    return 0;
+    const pair<const char*, void (*)()> tests[] = {
+        { "create_relative_to_working_directory", create_relative_to_working_directory },
+        { "apply_rolls_back_a_failed_batch", apply_rolls_back_a_failed_batch },
+        { "snapshot_round_trip", snapshot_round_trip },
+        { "snapshot_rejects_corrupt_images", snapshot_rejects_corrupt_images },
+        { "log_replays_up_to_a_torn_tail", log_replays_up_to_a_torn_tail },
+        { "log_follows_folder_and_file_changes", log_follows_folder_and_file_changes },
+        { "lock_free_readers_beside_writers", lock_free_readers_beside_writers },
+        { "chunked_edits_at_chunk_boundaries", chunked_edits_at_chunk_boundaries },
+        { "list_resumes_across_changes", list_resumes_across_changes },
+        { "totals_follow_every_change", totals_follow_every_change },
+        { "move_file_keeps_the_index", move_file_keeps_the_index },
+        { "path_cache_follows_changes", path_cache_follows_changes },
+        { "static_paths_match_runtime_paths", static_paths_match_runtime_paths },
+        { "assign_a_descendant", assign_a_descendant },
+        { "deduplication_shares_blobs", deduplication_shares_blobs },
+        { "glob_patterns", glob_patterns },
+        { "server_answers_a_client", server_answers_a_client },
+        { "server_answers_raw_frames", server_answers_raw_frames },
+    };
+
+    int failed = 0;
+    for (const auto& [name, test] : tests) {
+        try {
+            test();
+        } catch (const exception& error) {
+            cerr << name << " failed: " << error.what() << '\n';
+            ++failed;
+        }
+    }
+
+    cerr << size(tests) - failed << " of " << size(tests) << " tests passed\n";
+    return failed == 0 ? 0 : 1;
 }
@@ -0,0 +1,166 @@
+#include "trace.h"
+
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using std::array;
+using std::atomic;
+using std::lock_guard;
+using std::make_unique;
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::memory_order_release;
+using std::mutex;
+using std::size_t;
+using std::string;
+using std::uint64_t;
+using std::unique_ptr;
+using std::vector;
+
+namespace
+{
+    // A seqlock: the sequence is odd while the thread writes the event, readers retry or skip
+    struct Event
+    {
+        atomic<uint64_t> sequence = 0;
+        atomic<const char*> name = nullptr;
+        atomic<uint64_t> start = 0;
+        atomic<uint64_t> duration = 0;
+    };
+
+    struct Ring
+    {
+        explicit Ring(size_t id) noexcept : id(id)
+        {}
+
+        const size_t id;
+        // Only the owning thread writes it
+        atomic<uint64_t> written = 0;
+        array<Event, server::Tracer::ring_size> events;
+    };
+
+    // The rings outlive their threads, a new thread takes over a released one
+    struct Registry
+    {
+        mutex rings_mutex;
+        vector<unique_ptr<Ring>> rings;
+        vector<Ring*> released_rings;
+    };
+
+    Registry& registry()
+    {
+        // Never destroyed, threads may release their rings after the static destructors ran
+        static auto* const registry = new Registry;
+        return *registry;
+    }
+
+    class RingLease
+    {
+    public:
+        RingLease()
+        {
+            Registry& rings = registry();
+            lock_guard<mutex> lock{ rings.rings_mutex };
+            if (!rings.released_rings.empty()) {
+                m_ring = rings.released_rings.back();
+                rings.released_rings.pop_back();
+            } else {
+                m_ring = rings.rings.emplace_back(make_unique<Ring>(rings.rings.size())).get();
+            }
+        }
+
+        RingLease(const RingLease&) = delete;
+
+        ~RingLease()
+        {
+            Registry& rings = registry();
+            lock_guard<mutex> lock{ rings.rings_mutex };
+            rings.released_rings.push_back(m_ring);
+        }
+
+        RingLease& operator=(const RingLease&) = delete;
+
+        Ring& ring() const noexcept
+        {
+            return *m_ring;
+        }
+    private:
+        Ring* m_ring;
+    };
+
+    void append_number(string& output, uint64_t value)
+    {
+        char buffer[24];
+        const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        output.append(buffer, result.ptr);
+    }
+
+    // Chrome wants microseconds, the fraction keeps the nanoseconds
+    void append_microseconds(string& output, uint64_t nanoseconds)
+    {
+        append_number(output, nanoseconds / 1000);
+        const auto fraction = nanoseconds % 1000;
+        output += '.';
+        output += static_cast<char>('0' + fraction / 100);
+        output += static_cast<char>('0' + fraction / 10 % 10);
+        output += static_cast<char>('0' + fraction % 10);
+    }
+}  // namespace
+
+void server::Tracer::record(const char* name, uint64_t start, uint64_t duration) noexcept
+{
+    thread_local const RingLease lease;
+    Ring& ring = lease.ring();
+    const auto written = ring.written.load(memory_order_relaxed);
+    Event& event = ring.events[written % ring_size];
+
+    const auto sequence = event.sequence.load(memory_order_relaxed);
+    event.sequence.store(sequence + 1, memory_order_relaxed);
+    std::atomic_thread_fence(memory_order_release);
+    event.name.store(name, memory_order_relaxed);
+    event.start.store(start, memory_order_relaxed);
+    event.duration.store(duration, memory_order_relaxed);
+    event.sequence.store(sequence + 2, memory_order_release);
+    ring.written.store(written + 1, memory_order_release);
+}
+
+void server::Tracer::write_chrome_trace(string& output)
+{
+    Registry& rings = registry();
+    lock_guard<mutex> lock{ rings.rings_mutex };
+    output.append("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    bool first = true;
+    for (const auto& ring : rings.rings) {
+        const auto written = ring->written.load(memory_order_acquire);
+        const auto begin = written > ring_size ? written - ring_size : 0;
+        for (auto index = begin; index < written; ++index) {
+            const Event& event = ring->events[index % ring_size];
+            const auto sequence = event.sequence.load(memory_order_acquire);
+            const char* name = event.name.load(memory_order_relaxed);
+            const auto start = event.start.load(memory_order_relaxed);
+            const auto duration = event.duration.load(memory_order_relaxed);
+            std::atomic_thread_fence(memory_order_acquire);
+            // Skips an event the thread is writing or wrote over meanwhile
+            if (sequence % 2 != 0 || event.sequence.load(memory_order_relaxed) != sequence
+                || name == nullptr) {
+                continue;
+            }
+
+            output.append(first ? "\n" : ",\n");
+            first = false;
+            // The names are trace point names, which need no escaping
+            output.append("{\"name\":\"").append(name).append("\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+            append_number(output, ring->id);
+            output.append(",\"ts\":");
+            append_microseconds(output, start);
+            output.append(",\"dur\":");
+            append_microseconds(output, duration);
+            output += '}';
+        }
+    }
+    output.append("\n]}\n");
+}
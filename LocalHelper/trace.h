@@ -0,0 +1,81 @@
+#pragma once
+#ifndef TRACE_H_
+#  define TRACE_H_
+#  include <cstddef>
+#  include <cstdint>
+
+#  include <chrono>
+#  include <string>
+
+namespace server
+{
+    // Trace points record spans in builds with LOCAL_HELPER_TRACING defined and are left out of
+    // the others, so that they compile to the same code as without them
+#  ifdef LOCAL_HELPER_TRACING
+    inline constexpr bool tracing_enabled = true;
+#    define LOCAL_HELPER_TRACE(name) const ::server::TraceSpan local_helper_trace_span{ name }
+#  else
+    inline constexpr bool tracing_enabled = false;
+#    define LOCAL_HELPER_TRACE(name) static_cast<void>(0)
+#  endif
+
+    // The latest spans of every thread, each in a ring of its own which only that thread writes
+    // and dumping reads without stopping it
+    class Tracer
+    {
+    public:
+        // Older spans of a thread are overwritten
+        static constexpr std::size_t ring_size = 4096;
+
+        // name must outlive the tracer, e.g. a string literal
+        static void record(const char* name, std::uint64_t start, std::uint64_t duration) noexcept;
+        // Appends the spans in the rings in the Chrome trace event format, which Perfetto opens
+        static void write_chrome_trace(std::string& output);
+        // Nanoseconds on the clock of the spans
+        static inline std::uint64_t now() noexcept;
+    };
+
+    // Records the time until it is destroyed as a span called name, a string literal. Trace
+    // points use LOCAL_HELPER_TRACE instead.
+    class TraceSpan
+    {
+    public:
+        inline explicit TraceSpan(const char* name) noexcept;
+        TraceSpan(const TraceSpan&) = delete;
+        inline ~TraceSpan();
+
+        TraceSpan& operator=(const TraceSpan&) = delete;
+#  ifdef LOCAL_HELPER_TRACING
+    private:
+        const char* m_name;
+        std::uint64_t m_start;
+#  endif
+    };
+
+    inline std::uint64_t Tracer::now() noexcept
+    {
+        using std::chrono::duration_cast;
+        using std::chrono::nanoseconds;
+        using std::chrono::steady_clock;
+
+        const auto time = steady_clock::now().time_since_epoch();
+        return static_cast<std::uint64_t>(duration_cast<nanoseconds>(time).count());
+    }
+
+#  ifdef LOCAL_HELPER_TRACING
+    inline TraceSpan::TraceSpan(const char* name) noexcept : m_name(name), m_start(Tracer::now())
+    {}
+
+    inline TraceSpan::~TraceSpan()
+    {
+        Tracer::record(m_name, m_start, Tracer::now() - m_start);
+    }
+#  else
+    inline TraceSpan::TraceSpan(const char*) noexcept
+    {}
+
+    inline TraceSpan::~TraceSpan()
+    {}
+#  endif
+}  // namespace server
+#endif  // !TRACE_H_
@@ -0,0 +1,186 @@
+#include "traversal.h"
+using std::current_exception;
+using std::function;
+using std::lock_guard;
+using std::max;
+using std::memory_order_acquire;
+using std::memory_order_acq_rel;
+using std::memory_order_relaxed;
+using std::memory_order_release;
+using std::rethrow_exception;
+using std::size_t;
+using std::uint32_t;
+using std::unique_lock;
+
+server::TraversalPool::TraversalPool(size_t thread_count) : m_workers(thread_count + 1)
+{
+    m_threads.reserve(thread_count);
+    for (size_t worker = 0; worker < thread_count; ++worker) {
+        m_threads.emplace_back([this, worker] { work(worker); });
+    }
+}
+
+server::TraversalPool::~TraversalPool()
+{
+    {
+        lock_guard lock(m_mutex);
+        m_stopping = true;
+    }
+    m_job_ready.notify_all();
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+server::TraversalPool& server::TraversalPool::shared()
+{
+    static TraversalPool pool;
+    return pool;
+}
+
+size_t server::TraversalPool::default_thread_count() noexcept
+{
+    return max(std::thread::hardware_concurrency(), 1U) - 1;
+}
+
+void server::TraversalPool::for_each(
+    const Folder& root,
+    const function<void(const FileBase&, size_t)>& visitor
+)
+{
+    lock_guard run_lock(m_run_mutex);
+    const size_t caller = m_workers.size() - 1;
+    m_visitor = &visitor;
+    m_failed.store(false, memory_order_relaxed);
+    m_exception = nullptr;
+    m_pending.store(1, memory_order_relaxed);
+    push(root, caller);
+    {
+        lock_guard lock(m_mutex);
+        ++m_generation;
+    }
+    m_job_ready.notify_all();
+
+    drain(caller);
+    {
+        unique_lock lock(m_mutex);
+        m_job_done.wait(lock, [this] { return m_active_threads == 0; });
+    }
+    m_visitor = nullptr;
+
+    if (m_exception) {
+        rethrow_exception(m_exception);
+    }
+}
+
+void server::TraversalPool::work(size_t worker)
+{
+    size_t finished_generation = 0;
+    while (true) {
+        {
+            unique_lock lock(m_mutex);
+            m_job_ready.wait(lock, [this, finished_generation] {
+                return m_stopping || m_generation != finished_generation;
+            });
+            if (m_stopping) {
+                return;
+            }
+            finished_generation = m_generation;
+            ++m_active_threads;
+        }
+
+        drain(worker);
+
+        {
+            lock_guard lock(m_mutex);
+            --m_active_threads;
+        }
+        m_job_done.notify_all();
+    }
+}
+
+void server::TraversalPool::drain(size_t worker)
+{
+    while (true) {
+        // Read before looking for work, so a folder queued after the look ends the wait
+        const uint32_t signal = m_work_signal.load(memory_order_acquire);
+        if (m_pending.load(memory_order_acquire) == 0) {
+            return;
+        }
+
+        const Folder* folder = pop(worker);
+        if (folder == nullptr) {
+            m_work_signal.wait(signal, memory_order_acquire);
+            continue;
+        }
+
+        visit(*folder, worker);
+        if (m_pending.fetch_sub(1, memory_order_acq_rel) == 1) {
+            signal_work();
+        }
+    }
+}
+
+void server::TraversalPool::visit(const Folder& folder, size_t worker)
+{
+    for (const auto& file : folder) {
+        if (file.kind() == FileBase::Kind::folder) {
+            m_pending.fetch_add(1, memory_order_relaxed);
+            push(file.to_actually_type<Folder>(), worker);
+        }
+
+        if (m_failed.load(memory_order_relaxed)) {
+            continue;
+        }
+        try {
+            (*m_visitor)(file, worker);
+        } catch (...) {
+            lock_guard lock(m_mutex);
+            if (!m_exception) {
+                m_exception = current_exception();
+            }
+            m_failed.store(true, memory_order_relaxed);
+        }
+    }
+}
+
+void server::TraversalPool::push(const Folder& folder, size_t worker)
+{
+    {
+        auto& [mutex, folders] = m_workers[worker];
+        lock_guard lock(mutex);
+        folders.push_back(&folder);
+    }
+    signal_work();
+}
+
+void server::TraversalPool::signal_work() noexcept
+{
+    m_work_signal.fetch_add(1, memory_order_release);
+    m_work_signal.notify_all();
+}
+
+const server::Folder* server::TraversalPool::pop(size_t worker)
+{
+    {
+        auto& [mutex, folders] = m_workers[worker];
+        lock_guard lock(mutex);
+        if (!folders.empty()) {
+            const Folder* folder = folders.back();
+            folders.pop_back();
+            return folder;
+        }
+    }
+
+    for (size_t offset = 1; offset < m_workers.size(); ++offset) {
+        auto& [mutex, folders] = m_workers[(worker + offset) % m_workers.size()];
+        lock_guard lock(mutex);
+        if (!folders.empty()) {
+            const Folder* folder = folders.front();
+            folders.pop_front();
+            return folder;
+        }
+    }
+
+    return nullptr;
+}
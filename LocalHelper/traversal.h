@@ -0,0 +1,191 @@
+#pragma once
+#ifndef TRAVERSAL_H_
+#  define TRAVERSAL_H_
+#  include <cstddef>
+#  include <cstdint>
+
+#  include <atomic>
+#  include <concepts>
+#  include <condition_variable>
+#  include <deque>
+#  include <exception>
+#  include <functional>
+#  include <mutex>
+#  include <thread>
+#  include <type_traits>
+#  include <utility>
+#  include <vector>
+
+#  include "filesystem.h"
+
+namespace server
+{
+    // Tell the traversals how to run, like the policies of <execution>. Those pull in the
+    // parallel algorithms of libstdc++, which need TBB.
+    struct SequencedPolicy
+    {};
+
+    struct ParallelPolicy
+    {};
+
+    inline constexpr SequencedPolicy sequenced{};
+    inline constexpr ParallelPolicy parallel{};
+
+    template <typename Policy>
+    concept traversal_policy = std::same_as<std::remove_cvref_t<Policy>, SequencedPolicy>
+                               || std::same_as<std::remove_cvref_t<Policy>, ParallelPolicy>;
+
+    // Work-stealing pool walking a folder tree with one task per folder. Every worker works on
+    // its own deque depth first and steals the oldest folders of the others when it runs dry.
+    class TraversalPool
+    {
+    public:
+        explicit TraversalPool(std::size_t thread_count = default_thread_count());
+        TraversalPool(const TraversalPool&) = delete;
+        ~TraversalPool();
+
+        TraversalPool& operator=(const TraversalPool&) = delete;
+
+        static TraversalPool& shared();
+        static std::size_t default_thread_count() noexcept;
+        // The pool threads plus the calling thread, a visitor is told which one it runs on
+        inline std::size_t worker_count() const noexcept;
+        // Calls visitor concurrently for every file and folder below root and rethrows the first
+        // exception it threw. Calls are serialized, a visitor must not start another one.
+        void for_each(
+            const Folder& root,
+            const std::function<void(const FileBase&, std::size_t)>& visitor
+        );
+    private:
+        struct Worker
+        {
+            std::mutex mutex;
+            std::deque<const Folder*> folders;
+        };
+
+        void work(std::size_t worker);
+        void drain(std::size_t worker);
+        void visit(const Folder& folder, std::size_t worker);
+        void push(const Folder& folder, std::size_t worker);
+        // Wakes the workers waiting for a folder to be queued or the last one to be visited
+        void signal_work() noexcept;
+        const Folder* pop(std::size_t worker);
+
+        std::vector<Worker> m_workers;
+        std::mutex m_run_mutex;
+        std::mutex m_mutex;
+        std::condition_variable m_job_ready;
+        std::condition_variable m_job_done;
+        std::size_t m_generation = 0;
+        std::size_t m_active_threads = 0;
+        bool m_stopping = false;
+        const std::function<void(const FileBase&, std::size_t)>* m_visitor = nullptr;
+        // Folders queued or being visited in the current call
+        std::atomic<std::size_t> m_pending = 0;
+        // Changes whenever a folder is queued or the call runs out of folders, idle workers
+        // wait on it
+        std::atomic<std::uint32_t> m_work_signal = 0;
+        std::atomic<bool> m_failed = false;
+        std::exception_ptr m_exception;
+        std::vector<std::thread> m_threads;
+    };
+
+    // Calls visitor(file, worker) for every file below root matching predicate. With a parallel
+    // policy both run concurrently on TraversalPool::shared(), worker tells the threads apart.
+    template <typename Policy, typename Predicate, typename Visitor>
+    void for_each_file(
+        Policy&&,
+        const Folder& root,
+        Predicate&& predicate,
+        Visitor&& visitor
+    )
+    requires traversal_policy<Policy>;
+
+    template <typename Policy, typename Predicate>
+    std::vector<std::reference_wrapper<const File>>
+    find_files(Policy&& policy, const Folder& root, Predicate&& predicate)
+    requires traversal_policy<Policy>;
+
+    inline std::size_t TraversalPool::worker_count() const noexcept
+    {
+        return m_workers.size();
+    }
+
+    template <typename Policy, typename Predicate, typename Visitor>
+    void for_each_file(
+        Policy&&,
+        const Folder& root,
+        Predicate&& predicate,
+        Visitor&& visitor
+    )
+    requires traversal_policy<Policy>
+    {
+        using std::is_same_v;
+        using std::remove_cvref_t;
+        using std::size_t;
+        using std::vector;
+
+        if constexpr (is_same_v<remove_cvref_t<Policy>, SequencedPolicy>) {
+            vector<const Folder*> unvisited_folders{ &root };
+            while (!unvisited_folders.empty()) {
+                const Folder& folder = *unvisited_folders.back();
+                unvisited_folders.pop_back();
+                for (const auto& file : folder) {
+                    if (file.kind() == FileBase::Kind::folder) {
+                        unvisited_folders.push_back(&file.to_actually_type<Folder>());
+                    } else if (predicate(file.to_actually_type<File>())) {
+                        visitor(file.to_actually_type<File>(), size_t{ 0 });
+                    }
+                }
+            }
+        } else {
+            TraversalPool::shared().for_each(root, [&](const FileBase& file, size_t worker) {
+                if (file.kind() != FileBase::Kind::file) {
+                    return;
+                }
+                if (const File& found_file = file.to_actually_type<File>(); predicate(found_file)) {
+                    visitor(found_file, worker);
+                }
+            });
+        }
+    }
+
+    template <typename Policy, typename Predicate>
+    std::vector<std::reference_wrapper<const File>>
+    find_files(Policy&& policy, const Folder& root, Predicate&& predicate)
+    requires traversal_policy<Policy>
+    {
+        using std::forward;
+        using std::reference_wrapper;
+        using std::size_t;
+        using std::vector;
+
+        vector<vector<reference_wrapper<const File>>> found_files_per_worker(
+            TraversalPool::shared().worker_count()
+        );
+        for_each_file(
+            forward<Policy>(policy),
+            root,
+            forward<Predicate>(predicate),
+            [&found_files_per_worker](const File& file, size_t worker) {
+                found_files_per_worker[worker].emplace_back(file);
+            }
+        );
+
+        size_t found_file_count = 0;
+        for (const auto& found_files : found_files_per_worker) {
+            found_file_count += found_files.size();
+        }
+
+        vector<reference_wrapper<const File>> found_files;
+        found_files.reserve(found_file_count);
+        for (const auto& worker_found_files : found_files_per_worker) {
+            found_files.insert(
+                found_files.end(), worker_found_files.begin(), worker_found_files.end()
+            );
+        }
+
+        return found_files;
+    }
+}  // namespace server
+#endif  // !TRAVERSAL_H_
@@ -0,0 +1,578 @@
+#include "wal.h"
+
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#ifdef _WIN32
+#  include <io.h>
+#else
+#  include <unistd.h>
+#endif
+
+#include "filesystem.h"
+#include "trace.h"
+using std::array;
+using std::function;
+using std::in_place_type;
+using std::lock_guard;
+using std::move;
+using std::pair;
+using std::runtime_error;
+using std::shared_ptr;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::uint32_t;
+using std::uint64_t;
+using std::unique_lock;
+using std::variant;
+using std::vector;
+namespace filesystem = std::filesystem;
+
+namespace
+{
+    // Every record is preceded by its size and CRC, the size takes 8 bytes as the content of a
+    // single file may be larger than 4 GiB
+    constexpr size_t record_header_size = sizeof(uint64_t) + sizeof(uint32_t);
+
+    constexpr array<uint32_t, 256> crc_table = [] {
+        array<uint32_t, 256> table{};
+        for (uint32_t index = 0; index < table.size(); ++index) {
+            uint32_t crc = index;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc & 1) != 0 ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+            }
+            table[index] = crc;
+        }
+        return table;
+    }();
+
+    uint32_t crc32(string_view data) noexcept
+    {
+        uint32_t crc = 0xFFFFFFFF;
+        for (const char c : data) {
+            crc = crc_table[(crc ^ static_cast<unsigned char>(c)) & 0xFF] ^ (crc >> 8);
+        }
+        return crc ^ 0xFFFFFFFF;
+    }
+
+    template <typename Integer>
+    void append_integer(string& data, Integer value)
+    {
+        for (size_t byte = 0; byte < sizeof(Integer); ++byte) {
+            data += static_cast<char>((value >> (byte * 8)) & 0xFF);
+        }
+    }
+
+    template <typename Integer>
+    Integer parse_integer(string_view data) noexcept
+    {
+        Integer value = 0;
+        for (size_t byte = 0; byte < sizeof(Integer); ++byte) {
+            value |= Integer{ static_cast<unsigned char>(data[byte]) } << (byte * 8);
+        }
+        return value;
+    }
+
+    // Number of a file named <prefix><number><suffix>
+    bool parse_numbered_name(string_view name, string_view prefix, string_view suffix,
+                             uint64_t& number)
+    {
+        if (!name.starts_with(prefix) || !name.ends_with(suffix)) {
+            return false;
+        }
+
+        name = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+        const auto [end, error] = std::from_chars(name.data(), name.data() + name.size(), number);
+        return error == std::errc{} && end == name.data() + name.size();
+    }
+
+    void synchronize_file(std::FILE* file)
+    {
+#ifdef _WIN32
+        const bool synchronized = _commit(_fileno(file)) == 0;
+#else
+        const bool synchronized = fsync(fileno(file)) == 0;
+#endif
+        if (!synchronized) {
+            throw runtime_error{ "Cannot synchronize the log." };
+        }
+    }
+
+    // Cuts file back to size bytes, false if that failed
+    bool truncate_file(std::FILE* file, uint64_t size) noexcept
+    {
+#ifdef _WIN32
+        return _chsize_s(_fileno(file), static_cast<long long>(size)) == 0;
+#else
+        return ftruncate(fileno(file), static_cast<off_t>(size)) == 0;
+#endif
+    }
+
+    enum NodeKind : uint64_t
+    {
+        file,
+        folder
+    };
+}  // namespace
+
+server::WriteAheadLog::Record::Record(RecordType type)
+{
+    m_data += static_cast<char>(type);
+}
+
+server::WriteAheadLog::Record& server::WriteAheadLog::Record::add(uint64_t value)
+{
+    append_integer(m_data, value);
+    return *this;
+}
+
+server::WriteAheadLog::Record& server::WriteAheadLog::Record::add(string_view value)
+{
+    add(uint64_t{ value.size() });
+    m_data += value;
+    return *this;
+}
+
+server::WriteAheadLog::Record& server::WriteAheadLog::Record::add(const FileBase& file)
+{
+    using folder_iterator = Folder::const_iterator;
+
+    const auto add_node = [this](const FileBase& node) {
+        if (node.kind() == FileBase::Kind::file) {
+            const File& file = node.to_actually_type<File>();
+            add(uint64_t{ NodeKind::file }).add(node.name()).add_content(file);
+            return false;
+        }
+
+        const Folder& folder = node.to_actually_type<Folder>();
+        add(uint64_t{ NodeKind::folder }).add(node.name());
+        add(uint64_t(std::distance(folder.begin(), folder.end())));
+        return true;
+    };
+
+    if (!add_node(file)) {
+        return *this;
+    }
+
+    // Children follow their folder in pre-order
+    const Folder& root = file.to_actually_type<Folder>();
+    vector<pair<folder_iterator, folder_iterator>> unvisited_files{ { root.begin(), root.end() } };
+    while (!unvisited_files.empty()) {
+        auto& [iter, end] = unvisited_files.back();
+        if (iter == end) {
+            unvisited_files.pop_back();
+            continue;
+        }
+
+        const FileBase& child = *iter;
+        ++iter;
+        if (add_node(child)) {
+            const Folder& folder = child.to_actually_type<Folder>();
+            unvisited_files.emplace_back(folder.begin(), folder.end());
+        }
+    }
+
+    return *this;
+}
+
+server::WriteAheadLog::Record& server::WriteAheadLog::Record::add_content(const File& file)
+{
+    add(uint64_t{ file.size() });
+    file.for_each_shared_chunk(
+        0, file.size(), [this](const shared_ptr<const void>&, string_view piece) {
+            m_data += piece;
+        }
+    );
+    return *this;
+}
+
+server::WriteAheadLog::RecordReader::RecordReader(string_view data) : m_data(data)
+{
+    if (m_data.empty()) {
+        throw runtime_error{ "The log record is corrupted." };
+    }
+
+    m_type = static_cast<RecordType>(m_data.front());
+    m_data.remove_prefix(1);
+}
+
+uint64_t server::WriteAheadLog::RecordReader::read_integer()
+{
+    if (m_data.size() < sizeof(uint64_t)) {
+        throw runtime_error{ "The log record is corrupted." };
+    }
+
+    const auto value = parse_integer<uint64_t>(m_data);
+    m_data.remove_prefix(sizeof(uint64_t));
+    return value;
+}
+
+string_view server::WriteAheadLog::RecordReader::read_string()
+{
+    const uint64_t size = read_integer();
+    if (size > m_data.size()) {
+        throw runtime_error{ "The log record is corrupted." };
+    }
+
+    const auto value = m_data.substr(0, size);
+    m_data.remove_prefix(size);
+    return value;
+}
+
+variant<server::File, server::Folder> server::WriteAheadLog::RecordReader::read_file()
+{
+    using HowToHandle = Folder::HowToHandleFilesWithTheSameName;
+
+    const uint64_t kind = read_integer();
+    const string_view name = read_string();
+    if (kind == NodeKind::file) {
+        return variant<File, Folder>{ in_place_type<File>, name, string{ read_string() } };
+    }
+    if (kind != NodeKind::folder) {
+        throw runtime_error{ "The log record is corrupted." };
+    }
+
+    variant<File, Folder> file{ in_place_type<Folder>, name };
+    // Folders still missing children with the number of them
+    vector<pair<Folder*, uint64_t>> unfinished_folders{ { &get<Folder>(file), read_integer() } };
+    while (!unfinished_folders.empty()) {
+        auto& [folder, remaining_children] = unfinished_folders.back();
+        if (remaining_children == 0) {
+            unfinished_folders.pop_back();
+            continue;
+        }
+
+        --remaining_children;
+        Folder& parent = *folder;
+        const uint64_t child_kind = read_integer();
+        const string_view child_name = read_string();
+        if (child_kind == NodeKind::file) {
+            parent.add(File{ child_name, string{ read_string() } }, HowToHandle::throw_exception);
+        } else if (child_kind == NodeKind::folder) {
+            Folder& child = parent.add(Folder{ child_name }, HowToHandle::throw_exception);
+            unfinished_folders.emplace_back(&child, read_integer());
+        } else {
+            throw runtime_error{ "The log record is corrupted." };
+        }
+    }
+
+    return file;
+}
+
+server::WriteAheadLog::Checkpoint::Checkpoint(
+    const WriteAheadLog& log,
+    uint64_t base_segment,
+    uint64_t segment
+)
+    : m_log(log)
+    , m_base_snapshot(log.snapshot_of(base_segment))
+    , m_first_segment(std::max<uint64_t>(base_segment, 1))
+    , m_segment(segment)
+    , m_snapshot(log.snapshot_path(segment))
+{}
+
+void server::WriteAheadLog::Checkpoint::replay(const function<void(RecordReader&)>& function) const
+{
+    m_log.replay_segments(m_first_segment, m_segment, function);
+}
+
+server::WriteAheadLog::WriteAheadLog(const filesystem::path& directory, const Options& options)
+    : m_directory(directory)
+    , m_options(options)
+{
+    filesystem::create_directories(m_directory);
+
+    uint64_t last_segment = 0;
+    bool has_snapshot = false;
+    for (const auto& entry : filesystem::directory_iterator{ m_directory }) {
+        const string name = entry.path().filename().string();
+        uint64_t number = 0;
+        if (parse_numbered_name(name, "wal.", ".log", number)) {
+            last_segment = std::max(last_segment, number);
+        } else if (parse_numbered_name(name, "snapshot.", ".img", number)) {
+            m_snapshot_segment = has_snapshot ? std::max(m_snapshot_segment, number) : number;
+            has_snapshot = true;
+        } else if (parse_numbered_name(name, "snapshot.", ".img.tmp", number)) {
+            // Left by a checkpoint that did not finish
+            std::error_code error;
+            filesystem::remove(entry.path(), error);
+        }
+    }
+
+    // A torn record can only end a segment, so writing always starts a new one
+    m_segment = std::max(last_segment, m_snapshot_segment);
+    open_next_segment();
+
+    if (m_options.durability != Durability::every_commit) {
+        m_flusher = std::thread{ [this] { run_flusher(); } };
+    }
+}
+
+server::WriteAheadLog::~WriteAheadLog()
+{
+    {
+        lock_guard lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake_flusher.notify_all();
+    if (m_flusher.joinable()) {
+        m_flusher.join();
+    }
+    if (m_checkpointer.joinable()) {
+        m_checkpointer.join();
+    }
+
+    try {
+        unique_lock lock(m_mutex);
+        flush_all(lock);
+    } catch (const runtime_error&) {
+        // Nothing left to report the failure to
+    }
+    std::fclose(m_file);
+}
+
+filesystem::path server::WriteAheadLog::latest_snapshot() const
+{
+    lock_guard lock(m_mutex);
+    return snapshot_of(m_snapshot_segment);
+}
+
+void server::WriteAheadLog::replay(const function<void(RecordReader&)>& function) const
+{
+    replay_segments(std::max<uint64_t>(m_snapshot_segment, 1), m_segment, function);
+}
+
+void server::WriteAheadLog::commit(const Record& record)
+{
+    LOCAL_HELPER_TRACE("WriteAheadLog::commit");
+    const string_view data = record.data();
+    unique_lock lock(m_mutex);
+    append_integer(m_buffer, static_cast<uint64_t>(data.size()));
+    append_integer(m_buffer, crc32(data));
+    m_buffer += data;
+    m_size_since_checkpoint += data.size() + record_header_size;
+    const uint64_t sequence = ++m_appended;
+    if (m_options.durability != Durability::every_commit) {
+        return;
+    }
+
+    // Group commit: whoever finds no flush running writes out the records of all waiting ones
+    while (m_written < sequence) {
+        if (m_flushing) {
+            m_flushed.wait(lock);
+        } else {
+            flush(lock, true);
+        }
+    }
+}
+
+bool server::WriteAheadLog::should_checkpoint() const
+{
+    lock_guard lock(m_mutex);
+    return m_size_since_checkpoint >= m_options.checkpoint_size;
+}
+
+void server::WriteAheadLog::checkpoint(function<void(const Checkpoint&)> write_snapshot)
+{
+    LOCAL_HELPER_TRACE("WriteAheadLog::checkpoint");
+    lock_guard checkpoint_lock(m_checkpoint_mutex);
+    if (m_checkpointer.joinable()) {
+        m_checkpointer.join();
+    }
+
+    uint64_t base_segment = 0;
+    uint64_t segment = 0;
+    {
+        unique_lock lock(m_mutex);
+        flush_all(lock);
+        open_next_segment();
+        base_segment = m_snapshot_segment;
+        segment = m_segment;
+        m_size_since_checkpoint = 0;
+    }
+
+    const Checkpoint work{ *this, base_segment, segment };
+    m_checkpointer = std::thread{ [this, work, write_snapshot = move(write_snapshot)] {
+        try {
+            write_snapshot(work);
+            {
+                lock_guard lock(m_mutex);
+                m_snapshot_segment = work.m_segment;
+            }
+            // Only once the snapshot is on the disk are the segments it replaces dropped
+            remove_files_before(work.m_segment);
+        } catch (const std::exception&) {
+            // The log still holds everything, the next checkpoint tries again
+        }
+    } };
+}
+
+filesystem::path server::WriteAheadLog::segment_path(uint64_t segment) const
+{
+    return m_directory / ("wal." + std::to_string(segment) + ".log");
+}
+
+filesystem::path server::WriteAheadLog::snapshot_path(uint64_t segment) const
+{
+    return m_directory / ("snapshot." + std::to_string(segment) + ".img");
+}
+
+filesystem::path server::WriteAheadLog::snapshot_of(uint64_t base_segment) const
+{
+    const auto path = snapshot_path(base_segment);
+    if (base_segment == 0 || !filesystem::exists(path)) {
+        return {};
+    }
+
+    return path;
+}
+
+void server::WriteAheadLog::replay_segments(
+    uint64_t first,
+    uint64_t last,
+    const function<void(RecordReader&)>& function
+) const
+{
+    LOCAL_HELPER_TRACE("WriteAheadLog::replay");
+    for (uint64_t segment = first; segment < last; ++segment) {
+        std::ifstream input{ segment_path(segment), std::ios::binary };
+        if (!input) {
+            continue;
+        }
+
+        std::ostringstream content;
+        content << input.rdbuf();
+        const string data = move(content).str();
+        string_view remaining = data;
+        while (remaining.size() >= record_header_size) {
+            const auto size = parse_integer<uint64_t>(remaining);
+            const auto crc = parse_integer<uint32_t>(remaining.substr(sizeof(uint64_t)));
+            remaining.remove_prefix(record_header_size);
+            if (size > remaining.size() || crc32(remaining.substr(0, size)) != crc) {
+                break;
+            }
+
+            RecordReader record{ remaining.substr(0, size) };
+            function(record);
+            remaining.remove_prefix(size);
+        }
+    }
+}
+
+void server::WriteAheadLog::open_next_segment()
+{
+    const auto path = segment_path(m_segment + 1);
+    std::FILE* file = std::fopen(path.string().c_str(), "ab");
+    if (file == nullptr) {
+        throw runtime_error{ "Cannot open " + path.string() };
+    }
+
+    // Unbuffered, so a failed write leaves nothing behind in stdio to be written out later
+    std::setvbuf(file, nullptr, _IONBF, 0);
+    if (m_file != nullptr) {
+        std::fclose(m_file);
+    }
+    m_file = file;
+    ++m_segment;
+    m_file_size = 0;
+    m_torn = false;
+}
+
+void server::WriteAheadLog::flush(unique_lock<std::mutex>& lock, bool synchronize)
+{
+    LOCAL_HELPER_TRACE("WriteAheadLog::flush");
+    if (m_torn) {
+        open_next_segment();
+    }
+
+    m_flushing = true;
+    string buffer;
+    buffer.swap(m_buffer);
+    const uint64_t sequence = m_appended;
+    const uint64_t file_size = m_file_size;
+    std::FILE* file = m_file;
+    lock.unlock();
+
+    bool written = std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size()
+                   && std::fflush(file) == 0;
+    if (written && synchronize) {
+        try {
+            synchronize_file(file);
+        } catch (const runtime_error&) {
+            written = false;
+        }
+    }
+    // Part of a record left at the end would stop the replay of the segment before the records
+    // written after it
+    const bool torn = !written && !truncate_file(file, file_size);
+
+    lock.lock();
+    m_flushing = false;
+    if (written) {
+        m_written = std::max(m_written, sequence);
+        m_file_size += buffer.size();
+    } else {
+        // The next flush writes them again, ahead of the records appended meanwhile
+        buffer += m_buffer;
+        m_buffer = move(buffer);
+        m_torn = torn;
+        if (m_torn) {
+            try {
+                open_next_segment();
+            } catch (const runtime_error&) {
+                // The next flush tries again before writing
+            }
+        }
+    }
+    m_flushed.notify_all();
+    if (!written) {
+        throw runtime_error{ "Cannot write the log." };
+    }
+}
+
+void server::WriteAheadLog::flush_all(unique_lock<std::mutex>& lock)
+{
+    while (m_flushing || m_written < m_appended) {
+        if (m_flushing) {
+            m_flushed.wait(lock);
+        } else {
+            flush(lock, m_options.durability != Durability::none);
+        }
+    }
+}
+
+void server::WriteAheadLog::run_flusher()
+{
+    unique_lock lock(m_mutex);
+    while (!m_stopping) {
+        m_wake_flusher.wait_for(lock, m_options.flush_interval);
+        if (!m_flushing && m_written < m_appended) {
+            try {
+                flush(lock, m_options.durability == Durability::batched);
+            } catch (const runtime_error&) {
+                // Retried with the next interval and reported by the destructor at the latest
+            }
+        }
+    }
+}
+
+void server::WriteAheadLog::remove_files_before(uint64_t segment) const
+{
+    for (const auto& entry : filesystem::directory_iterator{ m_directory }) {
+        const string name = entry.path().filename().string();
+        uint64_t number = 0;
+        if ((parse_numbered_name(name, "wal.", ".log", number)
+             || parse_numbered_name(name, "snapshot.", ".img", number))
+            && number < segment) {
+            std::error_code error;
+            filesystem::remove(entry.path(), error);
+        }
+    }
+}
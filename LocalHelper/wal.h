@@ -0,0 +1,200 @@
+#pragma once
+#ifndef WAL_H_
+#  define WAL_H_
+#  include <cstdint>
+#  include <cstdio>
+
+#  include <chrono>
+#  include <condition_variable>
+#  include <filesystem>
+#  include <functional>
+#  include <mutex>
+#  include <string>
+#  include <string_view>
+#  include <thread>
+#  include <variant>
+
+namespace server
+{
+    class FileBase;
+    class File;
+    class Folder;
+
+    // Append-only log of file system changes, split into numbered segments. A checkpoint writes
+    // a snapshot of everything before a segment, after which the older segments are dropped.
+    class WriteAheadLog
+    {
+    public:
+        // What a crash may lose. Only every_commit makes commit wait, until its record is fsynced
+        // together with those committed meanwhile.
+        enum class Durability
+        {
+            // Written out every flush_interval without fsync, a crash of the machine loses what
+            // the system did not write back
+            none,
+            // Written out and fsynced every flush_interval, a crash loses at most that interval
+            batched,
+            every_commit
+        };
+
+        enum class RecordType : std::uint8_t
+        {
+            create,
+            remove,
+            rename,
+            change_content,
+            batch,
+            move_file,
+            assign,
+            write,
+            truncate
+        };
+
+        struct Options
+        {
+            Durability durability = Durability::batched;
+            // How often the records are written out unless every commit waits for them
+            std::chrono::milliseconds flush_interval{ 10 };
+            // should_checkpoint turns true once the log has grown by this many bytes
+            std::uint64_t checkpoint_size = std::uint64_t{ 64 } << 20;
+        };
+
+        class Record
+        {
+        public:
+            explicit Record(RecordType type);
+
+            Record& add(std::uint64_t value);
+            Record& add(std::string_view value);
+            // Adds file with everything below it
+            Record& add(const FileBase& file);
+            // Adds the content of file like a string, chunk by chunk
+            Record& add_content(const File& file);
+            inline std::string_view data() const noexcept;
+        private:
+            std::string m_data;
+        };
+
+        // Reads back the fields of a record in the order they were added
+        class RecordReader
+        {
+        public:
+            explicit RecordReader(std::string_view data);
+
+            inline RecordType type() const noexcept;
+            std::uint64_t read_integer();
+            std::string_view read_string();
+            std::variant<File, Folder> read_file();
+        private:
+            std::string_view m_data;
+            RecordType m_type;
+        };
+
+        // What a checkpoint running in the background writes its snapshot from
+        class Checkpoint
+        {
+            friend class WriteAheadLog;
+        public:
+            // Snapshot of the state before the records, empty if there is none
+            inline const std::filesystem::path& base_snapshot() const noexcept;
+            // Calls function for every intact record after base_snapshot and before the segment
+            // the checkpoint started
+            void replay(const std::function<void(RecordReader&)>& function) const;
+            // Where the snapshot of the state after the records goes
+            inline const std::filesystem::path& snapshot() const noexcept;
+        private:
+            Checkpoint(const WriteAheadLog& log, std::uint64_t base_segment, std::uint64_t segment);
+
+            const WriteAheadLog& m_log;
+            std::filesystem::path m_base_snapshot;
+            std::uint64_t m_first_segment;
+            std::uint64_t m_segment;
+            std::filesystem::path m_snapshot;
+        };
+
+        WriteAheadLog(const std::filesystem::path& directory, const Options& options);
+        WriteAheadLog(const WriteAheadLog&) = delete;
+        // Writes out and fsyncs every record, waits for a running checkpoint
+        ~WriteAheadLog();
+
+        WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+        // Snapshot the recovery starts from, empty if there is none
+        std::filesystem::path latest_snapshot() const;
+        // Calls function for every intact record after the latest snapshot
+        void replay(const std::function<void(RecordReader&)>& function) const;
+        // Thread-safe, concurrent commits are fsynced together
+        void commit(const Record& record);
+        bool should_checkpoint() const;
+        // Thread-safe, starts a new segment and calls write_snapshot in the background to write
+        // the snapshot for everything before it. The snapshot has to be on the disk when it
+        // returns, the segments it replaces are dropped then.
+        void checkpoint(std::function<void(const Checkpoint&)> write_snapshot);
+    private:
+        std::filesystem::path segment_path(std::uint64_t segment) const;
+        std::filesystem::path snapshot_path(std::uint64_t segment) const;
+        // The latest snapshot if it is that of base_segment, else empty
+        std::filesystem::path snapshot_of(std::uint64_t base_segment) const;
+        // Calls function for every intact record of the segments in [first, last)
+        void replay_segments(
+            std::uint64_t first,
+            std::uint64_t last,
+            const std::function<void(RecordReader&)>& function
+        ) const;
+        // Switches writing to the segment after m_segment
+        void open_next_segment();
+        void flush(std::unique_lock<std::mutex>& lock, bool synchronize);
+        void flush_all(std::unique_lock<std::mutex>& lock);
+        void run_flusher();
+        void remove_files_before(std::uint64_t segment) const;
+
+        std::filesystem::path m_directory;
+        Options m_options;
+        // First segment not contained in the latest snapshot, guarded by m_mutex once a
+        // checkpoint runs
+        std::uint64_t m_snapshot_segment = 0;
+        std::uint64_t m_segment = 0;
+        std::FILE* m_file = nullptr;
+        // Bytes of m_file holding whole records
+        std::uint64_t m_file_size = 0;
+        // A failed write left part of a record at the end of m_file
+        bool m_torn = false;
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_flushed;
+        std::condition_variable m_wake_flusher;
+        std::string m_buffer;
+        // Sequence numbers of the last record appended and the last one written out
+        std::uint64_t m_appended = 0;
+        std::uint64_t m_written = 0;
+        bool m_flushing = false;
+        bool m_stopping = false;
+        std::uint64_t m_size_since_checkpoint = 0;
+        std::thread m_flusher;
+        // Guards m_checkpointer, commits go on while a checkpoint starts
+        std::mutex m_checkpoint_mutex;
+        std::thread m_checkpointer;
+    };
+
+    inline std::string_view WriteAheadLog::Record::data() const noexcept
+    {
+        return m_data;
+    }
+
+    inline WriteAheadLog::RecordType WriteAheadLog::RecordReader::type() const noexcept
+    {
+        return m_type;
+    }
+
+    inline const std::filesystem::path&
+    WriteAheadLog::Checkpoint::base_snapshot() const noexcept
+    {
+        return m_base_snapshot;
+    }
+
+    inline const std::filesystem::path& WriteAheadLog::Checkpoint::snapshot() const noexcept
+    {
+        return m_snapshot;
+    }
+}  // namespace server
+#endif  // !WAL_H_